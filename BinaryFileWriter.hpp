@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstddef>
+#include <cassert>
+#include <string>
+
+// Base of the writers of binary files that announce their record count in the header, PLY and .npy exports:
+// the header, then exactly that many records of a fixed size, Close() fails on fewer
+class BinaryFileWriter
+{
+    protected:
+    FILE* file = nullptr;
+    size_t record_size = 0;
+    size_t n_records = 0;
+    size_t n_written = 0;
+    bool ok = false;
+    bool Open(const std::string& path, const std::string& header, size_t record_size, size_t n_records)
+    {
+        assert(file == nullptr);
+        file = fopen(path.c_str(), "wb");
+        if(file == nullptr)
+            return false;
+        // the large writes of the body go straight to the file
+        setvbuf(file, nullptr, _IONBF, 0);
+        this->record_size = record_size;
+        this->n_records = n_records;
+        n_written = 0;
+        ok = fwrite(header.data(), header.size(), 1, file) == 1;
+        return ok;
+    }
+    bool WriteRecords(const void* records, size_t n)
+    {
+        assert(file != nullptr);
+        assert(n_written + n <= n_records);
+        if(n != 0)
+            ok = ok && fwrite(records, n * record_size, 1, file) == 1;
+        n_written += n;
+        return ok;
+    }
+    public:
+    BinaryFileWriter(const BinaryFileWriter&) = delete;
+    BinaryFileWriter& operator=(const BinaryFileWriter&) = delete;
+    BinaryFileWriter() {}
+    ~BinaryFileWriter()
+    {
+        if(file != nullptr)
+            fclose(file);
+    }
+    bool Close()
+    {
+        assert(file != nullptr);
+        ok = (fclose(file) == 0) && ok && n_written == n_records;
+        file = nullptr;
+        return ok;
+    }
+};
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+
+#ifdef POINTS_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef POINTS_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "Trace.hpp"
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "PagedCloud.hpp"
+
+// gzip and zstd compressed text files, told apart by their magic bytes and parsed while they are decompressed
+// A thread of its own decompresses the mapped file into newline aligned blocks of COMPRESSED_TEXT_BLOCK_SIZE,
+// the parser workers take them from a bounded queue, so the decompressed text never exists as a whole
+// and decompressing and parsing overlap; the thread only lives for the duration of the load
+// Support for each format is compiled in with POINTS_HAS_ZLIB and POINTS_HAS_ZSTD (see the Makefile)
+
+// same as the chunks of uncompressed text
+constexpr size_t COMPRESSED_TEXT_BLOCK_SIZE = 4 << 20;
+// blocks decompressed ahead of the parsers, per worker
+constexpr size_t COMPRESSED_TEXT_QUEUE_BLOCKS_PER_WORKER = 2;
+// how much smaller the text of a compressed file is assumed to be, for estimates only
+constexpr size_t ASSUMED_TEXT_COMPRESSION_RATIO = 3;
+// zlib counts its input in 32 bits
+constexpr size_t GZIP_INPUT_PIECE = 1 << 30;
+
+enum class TextCompression
+{
+    None,
+    Gzip,
+    Zstd,
+};
+
+inline TextCompression DetectTextCompression(const char* data, size_t size)
+{
+    static constexpr uint8_t GZIP_MAGIC[2] = {0x1f, 0x8b};
+    static constexpr uint8_t ZSTD_MAGIC[4] = {0x28, 0xb5, 0x2f, 0xfd};
+    if(size >= sizeof(GZIP_MAGIC) && memcmp(data, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0)
+        return TextCompression::Gzip;
+    if(size >= sizeof(ZSTD_MAGIC) && memcmp(data, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0)
+        return TextCompression::Zstd;
+    return TextCompression::None;
+}
+
+inline bool IsTextCompressionSupported(TextCompression compression)
+{
+#ifdef POINTS_HAS_ZLIB
+    if(compression == TextCompression::Gzip)
+        return true;
+#endif
+#ifdef POINTS_HAS_ZSTD
+    if(compression == TextCompression::Zstd)
+        return true;
+#endif
+    return compression == TextCompression::None;
+}
+
+inline const char* GetTextCompressionName(TextCompression compression)
+{
+    switch(compression)
+    {
+        case TextCompression::Gzip: return "gzip";
+        case TextCompression::Zstd: return "zstd";
+        default: return "uncompressed";
+    }
+}
+
+// Size of the text in a compressed file of size bytes, exact if the format records it
+inline size_t EstimateDecompressedSize(const char* data, size_t size, TextCompression compression)
+{
+#ifdef POINTS_HAS_ZSTD
+    if(compression == TextCompression::Zstd)
+    {
+        // single frame files made by the zstd tool record it
+        unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+        if(content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+            return content_size;
+    }
+#endif
+    // gzip's trailer only holds the size modulo 2^32, too little for the files this is about
+    return (compression == TextCompression::None) ? size : size * ASSUMED_TEXT_COMPRESSION_RATIO;
+}
+
+#ifdef POINTS_HAS_ZLIB
+
+// Streams the decompressed bytes of a gzip file out of [data, data + size), concatenated members included
+class GzipReader
+{
+    protected:
+    z_stream stream = {};
+    const uint8_t* data;
+    size_t size;
+    bool initialized = false;
+    bool ended = false;
+    public:
+    GzipReader(const GzipReader&) = delete;
+    GzipReader& operator=(const GzipReader&) = delete;
+    GzipReader(const char* data, size_t size)
+    {
+        this->data = (const uint8_t*)data;
+        this->size = size;
+        // 32 makes zlib expect a gzip header
+        initialized = inflateInit2(&stream, 15 + 32) == Z_OK;
+        stream.next_in = (Bytef*)this->data;
+        stream.avail_in = 0;
+    }
+    ~GzipReader()
+    {
+        if(initialized)
+            inflateEnd(&stream);
+    }
+    // Fills out with up to out_size bytes and returns how many, 0 once the stream has ended
+    // Returns SIZE_MAX if the stream is corrupt or truncated
+    size_t Read(char* out, size_t out_size)
+    {
+        if(!initialized)
+            return SIZE_MAX;
+        stream.next_out = (Bytef*)out;
+        stream.avail_out = std::min<size_t>(out_size, UINT_MAX);
+        while(stream.avail_out != 0 && !ended)
+        {
+            if(stream.avail_in == 0)
+            {
+                // the input ran out before the end of the member
+                if(GetConsumed() == size)
+                    return SIZE_MAX;
+                stream.avail_in = std::min(GZIP_INPUT_PIECE, size - GetConsumed());
+            }
+            int result = inflate(&stream, Z_NO_FLUSH);
+            if(result == Z_STREAM_END)
+            {
+                // another member may follow, anything else after the first one is ignored like gzip does
+                size_t consumed = GetConsumed();
+                if(size - consumed >= 2 && data[consumed] == 0x1f && data[consumed + 1] == 0x8b)
+                    inflateReset(&stream);
+                else
+                    ended = true;
+            }
+            else if(result != Z_OK && result != Z_BUF_ERROR)
+                return SIZE_MAX;
+        }
+        return (char*)stream.next_out - out;
+    }
+    size_t GetConsumed()
+    {
+        return stream.next_in - data;
+    }
+};
+
+#endif
+
+#ifdef POINTS_HAS_ZSTD
+
+// Streams the decompressed bytes of a zstd file out of [data, data + size), every frame of it
+class ZstdReader
+{
+    protected:
+    ZSTD_DStream* stream;
+    ZSTD_inBuffer input;
+    // 0 after a complete frame
+    size_t last_result = 0;
+    bool ended = false;
+    public:
+    ZstdReader(const ZstdReader&) = delete;
+    ZstdReader& operator=(const ZstdReader&) = delete;
+    ZstdReader(const char* data, size_t size)
+    {
+        stream = ZSTD_createDStream();
+        if(stream != nullptr)
+            ZSTD_initDStream(stream);
+        input = {data, size, 0};
+    }
+    ~ZstdReader()
+    {
+        if(stream != nullptr)
+            ZSTD_freeDStream(stream);
+    }
+    // Same contract as GzipReader::Read()
+    size_t Read(char* out, size_t out_size)
+    {
+        if(stream == nullptr)
+            return SIZE_MAX;
+        ZSTD_outBuffer output = {out, out_size, 0};
+        // a finished frame with no input left is the end, calling the decoder again would wait for another frame
+        ended = ended || (input.pos == input.size && last_result == 0);
+        while(output.pos != output.size && !ended)
+        {
+            size_t previous = output.pos;
+            last_result = ZSTD_decompressStream(stream, &output, &input);
+            if(ZSTD_isError(last_result))
+                return SIZE_MAX;
+            if(input.pos == input.size && last_result == 0)
+                ended = true;
+            // all input is in, the frame is unfinished and nothing more comes out
+            else if(input.pos == input.size && output.pos == previous)
+                return SIZE_MAX;
+        }
+        return output.pos;
+    }
+    size_t GetConsumed()
+    {
+        return input.pos;
+    }
+};
+
+#endif
+
+struct TextBlock
+{
+    std::vector<char> text;
+    // position in the file, blocks are numbered in order
+    size_t index;
+    // compressed bytes read up to the end of the block
+    size_t consumed;
+};
+
+// Hands blocks from one thread to others, Push() waits while it is full and Pop() while it is empty
+class TextBlockQueue
+{
+    protected:
+    std::mutex mx;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<TextBlock> blocks;
+    size_t capacity;
+    bool closed = false;
+    public:
+    TextBlockQueue(size_t capacity)
+    {
+        this->capacity = capacity;
+    }
+    // Returns false, dropping the block, if the queue was closed
+    bool Push(TextBlock&& block)
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        not_full.wait(lock, [&]() {return blocks.size() < capacity || closed;});
+        if(closed)
+            return false;
+        blocks.push_back(std::move(block));
+        not_empty.notify_one();
+        return true;
+    }
+    // Returns false once the queue is closed and empty
+    bool Pop(TextBlock& block)
+    {
+        std::unique_lock<std::mutex> lock(mx);
+        not_empty.wait(lock, [&]() {return !blocks.empty() || closed;});
+        if(blocks.empty())
+            return false;
+        block = std::move(blocks.front());
+        blocks.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+    // Either end can close it: the producer when it is done, a consumer to stop the producer
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mx);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+// Cuts the output of reader into blocks of about block_size that end after a newline (the last one may not)
+// and passes them to push(TextBlock&&), which returns false to stop
+// Returns false and sets error if the stream is corrupt, false with an empty error if push stopped it
+template<typename Reader, typename PushFn>
+bool SplitDecompressedText(Reader& reader, size_t block_size, PushFn push, std::string& error)
+{
+    TextBlock block = {std::vector<char>(block_size), 0, 0};
+    size_t filled = 0;
+    while(true)
+    {
+        size_t n = reader.Read(block.text.data() + filled, block.text.size() - filled);
+        if(n == SIZE_MAX)
+        {
+            error = "Failed to decompress file, it is corrupt or truncated";
+            return false;
+        }
+        filled += n;
+        if(n == 0 || filled == block.text.size())
+        {
+            size_t cut = filled;
+            if(n != 0)
+            {
+                // a line longer than the whole block makes it grow until the line fits
+                while(cut != 0 && block.text[cut - 1] != '\n')
+                    cut--;
+                if(cut == 0)
+                {
+                    block.text.resize(block.text.size() * 2);
+                    continue;
+                }
+            }
+            // the start of the unfinished line moves on to the next block
+            TextBlock next = {std::vector<char>(std::max(block_size, 2 * (filled - cut))), block.index + 1, 0};
+            memcpy(next.text.data(), block.text.data() + cut, filled - cut);
+            block.text.resize(cut);
+            block.consumed = reader.GetConsumed();
+            if(cut != 0 && !push(std::move(block)))
+                return false;
+            if(n == 0)
+                return true;
+            filled -= cut;
+            block = std::move(next);
+        }
+    }
+}
+
+// Decompresses the text file in [data, data + size) on a thread of its own while the workers parse it
+// parse(const char* begin, const char* end, std::vector<float>& out) parses newline aligned pieces like ParseTextChunk
+// on_block(size_t index, TextParseError error, std::vector<float>& values) gets the result of every block, concurrently
+// and in any order, index being the position of the block in the file; it returns false to stop
+// progress(float) gets the fraction of the compressed bytes whose text has been parsed
+// Returns false and sets error if the file could not be decompressed, errors of the parser only go to on_block
+template<typename ParseFn, typename BlockFn, typename ProgressFn>
+bool ParseCompressedText(const char* data, size_t size, TextCompression compression, ParseFn parse, BlockFn on_block,
+    ProgressFn progress, std::string& error)
+{
+    if(!IsTextCompressionSupported(compression))
+    {
+        error = std::string("Reading ") + GetTextCompressionName(compression) + " compressed files is not supported by this build";
+        return false;
+    }
+    size_t n_workers = GetWorkerCount();
+    TextBlockQueue queue(n_workers * COMPRESSED_TEXT_QUEUE_BLOCKS_PER_WORKER);
+    std::string decompress_error;
+    bool decompressed = false;
+    std::thread decompressor([&]()
+    {
+        TraceScope trace("Decompress");
+        [[maybe_unused]] auto push = [&](TextBlock&& block) {return queue.Push(std::move(block));};
+#ifdef POINTS_HAS_ZLIB
+        if(compression == TextCompression::Gzip)
+        {
+            GzipReader reader(data, size);
+            decompressed = SplitDecompressedText(reader, COMPRESSED_TEXT_BLOCK_SIZE, push, decompress_error);
+        }
+#endif
+#ifdef POINTS_HAS_ZSTD
+        if(compression == TextCompression::Zstd)
+        {
+            ZstdReader reader(data, size);
+            decompressed = SplitDecompressedText(reader, COMPRESSED_TEXT_BLOCK_SIZE, push, decompress_error);
+        }
+#endif
+        queue.Close();
+    });
+    std::atomic<size_t> consumed = 0;
+    ParallelFor(n_workers, [&](size_t)
+    {
+        TextBlock block;
+        while(queue.Pop(block))
+        {
+            TraceScope trace("Parse chunk");
+            std::vector<float> values;
+            values.reserve(block.text.size() / 8);
+            TextParseError parse_error = parse(block.text.data(), block.text.data() + block.text.size(), values);
+            if(!on_block(block.index, parse_error, values))
+                queue.Close();
+            // blocks finish out of order, the progress only moves forward
+            size_t done = consumed;
+            while(done < block.consumed && !consumed.compare_exchange_weak(done, block.consumed));
+            progress(float(consumed) / float(std::max<size_t>(1, size)));
+        }
+    });
+    decompressor.join();
+    if(!decompressed && !decompress_error.empty())
+    {
+        error = decompress_error;
+        return false;
+    }
+    return true;
+}
+
+// Converts the compressed text file at source_path into the paged layout at out_path, see ConvertTextToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertCompressedTextToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error,
+    ProgressFn progress, ChunkFn on_chunk)
+{
+    MappedFile text;
+    if(!text.Open(source_path))
+    {
+        error = "Failed to open file!";
+        return false;
+    }
+    TextCompression compression = DetectTextCompression(text.GetData(), text.GetSize());
+    text.Advise(0, text.GetSize(), MappedFileAdvice::Sequential);
+
+    // 1: parse as it decompresses, appending the raw points to a temporary file in file order
+    std::string raw_path = out_path + ".raw";
+    FILE* raw = fopen(raw_path.c_str(), "wb");
+    if(raw == nullptr)
+    {
+        error = "Failed to create " + raw_path;
+        return false;
+    }
+    auto remove_raw = [&]()
+    {
+        std::error_code ec;
+        std::filesystem::remove(raw_path, ec);
+    };
+    std::mutex mx;
+    // blocks parsed ahead of one that is not done yet
+    std::map<size_t, std::vector<float>> pending;
+    size_t next_index = 0;
+    size_t n = 0;
+    bool write_ok = true;
+    size_t failed_index = SIZE_MAX;
+    TextParseError parse_error = TextParseError::None;
+    bool decompressed = ParseCompressedText(text.GetData(), text.GetSize(), compression,
+        [](const char* begin, const char* end, std::vector<float>& out) {return ParseTextChunk(begin, end, out);},
+        [&](size_t index, TextParseError block_error, std::vector<float>& values)
+        {
+            if(block_error == TextParseError::None)
+                on_chunk(values);
+            std::lock_guard<std::mutex> lock(mx);
+            if(block_error != TextParseError::None)
+            {
+                // the first one in file order is reported, same as for uncompressed text
+                if(index < failed_index)
+                {
+                    failed_index = index;
+                    parse_error = block_error;
+                }
+                return false;
+            }
+            pending[index] = std::move(values);
+            for(auto it = pending.begin(); it != pending.end() && it->first == next_index; it = pending.erase(it), next_index++)
+            {
+                if(!it->second.empty())
+                    write_ok = write_ok && fwrite(it->second.data(), it->second.size() * sizeof(float), 1, raw) == 1;
+                n += it->second.size() / 3;
+            }
+            return true;
+        }, [&](float p) {progress(0.4f * p);}, error);
+    write_ok = (fclose(raw) == 0) && write_ok;
+    text.Close();
+    if(parse_error != TextParseError::None)
+    {
+        remove_raw();
+        error = (parse_error == TextParseError::InvalidFormat) ? "Failed to parse file, invalid format"
+            : "Failed to parse file: invalid value(s) encountered";
+        return false;
+    }
+    if(!decompressed)
+    {
+        remove_raw();
+        return false;
+    }
+    if(!write_ok)
+    {
+        remove_raw();
+        error = "Failed to write " + raw_path;
+        return false;
+    }
+    return ConvertRawToPagedCloud(raw_path, n, {0.0, 0.0, 0.0}, source_path, out_path, error, progress);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Octree.hpp"
+
+// View frustum side planes, extracted from a view-projection matrix (Gribb & Hartmann)
+// The near and far planes are left out: OrbitCamera uses a near plane of 0, which makes both of them
+// degenerate, and points behind the camera are dropped by the side planes anyway
+struct Frustum
+{
+    // a * x + b * y + c * z + d >= 0 inside, left, right, bottom, top
+    float planes[4][4];
+};
+
+enum class FrustumTest
+{
+    Outside,
+    Intersecting,
+    Inside,
+};
+
+// m is column major, as glm and OpenGL store it
+inline Frustum ExtractFrustum(const float* m)
+{
+    auto row = [&](int r, int c) {return m[c * 4 + r];};
+    Frustum f;
+    for(int i = 0; i < 4; i++)
+    {
+        // left: w + x, right: w - x, bottom: w + y, top: w - y
+        int axis = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        for(int c = 0; c < 4; c++)
+            f.planes[i][c] = row(3, c) + sign * row(axis, c);
+    }
+    return f;
+}
+
+inline FrustumTest TestFrustumBox(const Frustum& f, const float* low, const float* high)
+{
+    bool inside = true;
+    for(auto& plane : f.planes)
+    {
+        // the corners furthest along and against the plane normal
+        float furthest = plane[3];
+        float nearest = plane[3];
+        for(int i = 0; i < 3; i++)
+        {
+            float a = plane[i] * low[i];
+            float b = plane[i] * high[i];
+            furthest += std::max(a, b);
+            nearest += std::min(a, b);
+        }
+        if(furthest < 0.0f)
+            return FrustumTest::Outside;
+        if(nearest < 0.0f)
+            inside = false;
+    }
+    return inside ? FrustumTest::Inside : FrustumTest::Intersecting;
+}
+
+// Appends the point ranges of the octree that may be visible to begins/counts, ranges are clipped to [0, limit)
+// Nodes entirely inside the frustum are taken whole without visiting their children, and as a node's
+// points are contiguous, ranges that touch are merged into one
+template<typename Index, typename Count>
+void CullOctree(const std::vector<OctreeNode>& nodes, const Frustum& frustum, size_t limit,
+    std::vector<Index>& begins, std::vector<Count>& counts)
+{
+    if(nodes.empty())
+        return;
+    auto add = [&](const OctreeNode& node)
+    {
+        size_t begin = node.begin;
+        size_t end = std::min(limit, size_t(node.begin) + node.count);
+        if(begin >= end)
+            return;
+        if(!begins.empty() && size_t(begins.back()) + size_t(counts.back()) == begin)
+            counts.back() += Count(end - begin);
+        else
+        {
+            begins.push_back(Index(begin));
+            counts.push_back(Count(end - begin));
+        }
+    };
+    // depth first, children in order, so the ranges come out ascending and can be merged
+    std::vector<uint32_t> stack = {0};
+    while(!stack.empty())
+    {
+        const OctreeNode& node = nodes[stack.back()];
+        stack.pop_back();
+        if(node.begin >= limit)
+            continue;
+        FrustumTest test = TestFrustumBox(frustum, node.low, node.high);
+        if(test == FrustumTest::Outside)
+            continue;
+        if(test == FrustumTest::Inside || IsOctreeLeaf(node))
+        {
+            add(node);
+            continue;
+        }
+        for(uint32_t c = node.first_child + node.n_children; c-- > node.first_child;)
+            stack.push_back(c);
+    }
+}
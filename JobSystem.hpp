@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <string>
+
+#include "Trace.hpp"
+
+// Process wide pool of worker threads, one per core, shared by everything that needs to run in the background
+// Every worker owns a queue: jobs submitted from a worker go to its own queue and are taken from the back
+// (the most recent job, whose data is likely still in cache), idle workers steal from the front of the others
+// Jobs submitted from outside the pool go to a shared queue
+
+// Number of threads used for data parallel work
+inline size_t GetWorkerCount()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+enum class JobPriority
+{
+    // pieces of work somebody is already waiting for, e.g. the parts of a ParallelFor
+    High,
+    // self-contained background work, e.g. loading a file
+    Low,
+};
+constexpr int JOB_PRIORITY_COUNT = 2;
+
+// Counts the unfinished jobs of a group, see JobSystem::Wait
+class JobCounter
+{
+    friend class JobSystem;
+    protected:
+    std::atomic<size_t> pending = 0;
+    public:
+    bool IsDone()
+    {
+        return pending == 0;
+    }
+};
+
+class JobSystem
+{
+    protected:
+    struct Job
+    {
+        std::function<void()> fn;
+        JobCounter* counter;
+    };
+    struct JobQueue
+    {
+        std::mutex mx;
+        std::deque<Job> jobs[JOB_PRIORITY_COUNT];
+    };
+    constexpr static const size_t NOT_A_WORKER = SIZE_MAX;
+    static inline thread_local size_t worker_index = NOT_A_WORKER;
+
+    // queues[0] is the shared queue, queues[i + 1] belongs to worker i
+    std::vector<std::unique_ptr<JobQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> n_queued[JOB_PRIORITY_COUNT] = {};
+    // everything below is protected by sleep_mx
+    std::mutex sleep_mx;
+    std::condition_variable worker_notify;
+    std::condition_variable waiter_notify;
+    size_t n_waiting = 0;
+    bool stopping = false;
+
+    bool HasQueued(JobPriority lowest)
+    {
+        for(int p = 0; p <= int(lowest); p++)
+        {
+            if(n_queued[p] > 0)
+                return true;
+        }
+        return false;
+    }
+    bool Pop(JobQueue& queue, int priority, bool back, Job& out)
+    {
+        std::lock_guard<std::mutex> lock(queue.mx);
+        auto& jobs = queue.jobs[priority];
+        if(jobs.empty())
+            return false;
+        if(back)
+        {
+            out = std::move(jobs.back());
+            jobs.pop_back();
+        }
+        else
+        {
+            out = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        n_queued[priority]--;
+        return true;
+    }
+    // Takes the most urgent job that is at least as urgent as lowest
+    // Within a priority the own queue comes first, then the shared one, then the other workers' queues
+    bool Take(JobPriority lowest, Job& out)
+    {
+        size_t own = (worker_index == NOT_A_WORKER) ? 0 : worker_index + 1;
+        size_t n_workers = workers.size();
+        for(int p = 0; p <= int(lowest); p++)
+        {
+            if(n_queued[p] == 0)
+                continue;
+            if(own != 0 && Pop(*queues[own], p, true, out))
+                return true;
+            if(Pop(*queues[0], p, false, out))
+                return true;
+            // start with the next worker, so that thieves spread out
+            for(size_t i = 0; i < n_workers; i++)
+            {
+                size_t victim = 1 + (own + i) % n_workers;
+                if(victim != own && Pop(*queues[victim], p, false, out))
+                    return true;
+            }
+        }
+        return false;
+    }
+    void Run(Job& job)
+    {
+        job.fn();
+        if(job.counter != nullptr && --job.counter->pending == 0)
+        {
+            std::lock_guard<std::mutex> lock(sleep_mx);
+            waiter_notify.notify_all();
+        }
+    }
+    void WorkerFunction(size_t index)
+    {
+        worker_index = index;
+        Trace::Get().SetThreadName("Worker " + std::to_string(index));
+        while(true)
+        {
+            Job job;
+            if(Take(JobPriority::Low, job))
+            {
+                Run(job);
+                continue;
+            }
+            auto lock = std::unique_lock<std::mutex>(sleep_mx);
+            worker_notify.wait(lock, [this]() {return stopping || HasQueued(JobPriority::Low);});
+            if(stopping)
+                return;
+        }
+    }
+    JobSystem(size_t n_workers)
+    {
+        for(size_t i = 0; i < n_workers + 1; i++)
+            queues.push_back(std::make_unique<JobQueue>());
+        // the queues must all exist before the first worker starts stealing
+        workers.resize(n_workers);
+        for(size_t i = 0; i < n_workers; i++)
+            workers[i] = std::thread(&JobSystem::WorkerFunction, this, i);
+    }
+    public:
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    // Jobs that have not started yet are dropped, everything that is waited for must be waited for before exit
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mx);
+            stopping = true;
+        }
+        worker_notify.notify_all();
+        for(auto& it : workers)
+            it.join();
+    }
+    static JobSystem& Get()
+    {
+        static JobSystem system(GetWorkerCount());
+        return system;
+    }
+    // Jobs waiting to be run, the running ones are not counted
+    size_t GetQueuedJobs(JobPriority priority)
+    {
+        return n_queued[int(priority)];
+    }
+    // Queues fn, counter (optional) is incremented now and decremented once fn has returned
+    void Submit(JobPriority priority, JobCounter* counter, std::function<void()> fn)
+    {
+        if(counter != nullptr)
+            counter->pending++;
+        size_t own = (worker_index == NOT_A_WORKER) ? 0 : worker_index + 1;
+        {
+            JobQueue& queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.mx);
+            queue.jobs[int(priority)].push_back({std::move(fn), counter});
+            n_queued[int(priority)]++;
+        }
+        std::lock_guard<std::mutex> lock(sleep_mx);
+        worker_notify.notify_one();
+        if(n_waiting > 0)
+            waiter_notify.notify_all();
+    }
+    // Blocks until every job of counter has finished
+    // Instead of idling the calling thread runs queued jobs at least as urgent as lowest, which is what keeps
+    // nested waits (a job waiting for its own sub-jobs) from deadlocking the pool
+    void Wait(JobCounter& counter, JobPriority lowest = JobPriority::High)
+    {
+        while(!counter.IsDone())
+        {
+            Job job;
+            if(Take(lowest, job))
+            {
+                Run(job);
+                continue;
+            }
+            auto lock = std::unique_lock<std::mutex>(sleep_mx);
+            n_waiting++;
+            waiter_notify.wait(lock, [&]() {return counter.IsDone() || HasQueued(lowest);});
+            n_waiting--;
+        }
+    }
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "MappedFile.hpp"
+#include "PagedCloud.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define POINTS_LAS_DECODE_X86
+#include <immintrin.h>
+#endif
+
+// ASPRS LAS 1.0 to 1.4 files, point data record formats 0 to 10, read straight from a mapping of the file
+// Every format starts with X, Y, Z as int32 steps of the header's scale away from the header's offset, nothing else is read
+// The points are kept relative to the offset (the origin of the cloud): georeferenced coordinates are far too large
+// for floats to hold them to the millimeter, the distances within a scan are not
+// Compressed files (LAZ) are not supported
+
+constexpr char LAS_MAGIC[4] = {'L', 'A', 'S', 'F'};
+// public header of LAS 1.0 to 1.2, later versions only append to it
+constexpr size_t LAS_MIN_HEADER_SIZE = 227;
+// LAS 1.4 adds 64 bit point counts at the end of its larger header
+constexpr size_t LAS_14_HEADER_SIZE = 375;
+constexpr int LAS_MAX_POINT_FORMAT = 10;
+
+struct LasHeader
+{
+    uint8_t version_major;
+    uint8_t version_minor;
+    uint8_t point_format;
+    uint16_t record_length;
+    size_t n_points;
+    // of the first point record
+    size_t point_offset;
+    double scale[3];
+    double offset[3];
+};
+
+inline bool IsLasFile(const char* data, size_t size)
+{
+    return size >= sizeof(LAS_MAGIC) && memcmp(data, LAS_MAGIC, sizeof(LAS_MAGIC)) == 0;
+}
+
+// Smallest record of every point format, records may be longer with extra bytes appended
+inline size_t GetLasMinRecordLength(int point_format)
+{
+    static constexpr size_t LENGTHS[LAS_MAX_POINT_FORMAT + 1] = {20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67};
+    return LENGTHS[point_format];
+}
+
+// Parses the public header of the LAS file in [data, data + size)
+// Returns false and sets error if the file is broken or its points cannot be read
+inline bool ReadLasHeader(const char* data, size_t size, LasHeader& header, std::string& error)
+{
+    header = LasHeader();
+    if(!IsLasFile(data, size) || size < LAS_MIN_HEADER_SIZE)
+    {
+        error = "Not a LAS file";
+        return false;
+    }
+    // the header is packed, every field is copied out at its offset
+    auto read = [&](size_t offset, auto& out) {memcpy(&out, data + offset, sizeof(out));};
+    uint16_t header_size;
+    uint32_t point_offset;
+    uint32_t legacy_n_points;
+    read(24, header.version_major);
+    read(25, header.version_minor);
+    read(94, header_size);
+    read(96, point_offset);
+    read(104, header.point_format);
+    read(105, header.record_length);
+    read(107, legacy_n_points);
+    for(int i = 0; i < 3; i++)
+    {
+        read(131 + i * 8, header.scale[i]);
+        read(155 + i * 8, header.offset[i]);
+    }
+    header.n_points = legacy_n_points;
+    if(header.version_major == 1 && header.version_minor >= 4 && header_size >= LAS_14_HEADER_SIZE && size >= LAS_14_HEADER_SIZE)
+    {
+        // the legacy count is 0 for the formats added in 1.4 and for more than 2^32 points
+        uint64_t n_points;
+        read(247, n_points);
+        header.n_points = n_points;
+    }
+    header.point_offset = point_offset;
+    // the two high bits mark LAZ compression
+    if(header.point_format & 0xC0)
+    {
+        error = "Compressed LAS (LAZ) files are not supported";
+        return false;
+    }
+    if(header.point_format > LAS_MAX_POINT_FORMAT)
+    {
+        error = "Unsupported LAS point format " + std::to_string(header.point_format);
+        return false;
+    }
+    if(header_size < LAS_MIN_HEADER_SIZE || header.point_offset < header_size
+        || header.record_length < GetLasMinRecordLength(header.point_format))
+    {
+        error = "Invalid LAS header";
+        return false;
+    }
+    for(int i = 0; i < 3; i++)
+    {
+        if(!std::isfinite(header.scale[i]) || header.scale[i] == 0.0 || !std::isfinite(header.offset[i]))
+        {
+            error = "Invalid LAS scale or offset";
+            return false;
+        }
+    }
+    if(header.point_offset > size || header.n_points > (size - header.point_offset) / header.record_length)
+    {
+        error = "File is truncated";
+        return false;
+    }
+    return true;
+}
+
+// Decodes points [first, first + count) of a LAS file mapped at data into out, relative to the header's offset
+// Reference implementation, see DecodeLasPoints()
+inline void DecodeLasPointsScalar(const LasHeader& header, const char* data, size_t first, size_t count, vec3<float>* out)
+{
+    const char* records = data + header.point_offset + first * header.record_length;
+    for(size_t i = 0; i < count; i++)
+    {
+        int32_t xyz[3];
+        memcpy(xyz, records + i * header.record_length, sizeof(xyz));
+        // one rounding, from the exact double product
+        for(int ii = 0; ii < 3; ii++)
+            out[i].data[ii] = float(double(xyz[ii]) * header.scale[ii]);
+    }
+}
+
+#ifdef POINTS_LAS_DECODE_X86
+
+// Gathers X, Y and Z of 8 records at a time and scales them 4 at a time in double, bit-identical to the scalar version
+__attribute__((target("avx2"))) inline void DecodeLasPointsAVX2(const LasHeader& header, const char* data, size_t first,
+    size_t count, vec3<float>* out)
+{
+    const char* records = data + header.point_offset + first * header.record_length;
+    int stride = header.record_length;
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    __m256d scale[3];
+    for(int c = 0; c < 3; c++)
+        scale[c] = _mm256_set1_pd(header.scale[c]);
+    alignas(32) float xyz[3][8];
+    size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        const char* base = records + i * stride;
+        for(int c = 0; c < 3; c++)
+        {
+            __m256i v = _mm256_i32gather_epi32((const int*)(base + c * sizeof(int32_t)), offsets, 1);
+            __m256d low = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v)), scale[c]);
+            __m256d high = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1)), scale[c]);
+            _mm256_store_ps(xyz[c], _mm256_set_m128(_mm256_cvtpd_ps(high), _mm256_cvtpd_ps(low)));
+        }
+        for(int k = 0; k < 8; k++)
+            out[i + k] = vec3<float>{xyz[0][k], xyz[1][k], xyz[2][k]};
+    }
+    DecodeLasPointsScalar(header, data, first + i, count - i, out + i);
+}
+
+#endif
+
+// Decodes points [first, first + count) with the fastest path the CPU supports
+inline void DecodeLasPoints(const LasHeader& header, const char* data, size_t first, size_t count, vec3<float>* out)
+{
+    assert(first + count <= header.n_points);
+#ifdef POINTS_LAS_DECODE_X86
+    static const bool avx2 = []()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }();
+    if(avx2)
+    {
+        DecodeLasPointsAVX2(header, data, first, count, out);
+        return;
+    }
+#endif
+    DecodeLasPointsScalar(header, data, first, count, out);
+}
+
+// Converts the LAS file at source_path into the paged layout at out_path, see ConvertBlocksToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertLasToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk)
+{
+    MappedFile file;
+    LasHeader header;
+    if(!OpenWithHeader(source_path, file, header, ReadLasHeader, error))
+        return false;
+    file.Advise(header.point_offset, header.n_points * header.record_length, MappedFileAdvice::Sequential);
+    return ConvertBlocksToPagedCloud(header.n_points, {header.offset[0], header.offset[1], header.offset[2]},
+        [&](size_t first, size_t count, vec3<float>* out)
+        {
+            DecodeLasPoints(header, file.GetData(), first, count, out);
+            file.Advise(header.point_offset + first * header.record_length, count * header.record_length,
+                MappedFileAdvice::DontNeed);
+            return count;
+        }, source_path, out_path, error, progress, on_chunk);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Frustum.hpp"
+
+// Point budget level of detail over the octree
+// The points of a leaf are in random order (see BuildOctree), so drawing the first k points of a leaf
+// draws a uniform subsample of it; the budget is spread so that every visible leaf gets the same number
+// of points per pixel of its projected size, and leaves with fewer points than their share are drawn whole
+// Raising the target afterwards only adds points, which is what progressive refinement relies on
+
+struct LodLeaf
+{
+    uint32_t node;
+    // points of the leaf that may be drawn, the leaf may not be fully uploaded yet
+    uint32_t available;
+    // projected size in pixels
+    float area;
+    // points to draw, set by AssignLodTargets
+    uint32_t target;
+};
+
+// Appends the leaves of the octree intersecting the frustum, with their projected size
+// view is the column major view matrix, focal the projection's y scale times half the viewport height in pixels
+// Only points below limit count as available
+inline void CollectLodLeaves(const std::vector<OctreeNode>& nodes, const Frustum& frustum, const float* view, float focal,
+    float screen_area, size_t limit, std::vector<LodLeaf>& out)
+{
+    if(nodes.empty())
+        return;
+    auto add = [&](uint32_t index)
+    {
+        const OctreeNode& node = nodes[index];
+        if(node.begin >= limit)
+            return;
+        float center[3];
+        float radius_squared = 0.0f;
+        for(int i = 0; i < 3; i++)
+        {
+            center[i] = (node.low[i] + node.high[i]) * 0.5f;
+            float half = (node.high[i] - node.low[i]) * 0.5f;
+            radius_squared += half * half;
+        }
+        float radius = std::sqrt(radius_squared);
+        // the camera looks down -Z in view space
+        float depth = -(view[2] * center[0] + view[6] * center[1] + view[10] * center[2] + view[14]);
+        float area = screen_area;
+        if(depth > radius)
+        {
+            // a leaf of coincident points still covers a pixel
+            float pixel_radius = std::max(1.0f, radius * focal / depth);
+            area = std::min(screen_area, float(M_PI) * pixel_radius * pixel_radius);
+        }
+        uint32_t available = uint32_t(std::min(size_t(node.count), limit - node.begin));
+        out.push_back({index, available, area, 0});
+    };
+    // (node, known to be inside)
+    std::vector<std::pair<uint32_t, bool>> stack = {{0, false}};
+    while(!stack.empty())
+    {
+        auto [index, inside] = stack.back();
+        stack.pop_back();
+        const OctreeNode& node = nodes[index];
+        if(node.begin >= limit)
+            continue;
+        if(!inside)
+        {
+            FrustumTest test = TestFrustumBox(frustum, node.low, node.high);
+            if(test == FrustumTest::Outside)
+                continue;
+            inside = test == FrustumTest::Inside;
+        }
+        if(IsOctreeLeaf(node))
+        {
+            add(index);
+            continue;
+        }
+        for(uint32_t c = node.first_child + node.n_children; c-- > node.first_child;)
+            stack.push_back({c, inside});
+    }
+}
+
+// Orders leaves by the density at which they are drawn whole, which AssignLodTargets needs
+inline void SortLodLeaves(std::vector<LodLeaf>& leaves)
+{
+    std::sort(leaves.begin(), leaves.end(), [](const LodLeaf& l, const LodLeaf& r)
+    {
+        return float(l.available) / l.area < float(r.available) / r.area;
+    });
+}
+
+// Sets every leaf's target so that they add up to about total, leaves must be sorted with SortLodLeaves
+// For a density d each leaf gets min(available, d * area), d is found by walking the leaves in the order they saturate
+inline void AssignLodTargets(std::vector<LodLeaf>& leaves, size_t total)
+{
+    double area = 0.0;
+    for(auto& it : leaves)
+        area += it.area;
+    double saturated = 0.0;
+    double density = INFINITY;
+    for(auto& it : leaves)
+    {
+        double saturation = double(it.available) / it.area;
+        if(saturated + saturation * area >= double(total))
+        {
+            density = (double(total) - saturated) / area;
+            break;
+        }
+        saturated += it.available;
+        area -= it.area;
+    }
+    for(auto& it : leaves)
+        it.target = uint32_t(std::min(double(it.available), std::round(density * it.area)));
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+enum class MappedFileAdvice
+{
+    Sequential,
+    Random,
+    // start reading the range in the background
+    WillNeed,
+    // the range may be dropped from memory, it is read again from the file when touched
+    DontNeed,
+};
+
+// Memory mapping of a whole file, read-only (Open) or read-write (Create)
+// Read-only pages are mapped privately, so the contents can be handed out as plain pointers for the lifetime of the object
+class MappedFile
+{
+    protected:
+    char* data = nullptr;
+    size_t size = 0;
+    bool writable = false;
+#if defined(_WIN32)
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+    public:
+    bool Open(const std::string& path)
+    {
+        Close();
+#if defined(_WIN32)
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if(file_handle == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER file_size;
+        if(!GetFileSizeEx(file_handle, &file_size))
+        {
+            Close();
+            return false;
+        }
+        size = size_t(file_size.QuadPart);
+        // mapping an empty file is an error on windows, treat it as an empty range instead
+        if(size == 0)
+            return true;
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping_handle == nullptr)
+        {
+            Close();
+            return false;
+        }
+        data = (char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        if(data == nullptr)
+        {
+            Close();
+            return false;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        size = size_t(st.st_size);
+        if(size == 0)
+        {
+            close(fd);
+            return true;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file
+        close(fd);
+        if(mapping == MAP_FAILED)
+        {
+            size = 0;
+            return false;
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = (char*)mapping;
+#endif
+        return true;
+    }
+    // Creates (or truncates) the file at path with the given size and maps it for writing, changes go to the file
+    bool Create(const std::string& path, size_t size)
+    {
+        Close();
+        if(size == 0)
+            return false;
+#if defined(_WIN32)
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file_handle == INVALID_HANDLE_VALUE)
+            return false;
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, DWORD(uint64_t(size) >> 32), DWORD(size), nullptr);
+        if(mapping_handle == nullptr)
+        {
+            Close();
+            return false;
+        }
+        data = (char*)MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, 0);
+        if(data == nullptr)
+        {
+            Close();
+            return false;
+        }
+#else
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+            return false;
+        if(ftruncate(fd, off_t(size)) != 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED)
+            return false;
+        data = (char*)mapping;
+#endif
+        this->size = size;
+        writable = true;
+        return true;
+    }
+    // Writes the changes of a Create()d mapping back to the file
+    bool Flush()
+    {
+        assert(writable);
+#if defined(_WIN32)
+        return FlushViewOfFile(data, 0) != 0;
+#else
+        return msync(data, size, MS_SYNC) == 0;
+#endif
+    }
+    // Hints how [offset, offset + length) is going to be used; DontNeed only releases the pages entirely inside the range
+    // No-op on windows
+    void Advise(size_t offset, size_t length, MappedFileAdvice advice)
+    {
+#if !defined(_WIN32)
+        if(data == nullptr || length == 0)
+            return;
+        size_t page = size_t(sysconf(_SC_PAGESIZE));
+        size_t begin = offset / page * page;
+        size_t end = std::min(size, offset + length);
+        if(advice == MappedFileAdvice::DontNeed)
+        {
+            begin = (offset + page - 1) / page * page;
+            end = end / page * page;
+            if(end <= begin)
+                return;
+        }
+        int flags[] = {MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED};
+        madvise(data + begin, end - begin, flags[int(advice)]);
+#endif
+    }
+    void Close()
+    {
+#if defined(_WIN32)
+        if(data != nullptr)
+            UnmapViewOfFile(data);
+        if(mapping_handle != nullptr)
+            CloseHandle(mapping_handle);
+        if(file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+#else
+        if(data != nullptr)
+            munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+        writable = false;
+    }
+    const char* GetData()
+    {
+        return data;
+    }
+    char* GetWritableData()
+    {
+        assert(writable);
+        return data;
+    }
+    size_t GetSize()
+    {
+        return size;
+    }
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+        Close();
+    }
+};
+
+// Maps the file at path and reads its header with read_header(const char* data, size_t size, Header&, std::string& error),
+// the start of every reader of a point format with a header; returns false and sets error if either fails
+template<typename Header, typename ReadHeaderFn>
+bool OpenWithHeader(const std::string& path, MappedFile& file, Header& header, ReadHeaderFn read_header, std::string& error)
+{
+    if(!file.Open(path))
+    {
+        error = "Failed to open file!";
+        return false;
+    }
+    return read_header(file.GetData(), file.GetSize(), header, error);
+}
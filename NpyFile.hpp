@@ -0,0 +1,251 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "MappedFile.hpp"
+#include "BinaryFileWriter.hpp"
+#include "PagedCloud.hpp"
+
+// NumPy .npy files of shape (N, 3) holding float32 or float64 in either byte order, C or Fortran ordered, read straight
+// from a mapping of the file
+// C ordered little endian float32 is the in-memory layout of the points and gets copied without any conversion,
+// everything else is converted per value
+// The writer produces that layout for points, float64 for points relative to an origin, and 1-D uint64 arrays for index lists
+
+constexpr char NPY_MAGIC[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+// version 1.0 headers store their length in 16 bits, so this bounds them too
+constexpr size_t NPY_MAX_HEADER_SIZE = 1 << 16;
+// numpy aligns the data to this
+constexpr size_t NPY_ALIGNMENT = 64;
+
+struct NpyHeader
+{
+    size_t n_points;
+    // of the first value
+    size_t data_offset;
+    // 4 or 8
+    size_t value_size;
+    bool big_endian;
+    // if set the file holds every x, then every y, then every z
+    bool fortran_order;
+};
+
+inline bool IsNpyFile(const char* data, size_t size)
+{
+    return size >= sizeof(NPY_MAGIC) && memcmp(data, NPY_MAGIC, sizeof(NPY_MAGIC)) == 0;
+}
+
+// Parses the header of the .npy file in [data, data + size)
+// Returns false and sets error if the file is broken or does not hold an (N, 3) float array
+inline bool ReadNpyHeader(const char* data, size_t size, NpyHeader& header, std::string& error)
+{
+    header = NpyHeader();
+    // magic, version, header length
+    if(!IsNpyFile(data, size) || size < 10)
+    {
+        error = "Not a NumPy file";
+        return false;
+    }
+    uint8_t version = data[6];
+    size_t dict_offset;
+    size_t dict_size;
+    if(version == 1)
+    {
+        uint16_t length;
+        memcpy(&length, data + 8, sizeof(length));
+        dict_offset = 10;
+        dict_size = length;
+    }
+    else if((version == 2 || version == 3) && size >= 12)
+    {
+        uint32_t length;
+        memcpy(&length, data + 8, sizeof(length));
+        dict_offset = 12;
+        dict_size = length;
+    }
+    else
+    {
+        error = "Unsupported NumPy file version " + std::to_string(version);
+        return false;
+    }
+    if(dict_size > size - dict_offset)
+    {
+        error = "File is truncated";
+        return false;
+    }
+    header.data_offset = dict_offset + dict_size;
+    // a Python dict literal: {'descr': '<f4', 'fortran_order': False, 'shape': (1000, 3), }
+    std::string dict(data + dict_offset, dict_size);
+    auto find_value = [&](const char* key) -> const char*
+    {
+        size_t pos = dict.find(std::string("'") + key + "'");
+        if(pos == std::string::npos)
+            return nullptr;
+        pos = dict.find(':', pos);
+        if(pos == std::string::npos)
+            return nullptr;
+        pos = dict.find_first_not_of(' ', pos + 1);
+        return (pos == std::string::npos) ? nullptr : dict.c_str() + pos;
+    };
+    const char* descr = find_value("descr");
+    const char* fortran_order = find_value("fortran_order");
+    const char* shape = find_value("shape");
+    if(descr == nullptr || fortran_order == nullptr || shape == nullptr)
+    {
+        error = "Failed to parse NumPy header";
+        return false;
+    }
+    // '<f4', '>f8' and so on, '=' is the native order (little endian everywhere this runs)
+    if(strncmp(descr, "'<f4'", 5) == 0 || strncmp(descr, "'=f4'", 5) == 0 || strncmp(descr, "'>f4'", 5) == 0)
+        header.value_size = 4;
+    else if(strncmp(descr, "'<f8'", 5) == 0 || strncmp(descr, "'=f8'", 5) == 0 || strncmp(descr, "'>f8'", 5) == 0)
+        header.value_size = 8;
+    else
+    {
+        error = "Unsupported NumPy data type, expected float32 or float64";
+        return false;
+    }
+    header.big_endian = descr[1] == '>';
+    if(strncmp(fortran_order, "True", 4) == 0)
+        header.fortran_order = true;
+    else if(strncmp(fortran_order, "False", 5) != 0)
+    {
+        error = "Failed to parse NumPy header";
+        return false;
+    }
+    char* end;
+    unsigned long long n_points = 0;
+    unsigned long long n_columns = 0;
+    if(*shape == '(')
+    {
+        n_points = strtoull(shape + 1, &end, 10);
+        if(end != shape + 1 && *end == ',')
+            n_columns = strtoull(end + 1, &end, 10);
+        while(*end == ' ')
+            end++;
+    }
+    if(n_columns != 3 || *end != ')')
+    {
+        error = "NumPy array must have shape (N, 3)";
+        return false;
+    }
+    header.n_points = n_points;
+    if(header.n_points > (size - header.data_offset) / (3 * header.value_size))
+    {
+        error = "File is truncated";
+        return false;
+    }
+    return true;
+}
+
+// Whether the data of the file is the in-memory layout of the points
+inline bool IsNpyPacked(const NpyHeader& header)
+{
+    return header.value_size == sizeof(float) && !header.big_endian && !header.fortran_order;
+}
+
+// Reads points [first, first + count) of a .npy file mapped at data into out
+// Returns false if any coordinate is NaN, which the text parser rejects as well
+inline bool ReadNpyPoints(const NpyHeader& header, const char* data, size_t first, size_t count, vec3<float>* out)
+{
+    assert(first + count <= header.n_points);
+    const char* values = data + header.data_offset;
+    if(IsNpyPacked(header))
+    {
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        memcpy(out, values + first * sizeof(vec3<float>), count * sizeof(vec3<float>));
+    }
+    else
+    {
+        size_t size = header.value_size;
+        // bytes between consecutive points and between the axes of a point
+        size_t point_stride = header.fortran_order ? size : 3 * size;
+        size_t axis_stride = header.fortran_order ? header.n_points * size : size;
+        auto read = [&](const char* p)
+        {
+            char bytes[8];
+            memcpy(bytes, p, size);
+            if(header.big_endian)
+                std::reverse(bytes, bytes + size);
+            if(size == sizeof(float))
+            {
+                float v;
+                memcpy(&v, bytes, sizeof(v));
+                return v;
+            }
+            double v;
+            memcpy(&v, bytes, sizeof(v));
+            return float(v);
+        };
+        for(size_t i = 0; i < count; i++)
+        {
+            const char* point = values + (first + i) * point_stride;
+            for(int ii = 0; ii < 3; ii++)
+                out[i].data[ii] = read(point + ii * axis_stride);
+        }
+    }
+    bool valid = true;
+    for(size_t i = 0; i < count; i++)
+        valid &= out[i].x == out[i].x && out[i].y == out[i].y && out[i].z == out[i].z;
+    return valid;
+}
+
+// Converts the .npy file at source_path into the paged layout at out_path, see ConvertBlocksToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertNpyToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk)
+{
+    MappedFile file;
+    NpyHeader header;
+    if(!OpenWithHeader(source_path, file, header, ReadNpyHeader, error))
+        return false;
+    size_t data_size = header.n_points * 3 * header.value_size;
+    file.Advise(header.data_offset, data_size, MappedFileAdvice::Sequential);
+    return ConvertBlocksToPagedCloud(header.n_points, {0.0, 0.0, 0.0},
+        [&](size_t first, size_t count, vec3<float>* out)
+        {
+            bool valid = ReadNpyPoints(header, file.GetData(), first, count, out);
+            // Fortran ordered files are read in three places at once, only C ordered ones can drop what is behind
+            if(!header.fortran_order)
+                file.Advise(header.data_offset + first * 3 * header.value_size, count * 3 * header.value_size,
+                    MappedFileAdvice::DontNeed);
+            return valid ? count : SIZE_MAX;
+        }, source_path, out_path, error, progress, on_chunk);
+}
+
+// Writes a version 1.0 .npy file of n_rows rows of n_columns values each, or a 1-D array if n_columns is 0
+// descr is the NumPy type of the values, e.g. "<f4"; rows are written as they are in memory
+// The shape goes in the header, so it has to be known up front, Close() fails if fewer rows were written
+class NpyWriter : public BinaryFileWriter
+{
+    public:
+    bool Open(const std::string& path, const char* descr, size_t value_size, size_t n_rows, size_t n_columns)
+    {
+        std::string shape = (n_columns == 0) ? std::to_string(n_rows) + "," : std::to_string(n_rows) + ", " + std::to_string(n_columns);
+        std::string dict = std::string("{'descr': '") + descr + "', 'fortran_order': False, 'shape': (" + shape + "), }";
+        // padded with spaces and ended by a newline so the data starts aligned
+        size_t prefix = sizeof(NPY_MAGIC) + 4;
+        size_t total = (prefix + dict.size() + 1 + NPY_ALIGNMENT - 1) / NPY_ALIGNMENT * NPY_ALIGNMENT;
+        dict.resize(total - prefix - 1, ' ');
+        dict += '\n';
+        assert(dict.size() < NPY_MAX_HEADER_SIZE);
+        uint16_t length = dict.size();
+        char head[sizeof(NPY_MAGIC) + 4];
+        memcpy(head, NPY_MAGIC, sizeof(NPY_MAGIC));
+        head[6] = 1;
+        head[7] = 0;
+        memcpy(head + 8, &length, sizeof(length));
+        return BinaryFileWriter::Open(path, std::string(head, sizeof(head)) + dict, value_size * std::max<size_t>(1, n_columns), n_rows);
+    }
+    bool Write(const void* rows, size_t n)
+    {
+        return WriteRecords(rows, n);
+    }
+};
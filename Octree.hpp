@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "Parallel.hpp"
+#include "RadixSort.hpp"
+
+// Octree over a point cloud, built by sorting the points along a Morton (Z-order) curve
+// Afterwards every node covers a contiguous range of the points, so a node can be drawn or scanned directly
+// Nodes are stored breadth first in one array, the children of a node are contiguous and follow their parent
+// Within a leaf the points are shuffled, so any prefix of a leaf is a uniform subsample of it (see Lod.hpp)
+
+// bits per axis of the Morton codes, also the deepest possible level
+constexpr int OCTREE_MAX_DEPTH = 10;
+// nodes with more points than this are split
+constexpr uint32_t OCTREE_MAX_LEAF_POINTS = 8192;
+constexpr size_t OCTREE_BLOCK_SIZE = 1 << 16;
+
+struct OctreeNode
+{
+    // tight bounds of the points in the node
+    float low[3];
+    float high[3];
+    // the node's points are [begin, begin + count)
+    uint32_t begin;
+    uint32_t count;
+    // leaves have no children, first_child is 0 for them as the root is nobody's child
+    uint32_t first_child;
+    uint32_t n_children;
+};
+static_assert(sizeof(OctreeNode) == 40, "the node layout is part of the cache format");
+
+inline bool IsOctreeLeaf(const OctreeNode& node)
+{
+    return node.n_children == 0;
+}
+
+// Moves the low 10 bits of v two bits apart
+inline uint32_t SpreadMortonBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Interleaves the coordinates of p quantized to OCTREE_MAX_DEPTH bits, scale maps the bounding box to [0, 1 << OCTREE_MAX_DEPTH]
+inline uint32_t MortonCode(vec3<float> p, vec3<float> low, vec3<float> scale)
+{
+    constexpr float MAX_CELL = float((1 << OCTREE_MAX_DEPTH) - 1);
+    uint32_t q[3];
+    for(int i = 0; i < 3; i++)
+        q[i] = uint32_t(std::clamp((p.data[i] - low.data[i]) * scale.data[i], 0.0f, MAX_CELL));
+    return (SpreadMortonBits(q[0]) << 2) | (SpreadMortonBits(q[1]) << 1) | SpreadMortonBits(q[2]);
+}
+
+// Reorders points into octree order and returns the nodes, low and high must bound all points
+// source_indices receives the permutation: points[i] afterwards is the point that was at source_indices[i] before
+// The Morton codes, the radix sort, the reordering and the leaf bounds are computed in parallel,
+// only the topology (a binary search per child) is built sequentially
+// progress(float) may be called from any thread
+template<typename ProgressFn>
+std::vector<OctreeNode> BuildOctree(std::vector<vec3<float>>& points, std::vector<uint32_t>& source_indices, vec3<float> low,
+    vec3<float> high, ProgressFn progress)
+{
+    struct MortonEntry
+    {
+        uint32_t code;
+        uint32_t index;
+    };
+    size_t n = points.size();
+    assert(n <= UINT32_MAX);
+    std::vector<OctreeNode> nodes;
+    source_indices.clear();
+    if(n == 0)
+    {
+        progress(1.0f);
+        return nodes;
+    }
+    size_t n_blocks = (n + OCTREE_BLOCK_SIZE - 1) / OCTREE_BLOCK_SIZE;
+
+    vec3<float> scale;
+    for(int i = 0; i < 3; i++)
+    {
+        float extent = high.data[i] - low.data[i];
+        scale.data[i] = (extent > 0.0f) ? float(1 << OCTREE_MAX_DEPTH) / extent : 0.0f;
+    }
+    std::vector<MortonEntry> entries(n);
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t end = std::min(n, (b + 1) * OCTREE_BLOCK_SIZE);
+        for(size_t i = b * OCTREE_BLOCK_SIZE; i < end; i++)
+            entries[i] = {MortonCode(points[i], low, scale), uint32_t(i)};
+    });
+    progress(0.1f);
+    RadixSort(entries, [](const MortonEntry& e) {return e.code;}, [&](float p) {progress(0.1f + p * 0.5f);});
+    source_indices.resize(n);
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t end = std::min(n, (b + 1) * OCTREE_BLOCK_SIZE);
+        for(size_t i = b * OCTREE_BLOCK_SIZE; i < end; i++)
+            source_indices[i] = entries[i].index;
+    });
+    progress(0.7f);
+
+    // breadth first, so a node's children can be appended as a block when it is reached
+    std::vector<uint8_t> depths;
+    nodes.push_back({{}, {}, 0, uint32_t(n), 0, 0});
+    depths.push_back(0);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(nodes[i].count <= OCTREE_MAX_LEAF_POINTS || depths[i] == OCTREE_MAX_DEPTH)
+            continue;
+        // the codes in a node share their top 3 * depth bits, the next 3 bits pick the child
+        int shift = 3 * (OCTREE_MAX_DEPTH - 1 - depths[i]);
+        auto begin = entries.begin() + nodes[i].begin;
+        auto end = begin + nodes[i].count;
+        uint32_t first_child = uint32_t(nodes.size());
+        for(uint32_t octant = 0; octant < 8 && begin != end; octant++)
+        {
+            auto next = std::partition_point(begin, end, [&](const MortonEntry& e) {return ((e.code >> shift) & 7) <= octant;});
+            if(next != begin)
+            {
+                nodes.push_back({{}, {}, uint32_t(begin - entries.begin()), uint32_t(next - begin), 0, 0});
+                depths.push_back(depths[i] + 1);
+            }
+            begin = next;
+        }
+        nodes[i].first_child = first_child;
+        nodes[i].n_children = uint32_t(nodes.size()) - first_child;
+    }
+    entries = std::vector<MortonEntry>();
+
+    std::vector<uint32_t> leaves;
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(IsOctreeLeaf(nodes[i]))
+            leaves.push_back(uint32_t(i));
+    }
+    // the points are moved once, shuffled leaf by leaf
+    std::vector<vec3<float>> sorted(n);
+    ParallelFor(leaves.size(), [&](size_t l)
+    {
+        OctreeNode& node = nodes[leaves[l]];
+        // seeded by the leaf, so the same input always gives the same order
+        std::minstd_rand random(uint32_t(l) + 1);
+        std::shuffle(source_indices.begin() + node.begin, source_indices.begin() + node.begin + node.count, random);
+        for(uint32_t p = node.begin; p < node.begin + node.count; p++)
+            sorted[p] = points[source_indices[p]];
+        vec3<float> first = sorted[node.begin];
+        for(int i = 0; i < 3; i++)
+            node.low[i] = node.high[i] = first.data[i];
+        for(uint32_t p = node.begin; p < node.begin + node.count; p++)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                node.low[i] = std::min(node.low[i], sorted[p].data[i]);
+                node.high[i] = std::max(node.high[i], sorted[p].data[i]);
+            }
+        }
+    });
+    points.swap(sorted);
+    sorted = std::vector<vec3<float>>();
+    // children always come after their parent
+    for(size_t i = nodes.size(); i-- > 0;)
+    {
+        OctreeNode& node = nodes[i];
+        if(IsOctreeLeaf(node))
+            continue;
+        std::copy(nodes[node.first_child].low, nodes[node.first_child].low + 3, node.low);
+        std::copy(nodes[node.first_child].high, nodes[node.first_child].high + 3, node.high);
+        for(uint32_t c = node.first_child + 1; c < node.first_child + node.n_children; c++)
+        {
+            for(int ii = 0; ii < 3; ii++)
+            {
+                node.low[ii] = std::min(node.low[ii], nodes[c].low[ii]);
+                node.high[ii] = std::max(node.high[ii], nodes[c].high[ii]);
+            }
+        }
+    }
+    progress(1.0f);
+    return nodes;
+}
+
+// Calls fn(node, contained) for the largest nodes whose points may lie in the box [low, high]
+// contained is true if all of the node's points are inside, otherwise the caller has to test them
+template<typename F>
+void QueryOctreeBox(const std::vector<OctreeNode>& nodes, vec3<float> low, vec3<float> high, F&& fn)
+{
+    if(nodes.empty())
+        return;
+    std::vector<uint32_t> stack = {0};
+    while(!stack.empty())
+    {
+        const OctreeNode& node = nodes[stack.back()];
+        stack.pop_back();
+        bool overlaps = true;
+        bool contained = true;
+        for(int i = 0; i < 3; i++)
+        {
+            overlaps = overlaps && node.high[i] >= low.data[i] && node.low[i] <= high.data[i];
+            contained = contained && node.low[i] >= low.data[i] && node.high[i] <= high.data[i];
+        }
+        if(!overlaps)
+            continue;
+        if(contained || IsOctreeLeaf(node))
+        {
+            fn(node, contained);
+            continue;
+        }
+        for(uint32_t c = node.first_child; c < node.first_child + node.n_children; c++)
+            stack.push_back(c);
+    }
+}
@@ -0,0 +1,811 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "MappedFile.hpp"
+#include "JobSystem.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "TextTokenizer.hpp"
+#include "PointStats.hpp"
+#include "Octree.hpp"
+#include "PointCache.hpp"
+
+// Out-of-core layout for clouds that do not fit in memory, written once next to the source (<file>.ptpages)
+// The points are bucketed into a Morton grid and ordered like the leaves of an octree built over the grid cells,
+// every leaf is a page that can be read and dropped on its own
+// Section counts stay exact without the points: a histogram of Z over fine bins counts everything below the bin
+// of a boundary and a copy of all Z values, sorted within each bin, is binary searched inside that one bin
+// Layout: PagedCloudHeader, OctreeNode[n_nodes], uint64_t[n_z_bins + 1] exclusive prefix counts of the bins,
+// then page aligned n_points float x, y, z triples, n_points floats of Z and the n_points uint32 indices of the points
+// in the source, in page order like the points
+
+constexpr char PAGED_CLOUD_MAGIC[8] = {'P', 'T', 'S', 'P', 'A', 'G', 'E', 'S'};
+constexpr uint32_t PAGED_CLOUD_VERSION = 3;
+constexpr const char* PAGED_CLOUD_EXTENSION = ".ptpages";
+// leaves are split above this many points, 768KB pages
+constexpr uint32_t PAGED_CLOUD_PAGE_POINTS = 65536;
+// depth of the Morton grid used while converting, 2^24 cells, which bounds the depth of the octree
+constexpr int PAGED_CLOUD_GRID_DEPTH = 8;
+constexpr uint32_t PAGED_CLOUD_Z_BINS = 1 << 20;
+constexpr size_t PAGED_CLOUD_ALIGNMENT = 4096;
+// text parsed per step of the conversion, bounds the memory the conversion needs
+constexpr size_t PAGED_CLOUD_PARSE_BATCH = 256 << 20;
+constexpr size_t PAGED_CLOUD_PARSE_CHUNK = 4 << 20;
+constexpr size_t PAGED_CLOUD_BLOCK_POINTS = 1 << 20;
+
+struct PagedCloudHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_z_bins;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_checksum;
+    uint64_t n_points;
+    uint64_t n_nodes;
+    uint64_t nodes_offset;
+    uint64_t bins_offset;
+    uint64_t points_offset;
+    uint64_t z_offset;
+    uint64_t indices_offset;
+    uint64_t file_size;
+    // the bins evenly cover [z_low, z_high]
+    float z_low;
+    float z_high;
+    float bounding_box_low[3];
+    float bounding_box_high[3];
+    float center_average[3];
+    float center_bounding[3];
+    float furthest_point_center_distance;
+    float furthest_point_zero_distance;
+    // the points are relative to this, which keeps far away coordinates precise as floats (see LasFile.hpp)
+    double origin[3];
+    // checksum of all of the above
+    uint64_t header_checksum;
+};
+static_assert(sizeof(PagedCloudHeader) == 200, "the header layout is part of the file format");
+
+inline uint64_t PagedCloudHeaderChecksum(const PagedCloudHeader& header)
+{
+    return PointCacheChecksum(&header, offsetof(PagedCloudHeader, header_checksum));
+}
+
+inline std::string GetPagedCloudPath(const std::string& source_path)
+{
+    return source_path + PAGED_CLOUD_EXTENSION;
+}
+
+inline size_t AlignPagedCloudOffset(size_t offset)
+{
+    return (offset + PAGED_CLOUD_ALIGNMENT - 1) / PAGED_CLOUD_ALIGNMENT * PAGED_CLOUD_ALIGNMENT;
+}
+
+inline uint32_t GetPagedCloudZBin(float z, float z_low, float scale)
+{
+    return uint32_t(std::clamp((z - z_low) * scale, 0.0f, float(PAGED_CLOUD_Z_BINS - 1)));
+}
+
+inline float GetPagedCloudZScale(float z_low, float z_high)
+{
+    return (z_high > z_low) ? float(PAGED_CLOUD_Z_BINS) / (z_high - z_low) : 0.0f;
+}
+
+// Installed memory in bytes, 0 if unknown
+inline size_t GetPhysicalMemory()
+{
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? size_t(status.ullTotalPhys) : 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    return (pages > 0 && page_size > 0) ? size_t(pages) * size_t(page_size) : 0;
+#endif
+}
+
+// Steps 2 to 5 of a conversion: orders the n points of the temporary file at raw_path (float x, y, z triples,
+// removed when done) into the paged layout at out_path, which is tied to the file at source_path
+// origin is where the points are relative to, see PagedCloudHeader
+// rows_path is empty if point i of raw_path is point i of the source, otherwise a temporary file (removed when done)
+// with the index in the source of every point, as uint32_t, for conversions that dropped points
+// progress(float) goes from 0.4 to 1, the fraction the steps take of a conversion from text
+template<typename ProgressFn>
+bool ConvertRawToPagedCloud(const std::string& raw_path, size_t n, vec3<double> origin, const std::string& source_path,
+    const std::string& out_path, std::string& error, ProgressFn progress, const std::string& rows_path = "")
+{
+    auto remove_raw = [&]()
+    {
+        std::error_code ec;
+        std::filesystem::remove(raw_path, ec);
+        if(!rows_path.empty())
+            std::filesystem::remove(rows_path, ec);
+    };
+    if(n == 0)
+    {
+        remove_raw();
+        error = "No data found in file";
+        return false;
+    }
+    if(n > UINT32_MAX)
+    {
+        remove_raw();
+        error = "Too many points in file";
+        return false;
+    }
+    MappedFile raw_file;
+    if(!raw_file.Open(raw_path))
+    {
+        remove_raw();
+        error = "Failed to open " + raw_path;
+        return false;
+    }
+    const vec3<float>* points = (const vec3<float>*)raw_file.GetData();
+    MappedFile rows_file;
+    if(!rows_path.empty() && !rows_file.Open(rows_path))
+    {
+        remove_raw();
+        error = "Failed to open " + rows_path;
+        return false;
+    }
+    const uint32_t* rows = rows_path.empty() ? nullptr : (const uint32_t*)rows_file.GetData();
+
+    // 2: statistics, then counts per grid cell and Z bin
+    PointStats stats = ComputePointStats(points, n, [&](int sweep, float p) {progress(0.4f + 0.05f * (float(sweep) + p));});
+    vec3<float> scale;
+    for(int i = 0; i < 3; i++)
+    {
+        float extent = stats.bounding_box_high.data[i] - stats.bounding_box_low.data[i];
+        scale.data[i] = (extent > 0.0f) ? float(1 << OCTREE_MAX_DEPTH) / extent : 0.0f;
+    }
+    constexpr int CELL_SHIFT = 3 * (OCTREE_MAX_DEPTH - PAGED_CLOUD_GRID_DEPTH);
+    constexpr uint32_t N_CELLS = 1u << (3 * PAGED_CLOUD_GRID_DEPTH);
+    float z_low = stats.bounding_box_low.z;
+    float z_high = stats.bounding_box_high.z;
+    float z_scale = GetPagedCloudZScale(z_low, z_high);
+    // counts first, then the next free index of every cell/bin
+    std::vector<std::atomic<uint32_t>> cells(N_CELLS);
+    std::vector<std::atomic<uint32_t>> bins(PAGED_CLOUD_Z_BINS);
+    size_t n_blocks = (n + PAGED_CLOUD_BLOCK_POINTS - 1) / PAGED_CLOUD_BLOCK_POINTS;
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t end = std::min(n, (b + 1) * PAGED_CLOUD_BLOCK_POINTS);
+        for(size_t i = b * PAGED_CLOUD_BLOCK_POINTS; i < end; i++)
+        {
+            cells[MortonCode(points[i], stats.bounding_box_low, scale) >> CELL_SHIFT].fetch_add(1, std::memory_order_relaxed);
+            bins[GetPagedCloudZBin(points[i].z, z_low, z_scale)].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    progress(0.55f);
+    std::vector<uint64_t> bin_offsets(PAGED_CLOUD_Z_BINS + 1, 0);
+    for(uint32_t i = 0; i < PAGED_CLOUD_Z_BINS; i++)
+    {
+        bin_offsets[i + 1] = bin_offsets[i] + bins[i];
+        bins[i] = uint32_t(bin_offsets[i]);
+    }
+    uint32_t total = 0;
+    for(auto& it : cells)
+        total += it.exchange(total);
+    auto cell_start = [&](uint64_t c) {return (c == N_CELLS) ? uint32_t(n) : uint32_t(cells[c]);};
+
+    // 3: octree topology over the grid, breadth first like BuildOctree; a node at depth d spans N_CELLS >> 3d cells
+    std::vector<OctreeNode> nodes;
+    std::vector<uint64_t> node_cells = {0};
+    std::vector<uint8_t> depths = {0};
+    nodes.push_back({{}, {}, 0, uint32_t(n), 0, 0});
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(nodes[i].count <= PAGED_CLOUD_PAGE_POINTS || depths[i] == PAGED_CLOUD_GRID_DEPTH)
+            continue;
+        uint64_t span = uint64_t(N_CELLS) >> (3 * (depths[i] + 1));
+        uint32_t first_child = uint32_t(nodes.size());
+        for(uint64_t octant = 0; octant < 8; octant++)
+        {
+            uint64_t c = node_cells[i] + octant * span;
+            uint32_t begin = cell_start(c);
+            uint32_t end = cell_start(c + span);
+            if(end != begin)
+            {
+                nodes.push_back({{}, {}, begin, end - begin, 0, 0});
+                node_cells.push_back(c);
+                depths.push_back(depths[i] + 1);
+            }
+        }
+        nodes[i].first_child = first_child;
+        nodes[i].n_children = uint32_t(nodes.size()) - first_child;
+    }
+
+    // 4: scatter the points into the output, by cell, and their Z by bin
+    PagedCloudHeader header = {};
+    memcpy(header.magic, PAGED_CLOUD_MAGIC, sizeof(PAGED_CLOUD_MAGIC));
+    header.version = PAGED_CLOUD_VERSION;
+    header.n_z_bins = PAGED_CLOUD_Z_BINS;
+    header.n_points = n;
+    header.n_nodes = nodes.size();
+    header.nodes_offset = AlignPagedCloudOffset(sizeof(PagedCloudHeader));
+    header.bins_offset = AlignPagedCloudOffset(header.nodes_offset + nodes.size() * sizeof(OctreeNode));
+    header.points_offset = AlignPagedCloudOffset(header.bins_offset + bin_offsets.size() * sizeof(uint64_t));
+    header.z_offset = AlignPagedCloudOffset(header.points_offset + n * sizeof(vec3<float>));
+    header.indices_offset = AlignPagedCloudOffset(header.z_offset + n * sizeof(float));
+    header.file_size = header.indices_offset + n * sizeof(uint32_t);
+    std::string temp_path = out_path + ".tmp";
+    MappedFile out;
+    if(!out.Create(temp_path, header.file_size))
+    {
+        remove_raw();
+        error = "Failed to create " + temp_path;
+        return false;
+    }
+    vec3<float>* out_points = (vec3<float>*)(out.GetWritableData() + header.points_offset);
+    float* out_z = (float*)(out.GetWritableData() + header.z_offset);
+    uint32_t* out_indices = (uint32_t*)(out.GetWritableData() + header.indices_offset);
+    std::atomic<size_t> blocks_done = 0;
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t end = std::min(n, (b + 1) * PAGED_CLOUD_BLOCK_POINTS);
+        for(size_t i = b * PAGED_CLOUD_BLOCK_POINTS; i < end; i++)
+        {
+            vec3<float> p = points[i];
+            uint32_t slot = cells[MortonCode(p, stats.bounding_box_low, scale) >> CELL_SHIFT].fetch_add(1, std::memory_order_relaxed);
+            out_points[slot] = p;
+            out_indices[slot] = (rows != nullptr) ? rows[i] : uint32_t(i);
+            out_z[bins[GetPagedCloudZBin(p.z, z_low, z_scale)].fetch_add(1, std::memory_order_relaxed)] = p.z;
+        }
+        progress(0.55f + 0.25f * float(++blocks_done) / float(n_blocks));
+    });
+    raw_file.Close();
+    rows_file.Close();
+    remove_raw();
+    cells = std::vector<std::atomic<uint32_t>>();
+    bins = std::vector<std::atomic<uint32_t>>();
+
+    // 5: shuffle and bound the leaves (see BuildOctree), sort Z within the bins
+    std::vector<uint32_t> leaves;
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        if(IsOctreeLeaf(nodes[i]))
+            leaves.push_back(uint32_t(i));
+    }
+    ParallelFor(leaves.size(), [&](size_t l)
+    {
+        OctreeNode& node = nodes[leaves[l]];
+        std::minstd_rand random(uint32_t(l) + 1);
+        // the same shuffle for the points and their indices, through the order it puts the leaf in
+        std::vector<uint32_t> order(node.count);
+        std::iota(order.begin(), order.end(), 0u);
+        std::shuffle(order.begin(), order.end(), random);
+        std::vector<vec3<float>> leaf_points(out_points + node.begin, out_points + node.begin + node.count);
+        std::vector<uint32_t> leaf_indices(out_indices + node.begin, out_indices + node.begin + node.count);
+        for(uint32_t p = 0; p < node.count; p++)
+        {
+            out_points[node.begin + p] = leaf_points[order[p]];
+            out_indices[node.begin + p] = leaf_indices[order[p]];
+        }
+        for(int i = 0; i < 3; i++)
+            node.low[i] = node.high[i] = out_points[node.begin].data[i];
+        for(uint32_t p = node.begin; p < node.begin + node.count; p++)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                node.low[i] = std::min(node.low[i], out_points[p].data[i]);
+                node.high[i] = std::max(node.high[i], out_points[p].data[i]);
+            }
+        }
+    });
+    for(size_t i = nodes.size(); i-- > 0;)
+    {
+        OctreeNode& node = nodes[i];
+        if(IsOctreeLeaf(node))
+            continue;
+        std::copy(nodes[node.first_child].low, nodes[node.first_child].low + 3, node.low);
+        std::copy(nodes[node.first_child].high, nodes[node.first_child].high + 3, node.high);
+        for(uint32_t c = node.first_child + 1; c < node.first_child + node.n_children; c++)
+        {
+            for(int ii = 0; ii < 3; ii++)
+            {
+                node.low[ii] = std::min(node.low[ii], nodes[c].low[ii]);
+                node.high[ii] = std::max(node.high[ii], nodes[c].high[ii]);
+            }
+        }
+    }
+    progress(0.9f);
+    constexpr size_t BINS_PER_TASK = 1024;
+    ParallelFor(PAGED_CLOUD_Z_BINS / BINS_PER_TASK, [&](size_t t)
+    {
+        for(size_t b = t * BINS_PER_TASK; b < (t + 1) * BINS_PER_TASK; b++)
+            std::sort(out_z + bin_offsets[b], out_z + bin_offsets[b + 1]);
+    });
+
+    // the header goes in last, a conversion that did not finish never validates
+    memcpy(out.GetWritableData() + header.nodes_offset, nodes.data(), nodes.size() * sizeof(OctreeNode));
+    memcpy(out.GetWritableData() + header.bins_offset, bin_offsets.data(), bin_offsets.size() * sizeof(uint64_t));
+    bool ok = GetPointCacheSourceStamp(source_path, header.source_size, header.source_mtime);
+    header.source_checksum = PointCacheSourceChecksum(header.source_size, header.source_mtime);
+    header.z_low = z_low;
+    header.z_high = z_high;
+    auto from_vec3 = [](vec3<float> v, float* out) {out[0] = v.x; out[1] = v.y; out[2] = v.z;};
+    from_vec3(stats.bounding_box_low, header.bounding_box_low);
+    from_vec3(stats.bounding_box_high, header.bounding_box_high);
+    from_vec3(stats.center_average, header.center_average);
+    from_vec3(stats.center_bounding, header.center_bounding);
+    header.furthest_point_center_distance = stats.furthest_point_center_distance;
+    header.furthest_point_zero_distance = stats.furthest_point_zero_distance;
+    header.origin[0] = origin.x;
+    header.origin[1] = origin.y;
+    header.origin[2] = origin.z;
+    header.header_checksum = PagedCloudHeaderChecksum(header);
+    memcpy(out.GetWritableData(), &header, sizeof(header));
+    ok = ok && out.Flush();
+    out.Close();
+    std::error_code ec;
+    if(ok)
+        std::filesystem::rename(temp_path, out_path, ec);
+    if(!ok || ec)
+    {
+        std::filesystem::remove(temp_path, ec);
+        error = "Failed to write " + out_path;
+        return false;
+    }
+    progress(1.0f);
+    return true;
+}
+
+// The temporary file step 1 of a conversion writes (float x, y, z triples) and steps 2 to 5 order
+struct RawPoints
+{
+    std::string path;
+    // the index in the source of every point, see ConvertRawToPagedCloud(); empty unless points were dropped
+    std::string rows_path;
+    // points in the file
+    size_t n;
+    // points read from the source, with the ones dropped for a NaN coordinate
+    size_t n_read;
+};
+
+// Drops the points with a NaN coordinate from x, y, z values and keeps the order of the others
+// rows gets the index among values of every point left
+inline void DropNanValues(std::vector<float>& values, std::vector<uint32_t>& rows)
+{
+    size_t out = 0;
+    rows.clear();
+    for(size_t i = 0; i < values.size(); i += 3)
+    {
+        if(std::isnan(values[i]) || std::isnan(values[i + 1]) || std::isnan(values[i + 2]))
+            continue;
+        rows.push_back(uint32_t(i / 3));
+        values[out++] = values[i];
+        values[out++] = values[i + 1];
+        values[out++] = values[i + 2];
+    }
+    values.resize(out);
+}
+
+// Appends the points of step 1 of a conversion to the temporary files of raw, in source order
+class RawPointsWriter
+{
+    protected:
+    FILE* points_file = nullptr;
+    FILE* rows_file = nullptr;
+    bool write_ok = true;
+    std::vector<uint32_t> rows;
+    public:
+    RawPoints raw = {};
+    // With drop_nan the index in the source of every point goes to raw.rows_path as well
+    bool Open(const std::string& out_path, bool drop_nan, std::string& error)
+    {
+        raw = {out_path + ".raw", drop_nan ? out_path + ".rows" : "", 0, 0};
+        points_file = fopen(raw.path.c_str(), "wb");
+        if(drop_nan)
+            rows_file = fopen(raw.rows_path.c_str(), "wb");
+        if(points_file == nullptr || (drop_nan && rows_file == nullptr))
+        {
+            error = "Failed to create " + ((points_file == nullptr) ? raw.path : raw.rows_path);
+            Remove();
+            return false;
+        }
+        return true;
+    }
+    // values are the x, y, z of the points left of the next n_read of the source, chunk_rows their index among those,
+    // see DropNanValues(); chunk_rows is only read with drop_nan
+    void Append(const std::vector<float>& values, size_t n_read, const std::vector<uint32_t>& chunk_rows)
+    {
+        if(!values.empty())
+            write_ok = write_ok && fwrite(values.data(), values.size() * sizeof(float), 1, points_file) == 1;
+        if(rows_file != nullptr && !chunk_rows.empty())
+        {
+            rows.resize(chunk_rows.size());
+            for(size_t i = 0; i < rows.size(); i++)
+                rows[i] = uint32_t(raw.n_read + chunk_rows[i]);
+            write_ok = write_ok && fwrite(rows.data(), rows.size() * sizeof(uint32_t), 1, rows_file) == 1;
+        }
+        raw.n += values.size() / 3;
+        raw.n_read += n_read;
+    }
+    // Closes the files, the rows are dropped again if every point was kept
+    bool Close(std::string& error)
+    {
+        write_ok = (fclose(points_file) == 0) && write_ok;
+        points_file = nullptr;
+        if(rows_file != nullptr)
+        {
+            write_ok = (fclose(rows_file) == 0) && write_ok;
+            rows_file = nullptr;
+        }
+        if(!write_ok)
+        {
+            Remove();
+            error = "Failed to write " + raw.path;
+            return false;
+        }
+        if(!raw.rows_path.empty() && raw.n == raw.n_read)
+        {
+            std::error_code ec;
+            std::filesystem::remove(raw.rows_path, ec);
+            raw.rows_path.clear();
+        }
+        return true;
+    }
+    // Closes and removes the files, for a conversion that failed
+    void Remove()
+    {
+        if(points_file != nullptr)
+            fclose(points_file);
+        if(rows_file != nullptr)
+            fclose(rows_file);
+        points_file = rows_file = nullptr;
+        std::error_code ec;
+        std::filesystem::remove(raw.path, ec);
+        if(!raw.rows_path.empty())
+            std::filesystem::remove(raw.rows_path, ec);
+    }
+};
+
+// Step 1 of a conversion from text: parses bytes [begin, end) of the text file at source_path, end is clamped to the file,
+// batch by batch into raw, at out_path + ".raw"; see ConvertTextToPagedCloud() for the rest
+// With drop_nan points with a NaN coordinate, which parse keeps then, are left out of raw and of on_chunk
+template<typename ProgressFn, typename ChunkFn, typename ParseFn>
+bool WriteTextToRawPoints(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk, size_t begin, size_t end, ParseFn parse, bool drop_nan, RawPoints& raw)
+{
+    MappedFile text;
+    if(!text.Open(source_path))
+    {
+        error = "Failed to open file!";
+        return false;
+    }
+    end = std::min(end, text.GetSize());
+    begin = std::min(begin, end);
+
+    RawPointsWriter writer;
+    if(!writer.Open(out_path, drop_nan, error))
+        return false;
+    size_t batch = begin;
+    while(batch < end)
+    {
+        size_t batch_end = std::min(end, batch + PAGED_CLOUD_PARSE_BATCH);
+        // batches end after a newline like the chunks do
+        while(batch_end != end && text.GetData()[batch_end - 1] != '\n')
+            batch_end++;
+        auto chunks = SplitTextChunks(text.GetData() + batch, batch_end - batch, PAGED_CLOUD_PARSE_CHUNK);
+        std::vector<std::vector<float>> values(chunks.size());
+        std::vector<std::vector<uint32_t>> rows(chunks.size());
+        std::vector<size_t> n_parsed(chunks.size());
+        std::vector<TextParseError> errors(chunks.size());
+        ParallelFor(chunks.size(), [&](size_t i)
+        {
+            errors[i] = parse(chunks[i].begin, chunks[i].end, values[i]);
+            if(errors[i] != TextParseError::None)
+                return;
+            n_parsed[i] = values[i].size() / 3;
+            if(drop_nan)
+                DropNanValues(values[i], rows[i]);
+            on_chunk(values[i]);
+        });
+        for(size_t i = 0; i < chunks.size(); i++)
+        {
+            if(errors[i] != TextParseError::None)
+            {
+                writer.Remove();
+                error = (errors[i] == TextParseError::InvalidFormat) ? "Failed to parse file, invalid format"
+                    : "Failed to parse file: invalid value(s) encountered";
+                return false;
+            }
+            writer.Append(values[i], n_parsed[i], rows[i]);
+        }
+        // the parsed text is not needed anymore
+        text.Advise(batch, batch_end - batch, MappedFileAdvice::DontNeed);
+        progress(0.4f * float(batch_end - begin) / float(end - begin));
+        batch = batch_end;
+    }
+    if(!writer.Close(error))
+        return false;
+    raw = writer.raw;
+    return true;
+}
+
+// Step 1 of a conversion from a binary file: copies its n points into raw, a batch of blocks at a time,
+// see ConvertBlocksToPagedCloud() for read and WriteTextToRawPoints() for drop_nan
+template<typename ReadFn, typename ProgressFn, typename ChunkFn>
+bool WriteBlocksToRawPoints(size_t n, ReadFn read, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk, bool drop_nan, RawPoints& raw)
+{
+    RawPointsWriter writer;
+    if(!writer.Open(out_path, drop_nan, error))
+        return false;
+    constexpr size_t BATCH_POINTS = std::max(PAGED_CLOUD_BLOCK_POINTS,
+        PAGED_CLOUD_PARSE_BATCH / sizeof(vec3<float>) / PAGED_CLOUD_BLOCK_POINTS * PAGED_CLOUD_BLOCK_POINTS);
+    for(size_t batch = 0; batch < n; batch += BATCH_POINTS)
+    {
+        size_t batch_end = std::min(n, batch + BATCH_POINTS);
+        size_t n_blocks = (batch_end - batch + PAGED_CLOUD_BLOCK_POINTS - 1) / PAGED_CLOUD_BLOCK_POINTS;
+        std::vector<std::vector<float>> values(n_blocks);
+        std::vector<std::vector<uint32_t>> rows(n_blocks);
+        std::vector<size_t> n_read(n_blocks);
+        ParallelFor(n_blocks, [&](size_t b)
+        {
+            size_t begin = batch + b * PAGED_CLOUD_BLOCK_POINTS;
+            size_t count = std::min(batch_end, begin + PAGED_CLOUD_BLOCK_POINTS) - begin;
+            values[b].resize(count * 3);
+            n_read[b] = read(begin, count, (vec3<float>*)values[b].data());
+            if(n_read[b] == SIZE_MAX)
+                return;
+            if(drop_nan)
+                DropNanValues(values[b], rows[b]);
+            on_chunk(values[b]);
+        });
+        for(size_t b = 0; b < n_blocks; b++)
+        {
+            if(n_read[b] == SIZE_MAX)
+            {
+                writer.Remove();
+                error = "Failed to parse file: invalid value(s) encountered";
+                return false;
+            }
+            writer.Append(values[b], n_read[b], rows[b]);
+        }
+        progress(0.4f * float(batch_end) / float(n));
+    }
+    if(!writer.Close(error))
+        return false;
+    raw = writer.raw;
+    return true;
+}
+
+// Converts bytes [begin, end) of the text file at source_path into the paged layout at out_path, end is clamped to the file
+// parse(const char* begin, const char* end, std::vector<float>& out) parses newline aligned pieces like ParseTextChunk
+// Needs memory for the grid and the bins (~100MB) and one batch of text, the points themselves only pass through mappings
+// Returns false and sets error if the source is broken, the messages match the ones of the in-memory loader
+// progress(float) and on_chunk(const std::vector<float>&), which gets the x, y, z values of every parsed chunk,
+// may be called from any thread
+template<typename ProgressFn, typename ChunkFn, typename ParseFn>
+bool ConvertTextToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk, size_t begin, size_t end, ParseFn parse)
+{
+    RawPoints raw;
+    if(!WriteTextToRawPoints(source_path, out_path, error, progress, on_chunk, begin, end, parse, false, raw))
+        return false;
+    return ConvertRawToPagedCloud(raw.path, raw.n, {0.0, 0.0, 0.0}, source_path, out_path, error, progress);
+}
+
+// Converts n points of a binary file into the paged layout, see ConvertTextToPagedCloud()
+// read(size_t first, size_t count, vec3<float>* out) reads points [first, first + count) of the source, relative to origin,
+// and returns count, or SIZE_MAX if any of them is invalid; it is called concurrently for blocks of PAGED_CLOUD_BLOCK_POINTS
+template<typename ReadFn, typename ProgressFn, typename ChunkFn>
+bool ConvertBlocksToPagedCloud(size_t n, vec3<double> origin, ReadFn read, const std::string& source_path,
+    const std::string& out_path, std::string& error, ProgressFn progress, ChunkFn on_chunk)
+{
+    RawPoints raw;
+    if(!WriteBlocksToRawPoints(n, read, out_path, error, progress, on_chunk, false, raw))
+        return false;
+    return ConvertRawToPagedCloud(raw.path, raw.n, origin, source_path, out_path, error, progress);
+}
+
+// Converts the whole text file at source_path, see ConvertTextToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk)
+{
+    return ConvertTextToPagedCloud(source_path, out_path, error, progress, on_chunk, 0, SIZE_MAX,
+        [](const char* begin, const char* end, std::vector<float>& out) {return ParseTextChunk(begin, end, out);});
+}
+
+// Reader of the paged layout with a bounded cache of resident pages (octree leaves)
+// Pages are read by jobs on request and dropped again least recently used first once over the budget
+// RequestLeaf/TouchLeaf/Trim are meant to be called from one thread, the renderer's
+class PagedCloud
+{
+    protected:
+    constexpr static const uint8_t PAGE_ABSENT = 0;
+    constexpr static const uint8_t PAGE_LOADING = 1;
+    constexpr static const uint8_t PAGE_RESIDENT = 2;
+
+    MappedFile file;
+    PagedCloudHeader header;
+    std::vector<OctreeNode> nodes;
+    const uint64_t* bin_offsets = nullptr;
+    const vec3<float>* points = nullptr;
+    const float* sorted_z = nullptr;
+    const uint32_t* source_indices = nullptr;
+    // per node, only leaves are ever paged
+    std::unique_ptr<std::atomic<uint8_t>[]> page_states;
+    std::vector<uint64_t> page_last_used;
+    uint64_t use_counter = 0;
+    std::atomic<size_t> resident_bytes = 0;
+    size_t budget;
+    // page reads in flight, waited for before the mapping goes away
+    JobCounter page_jobs;
+
+    size_t GetLeafBytes(uint32_t node)
+    {
+        return size_t(nodes[node].count) * sizeof(vec3<float>);
+    }
+    size_t GetLeafOffset(uint32_t node)
+    {
+        return header.points_offset + size_t(nodes[node].begin) * sizeof(vec3<float>);
+    }
+    public:
+    PagedCloud(size_t budget)
+    {
+        this->budget = budget;
+    }
+    PagedCloud(const PagedCloud&) = delete;
+    PagedCloud& operator=(const PagedCloud&) = delete;
+    ~PagedCloud()
+    {
+        JobSystem::Get().Wait(page_jobs, JobPriority::Low);
+    }
+    // Maps the paged layout belonging to source_path, false if there is none or it is damaged or stale
+    bool Open(const std::string& source_path)
+    {
+        std::string path = GetPagedCloudPath(source_path);
+        if(!std::filesystem::is_regular_file(path))
+            return false;
+        if(!file.Open(path) || file.GetSize() < sizeof(PagedCloudHeader))
+            return false;
+        memcpy(&header, file.GetData(), sizeof(header));
+        if(memcmp(header.magic, PAGED_CLOUD_MAGIC, sizeof(PAGED_CLOUD_MAGIC)) != 0
+            || header.version != PAGED_CLOUD_VERSION
+            || header.header_checksum != PagedCloudHeaderChecksum(header)
+            || header.file_size != file.GetSize()
+            || header.n_z_bins != PAGED_CLOUD_Z_BINS)
+            return false;
+        uint64_t source_size;
+        int64_t source_mtime;
+        if(!GetPointCacheSourceStamp(source_path, source_size, source_mtime)
+            || header.source_size != source_size || header.source_mtime != source_mtime)
+            return false;
+        // everything but the nodes is read on demand
+        file.Advise(0, file.GetSize(), MappedFileAdvice::Random);
+        const OctreeNode* mapped_nodes = (const OctreeNode*)(file.GetData() + header.nodes_offset);
+        nodes.assign(mapped_nodes, mapped_nodes + header.n_nodes);
+        bin_offsets = (const uint64_t*)(file.GetData() + header.bins_offset);
+        points = (const vec3<float>*)(file.GetData() + header.points_offset);
+        sorted_z = (const float*)(file.GetData() + header.z_offset);
+        source_indices = (const uint32_t*)(file.GetData() + header.indices_offset);
+        page_states = std::make_unique<std::atomic<uint8_t>[]>(nodes.size());
+        page_last_used.assign(nodes.size(), 0);
+        return true;
+    }
+    const PagedCloudHeader& GetHeader()
+    {
+        return header;
+    }
+    const std::vector<OctreeNode>& GetNodes()
+    {
+        return nodes;
+    }
+    size_t GetNPoints()
+    {
+        return header.n_points;
+    }
+    // All points in page order straight from the mapping, for one sequential pass such as an export
+    // Reading them bypasses the budget, the pages read that way are left for the system to drop
+    const vec3<float>* GetMappedPoints()
+    {
+        return points;
+    }
+    // Index in the source of every point, in the order of GetMappedPoints(), read the same way
+    const uint32_t* GetMappedSourceIndices()
+    {
+        return source_indices;
+    }
+    // Exact number of points with Z <= z, reads at most a few pages of the Z copy
+    size_t CountUpTo(float z)
+    {
+        if(z < header.z_low)
+            return 0;
+        if(z >= header.z_high)
+            return header.n_points;
+        uint32_t bin = GetPagedCloudZBin(z, header.z_low, GetPagedCloudZScale(header.z_low, header.z_high));
+        return std::upper_bound(sorted_z + bin_offsets[bin], sorted_z + bin_offsets[bin + 1], z) - sorted_z;
+    }
+    // Starts reading a leaf in the background if it is not resident
+    void RequestLeaf(uint32_t node)
+    {
+        assert(IsOctreeLeaf(nodes[node]));
+        page_last_used[node] = ++use_counter;
+        uint8_t expected = PAGE_ABSENT;
+        if(!page_states[node].compare_exchange_strong(expected, PAGE_LOADING))
+            return;
+        JobSystem::Get().Submit(JobPriority::Low, &page_jobs, [this, node]()
+        {
+            TraceScope trace("Read page");
+            size_t offset = GetLeafOffset(node);
+            size_t bytes = GetLeafBytes(node);
+            file.Advise(offset, bytes, MappedFileAdvice::WillNeed);
+            // touching every page makes it resident now, rather than on the render thread
+            volatile char sink = 0;
+            for(size_t i = 0; i < bytes; i += PAGED_CLOUD_ALIGNMENT)
+                sink = sink + file.GetData()[offset + i];
+            resident_bytes += bytes;
+            page_states[node] = PAGE_RESIDENT;
+        });
+    }
+    bool IsLeafResident(uint32_t node)
+    {
+        return page_states[node] == PAGE_RESIDENT;
+    }
+    // Marks a leaf as used, its points stay valid until the next Trim()
+    const vec3<float>* TouchLeaf(uint32_t node)
+    {
+        assert(IsLeafResident(node));
+        page_last_used[node] = ++use_counter;
+        return points + nodes[node].begin;
+    }
+    // Drops the least recently used resident leaves until the budget is met
+    void Trim()
+    {
+        if(resident_bytes <= budget)
+            return;
+        std::vector<uint32_t> resident;
+        for(uint32_t i = 0; i < nodes.size(); i++)
+        {
+            if(page_states[i] == PAGE_RESIDENT)
+                resident.push_back(i);
+        }
+        std::sort(resident.begin(), resident.end(), [&](uint32_t l, uint32_t r) {return page_last_used[l] < page_last_used[r];});
+        for(size_t i = 0; i < resident.size() && resident_bytes > budget; i++)
+        {
+            file.Advise(GetLeafOffset(resident[i]), GetLeafBytes(resident[i]), MappedFileAdvice::DontNeed);
+            resident_bytes -= GetLeafBytes(resident[i]);
+            page_states[resident[i]] = PAGE_ABSENT;
+        }
+    }
+    void SetBudget(size_t bytes)
+    {
+        budget = bytes;
+    }
+    // Memory held by the cache and the index
+    size_t GetResidentMemoryUsage()
+    {
+        return resident_bytes + nodes.size() * sizeof(OctreeNode);
+    }
+    // Size of all the data, as if it was resident
+    size_t GetTotalMemoryUsage()
+    {
+        return header.n_points * (sizeof(vec3<float>) + sizeof(float)) + nodes.size() * sizeof(OctreeNode)
+            + (header.n_z_bins + 1) * sizeof(uint64_t);
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+
+#include "JobSystem.hpp"
+
+// Calls fn(i) for every i in [0, n), spreading the calls over the workers of the JobSystem
+// Indices are handed out dynamically, so uneven work items balance themselves
+// Blocks until every call has returned, may be called from inside a job
+template<typename F>
+void ParallelFor(size_t n, F&& fn)
+{
+    if(n == 0)
+        return;
+    std::atomic<size_t> next = 0;
+    auto worker = [&]()
+    {
+        for(size_t i = next++; i < n; i = next++)
+            fn(i);
+    };
+    JobSystem& jobs = JobSystem::Get();
+    JobCounter counter;
+    size_t n_helpers = std::min(n, GetWorkerCount()) - 1;
+    for(size_t i = 0; i < n_helpers; i++)
+        jobs.Submit(JobPriority::High, &counter, worker);
+    // the calling thread takes part instead of idling
+    worker();
+    jobs.Wait(counter);
+}
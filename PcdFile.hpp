@@ -0,0 +1,638 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "PagedCloud.hpp"
+
+// Point Cloud Library PCD files (v0.6, v0.7): ascii, binary and binary_compressed bodies
+// Only the x, y and z fields are loaded; points with a NaN coordinate, which is how PCL marks the missing points
+// of organized clouds, are dropped rather than rejected
+// binary_compressed bodies are a single LZF block of the fields one after the other (all x, then all y, ...),
+// which can only be decompressed front to back: it streams through a small window and x, y and z are picked out
+// of it straight into the points, the decompressed body never exists as a whole
+
+// longest LZF back reference, also what the window keeps of the decompressed stream when it moves on
+constexpr size_t LZF_MAX_DISTANCE = 8192;
+// longest output of a single LZF instruction
+constexpr size_t LZF_MAX_RUN = 264;
+// decompressed bytes handed on at once
+constexpr size_t PCD_LZF_WINDOW = 1 << 20;
+// no sane header comes close, see PLY_MAX_HEADER_SIZE
+constexpr size_t PCD_MAX_HEADER_SIZE = 1 << 20;
+constexpr size_t PCD_COMPACT_BLOCK_POINTS = 1 << 20;
+
+enum class PcdFormat
+{
+    Ascii,
+    Binary,
+    BinaryCompressed,
+};
+
+struct PcdField
+{
+    std::string name;
+    // 'F' float, 'I' signed or 'U' unsigned integer
+    char type;
+    size_t size;
+    size_t count;
+};
+
+struct PcdHeader
+{
+    PcdFormat format;
+    std::vector<PcdField> fields;
+    size_t n_points;
+    // first byte of the body
+    size_t data_offset;
+    // per point, bytes for binary bodies and values (columns) for ASCII ones
+    size_t point_stride;
+    // x, y, z: offset within a point in the same unit as the stride, and index of the field
+    size_t xyz_offsets[3];
+    size_t xyz_fields[3];
+    // binary_compressed: the LZF block starts at data_offset + 8
+    size_t compressed_size;
+    size_t uncompressed_size;
+};
+
+inline bool IsPcdFile(const char* data, size_t size)
+{
+    // the comment line is optional
+    return (size >= 6 && memcmp(data, "# .PCD", 6) == 0) || (size >= 8 && memcmp(data, "VERSION ", 8) == 0);
+}
+
+// Parses the header of the PCD file in [data, data + size) and locates its body
+// Returns false and sets error if the file is broken or has no x, y, z fields that can be read
+inline bool ReadPcdHeader(const char* data, size_t size, PcdHeader& header, std::string& error)
+{
+    header = PcdHeader();
+    if(!IsPcdFile(data, size))
+    {
+        error = "Not a PCD file";
+        return false;
+    }
+    const char* p = data;
+    const char* end = data + std::min(size, PCD_MAX_HEADER_SIZE);
+    std::vector<std::string> names, types, sizes, counts;
+    size_t width = 0, height = 1;
+    bool has_points = false;
+    bool has_data = false;
+    auto parse_count = [&](const std::string& text, size_t& out)
+    {
+        char* text_end;
+        out = strtoull(text.c_str(), &text_end, 10);
+        return *text_end == 0 && !text.empty() && text[0] != '-';
+    };
+    while(!has_data)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if(eol == nullptr)
+        {
+            error = "Failed to parse PCD header, DATA not found";
+            return false;
+        }
+        std::vector<std::string> words;
+        const char* w = p;
+        while(w != eol)
+        {
+            while(w != eol && IsLineSpace(*w))
+                w++;
+            const char* word_end = w;
+            while(word_end != eol && !IsLineSpace(*word_end))
+                word_end++;
+            if(word_end != w)
+                words.push_back(std::string(w, word_end));
+            w = word_end;
+        }
+        p = eol + 1;
+        if(words.empty() || words[0][0] == '#')
+            continue;
+        std::vector<std::string> values(words.begin() + 1, words.end());
+        bool valid = true;
+        if(words[0] == "FIELDS" || words[0] == "COLUMNS")
+            names = values;
+        else if(words[0] == "TYPE")
+            types = values;
+        else if(words[0] == "SIZE")
+            sizes = values;
+        else if(words[0] == "COUNT")
+            counts = values;
+        else if(words[0] == "WIDTH")
+            valid = values.size() == 1 && parse_count(values[0], width);
+        else if(words[0] == "HEIGHT")
+            valid = values.size() == 1 && parse_count(values[0], height);
+        else if(words[0] == "POINTS")
+        {
+            valid = values.size() == 1 && parse_count(values[0], header.n_points);
+            has_points = true;
+        }
+        else if(words[0] == "DATA")
+        {
+            valid = values.size() == 1;
+            if(valid && values[0] == "ascii")
+                header.format = PcdFormat::Ascii;
+            else if(valid && values[0] == "binary")
+                header.format = PcdFormat::Binary;
+            else if(valid && values[0] == "binary_compressed")
+                header.format = PcdFormat::BinaryCompressed;
+            else
+            {
+                error = "Unknown PCD data format";
+                return false;
+            }
+            has_data = true;
+        }
+        else if(words[0] != "VERSION" && words[0] != "VIEWPOINT")
+            valid = false;
+        if(!valid)
+        {
+            error = "Failed to parse PCD header, invalid " + words[0];
+            return false;
+        }
+    }
+    header.data_offset = p - data;
+    if(!has_points)
+        header.n_points = width * height;
+    // COUNT is optional, every field holds a single value then
+    if(counts.empty())
+        counts.assign(names.size(), "1");
+    if(names.empty() || types.size() != names.size() || sizes.size() != names.size() || counts.size() != names.size())
+    {
+        error = "Failed to parse PCD header, FIELDS, TYPE, SIZE and COUNT do not match";
+        return false;
+    }
+    bool binary = header.format != PcdFormat::Ascii;
+    static const char* XYZ[] = {"x", "y", "z"};
+    bool found[3] = {false, false, false};
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        PcdField field = {names[i], types[i].size() == 1 ? types[i][0] : char(0), 0, 0};
+        bool valid = parse_count(sizes[i], field.size) && parse_count(counts[i], field.count) && field.count != 0;
+        valid = valid && ((field.type == 'F' && (field.size == 4 || field.size == 8))
+            || ((field.type == 'I' || field.type == 'U') && (field.size == 1 || field.size == 2 || field.size == 4 || field.size == 8)));
+        if(!valid)
+        {
+            error = "Failed to parse PCD header, invalid field " + field.name;
+            return false;
+        }
+        for(int ii = 0; ii < 3; ii++)
+        {
+            if(field.name == XYZ[ii])
+            {
+                if(field.count != 1)
+                {
+                    error = "PCD x, y and z fields must have COUNT 1";
+                    return false;
+                }
+                header.xyz_offsets[ii] = header.point_stride;
+                header.xyz_fields[ii] = i;
+                found[ii] = true;
+            }
+        }
+        header.point_stride += binary ? field.size * field.count : field.count;
+        header.fields.push_back(field);
+    }
+    if(!found[0] || !found[1] || !found[2])
+    {
+        error = "PCD file has no x, y and z fields";
+        return false;
+    }
+    size_t body = size - header.data_offset;
+    if(header.format == PcdFormat::Binary && header.n_points > body / header.point_stride)
+    {
+        error = "File is truncated";
+        return false;
+    }
+    if(header.format == PcdFormat::BinaryCompressed)
+    {
+        uint32_t sizes[2];
+        if(body < sizeof(sizes))
+        {
+            error = "File is truncated";
+            return false;
+        }
+        memcpy(sizes, data + header.data_offset, sizeof(sizes));
+        header.compressed_size = sizes[0];
+        header.uncompressed_size = sizes[1];
+        if(header.compressed_size > body - sizeof(sizes))
+        {
+            error = "File is truncated";
+            return false;
+        }
+        // PCL leaves the padding fields ("_") out of compressed bodies
+        size_t unpadded_stride = 0;
+        for(auto& field : header.fields)
+        {
+            if(field.name != "_")
+                unpadded_stride += field.size * field.count;
+        }
+        if(header.n_points > SIZE_MAX / unpadded_stride || header.uncompressed_size != header.n_points * unpadded_stride)
+        {
+            error = "Invalid PCD compressed data size";
+            return false;
+        }
+    }
+    return true;
+}
+
+inline float ReadPcdValue(const char* p, char type, size_t size)
+{
+    auto read = [&](auto v)
+    {
+        memcpy(&v, p, sizeof(v));
+        return float(v);
+    };
+    if(type == 'F')
+        return (size == 4) ? read(float()) : read(double());
+    if(type == 'I')
+    {
+        switch(size)
+        {
+            case 1: return read(int8_t());
+            case 2: return read(int16_t());
+            case 4: return read(int32_t());
+            default: return read(int64_t());
+        }
+    }
+    switch(size)
+    {
+        case 1: return read(uint8_t());
+        case 2: return read(uint16_t());
+        case 4: return read(uint32_t());
+        default: return read(uint64_t());
+    }
+}
+
+// Reads points [first, first + count) of a binary PCD file mapped at data into out, NaNs included
+inline void ReadPcdPoints(const PcdHeader& header, const char* data, size_t first, size_t count, vec3<float>* out)
+{
+    assert(header.format == PcdFormat::Binary);
+    const char* begin = data + header.data_offset + first * header.point_stride;
+    size_t stride = header.point_stride;
+    const size_t* offsets = header.xyz_offsets;
+    const PcdField* xyz[3] = {&header.fields[header.xyz_fields[0]], &header.fields[header.xyz_fields[1]],
+        &header.fields[header.xyz_fields[2]]};
+    bool floats = xyz[0]->type == 'F' && xyz[0]->size == 4 && xyz[1]->type == 'F' && xyz[1]->size == 4
+        && xyz[2]->type == 'F' && xyz[2]->size == 4;
+    if(floats && stride == 3 * sizeof(float) && offsets[0] == 0 && offsets[1] == 4 && offsets[2] == 8)
+    {
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        memcpy(out, begin, count * sizeof(vec3<float>));
+    }
+    else if(floats)
+    {
+        // PCL pads x, y, z to 16 bytes and interleaves the other fields
+        for(size_t i = 0; i < count; i++)
+        {
+            const char* point = begin + i * stride;
+            memcpy(&out[i].x, point + offsets[0], sizeof(float));
+            memcpy(&out[i].y, point + offsets[1], sizeof(float));
+            memcpy(&out[i].z, point + offsets[2], sizeof(float));
+        }
+    }
+    else
+    {
+        for(size_t i = 0; i < count; i++)
+        {
+            const char* point = begin + i * stride;
+            for(int ii = 0; ii < 3; ii++)
+                out[i].data[ii] = ReadPcdValue(point + offsets[ii], xyz[ii]->type, xyz[ii]->size);
+        }
+    }
+}
+
+// Parses newline aligned point lines of an ASCII PCD file, same contract as ParseTextChunk but NaN points are kept,
+// one per line, so the lines can be counted against the header before they are dropped
+inline TextParseError ParsePcdText(const PcdHeader& header, const char* begin, const char* end, std::vector<float>& out)
+{
+    assert(header.format == PcdFormat::Ascii);
+    int columns[3] = {int(header.xyz_offsets[0]), int(header.xyz_offsets[1]), int(header.xyz_offsets[2])};
+    return ParseTextColumns(begin, end, int(header.point_stride), columns, out, true);
+}
+
+// Decompresses the LZF block [in, in + in_size) of out_size bytes without ever holding all of it
+// The output goes through a window and is handed to sink(const char* data, size_t offset, size_t size) in order,
+// in pieces that may end anywhere; progress(size_t) gets the compressed bytes consumed so far
+// Returns false if the block is corrupt or does not decompress to exactly out_size bytes
+template<typename SinkFn, typename ProgressFn>
+bool DecompressLzfStream(const uint8_t* in, size_t in_size, size_t out_size, SinkFn sink, ProgressFn progress)
+{
+    std::vector<uint8_t> window(PCD_LZF_WINDOW + LZF_MAX_DISTANCE);
+    // stream offset of window[0], window[flushed, pos) is not handed on yet
+    size_t base = 0;
+    size_t pos = 0;
+    size_t flushed = 0;
+    const uint8_t* ip = in;
+    const uint8_t* in_end = in + in_size;
+    while(ip != in_end)
+    {
+        if(pos + LZF_MAX_RUN > window.size())
+        {
+            sink((const char*)window.data() + flushed, base + flushed, pos - flushed);
+            // only what back references can reach stays
+            size_t keep = std::min(pos, LZF_MAX_DISTANCE);
+            memmove(window.data(), window.data() + pos - keep, keep);
+            base += pos - keep;
+            pos = keep;
+            flushed = keep;
+            progress(size_t(ip - in));
+        }
+        size_t ctrl = *ip++;
+        if(ctrl < 32)
+        {
+            // a run of ctrl + 1 literal bytes
+            size_t length = ctrl + 1;
+            if(size_t(in_end - ip) < length || base + pos + length > out_size)
+                return false;
+            memcpy(window.data() + pos, ip, length);
+            ip += length;
+            pos += length;
+        }
+        else
+        {
+            // a copy of earlier output, which may overlap the bytes it produces
+            size_t length = ctrl >> 5;
+            if(length == 7)
+            {
+                if(ip == in_end)
+                    return false;
+                length += *ip++;
+            }
+            if(ip == in_end)
+                return false;
+            size_t distance = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+            length += 2;
+            if(distance > pos || base + pos + length > out_size)
+                return false;
+            uint8_t* out = window.data() + pos;
+            const uint8_t* ref = out - distance;
+            if(distance >= length)
+                memcpy(out, ref, length);
+            else
+            {
+                for(size_t i = 0; i < length; i++)
+                    out[i] = ref[i];
+            }
+            pos += length;
+        }
+    }
+    sink((const char*)window.data() + flushed, base + flushed, pos - flushed);
+    progress(in_size);
+    return base + pos == out_size;
+}
+
+// Picks x, y and z out of the decompressed body of a binary_compressed PCD file as it streams by
+// (see DecompressLzfStream()) and stores them into out, n_points of them
+class PcdFieldRouter
+{
+    protected:
+    struct Axis
+    {
+        // bytes [begin, end) of the decompressed body
+        size_t begin;
+        size_t end;
+        char type;
+        size_t size;
+        // a value cut in two by the end of a piece
+        char carry[8];
+        size_t n_carry;
+    };
+    Axis axes[3];
+    vec3<float>* out;
+    public:
+    PcdFieldRouter(const PcdHeader& header, vec3<float>* out)
+    {
+        assert(header.format == PcdFormat::BinaryCompressed);
+        this->out = out;
+        // every field takes n_points values in a row
+        std::vector<size_t> field_offsets;
+        size_t offset = 0;
+        for(auto& field : header.fields)
+        {
+            field_offsets.push_back(offset);
+            if(field.name != "_")
+                offset += header.n_points * field.size * field.count;
+        }
+        for(int i = 0; i < 3; i++)
+        {
+            auto& field = header.fields[header.xyz_fields[i]];
+            axes[i] = {field_offsets[header.xyz_fields[i]], 0, field.type, field.size, {}, 0};
+            axes[i].end = axes[i].begin + header.n_points * field.size;
+        }
+    }
+    void operator()(const char* data, size_t offset, size_t size)
+    {
+        for(int a = 0; a < 3; a++)
+        {
+            Axis& axis = axes[a];
+            size_t begin = std::max(offset, axis.begin);
+            size_t end = std::min(offset + size, axis.end);
+            if(begin >= end)
+                continue;
+            const char* p = data + (begin - offset);
+            size_t remaining = end - begin;
+            // index of the value p is in
+            size_t i = (begin - axis.begin) / axis.size;
+            if(axis.n_carry != 0)
+            {
+                size_t take = std::min(remaining, axis.size - axis.n_carry);
+                memcpy(axis.carry + axis.n_carry, p, take);
+                axis.n_carry += take;
+                p += take;
+                remaining -= take;
+                if(axis.n_carry < axis.size)
+                    continue;
+                out[i].data[a] = ReadPcdValue(axis.carry, axis.type, axis.size);
+                axis.n_carry = 0;
+                i++;
+            }
+            if(axis.type == 'F' && axis.size == 4)
+            {
+                for(; remaining >= sizeof(float); i++, p += sizeof(float), remaining -= sizeof(float))
+                    memcpy(&out[i].data[a], p, sizeof(float));
+            }
+            else
+            {
+                for(; remaining >= axis.size; i++, p += axis.size, remaining -= axis.size)
+                    out[i].data[a] = ReadPcdValue(p, axis.type, axis.size);
+            }
+            memcpy(axis.carry, p, remaining);
+            axis.n_carry = remaining;
+        }
+    }
+};
+
+// Drops the points with a NaN coordinate and keeps the order of the others, returns how many are left
+// rows, if not null, gets the index among the n of every point left
+inline size_t RemoveNanPoints(vec3<float>* points, size_t n, uint32_t* rows = nullptr)
+{
+    size_t n_blocks = (n + PCD_COMPACT_BLOCK_POINTS - 1) / PCD_COMPACT_BLOCK_POINTS;
+    std::vector<size_t> kept(n_blocks);
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t begin = b * PCD_COMPACT_BLOCK_POINTS;
+        size_t end = std::min(n, begin + PCD_COMPACT_BLOCK_POINTS);
+        size_t out = begin;
+        for(size_t i = begin; i < end; i++)
+        {
+            vec3<float> p = points[i];
+            if(std::isnan(p.x) || std::isnan(p.y) || std::isnan(p.z))
+                continue;
+            if(rows != nullptr)
+                rows[out] = uint32_t(i);
+            points[out++] = p;
+        }
+        kept[b] = out - begin;
+    });
+    // close the gaps between the blocks, nothing moves unless something was dropped
+    size_t n_kept = 0;
+    for(size_t b = 0; b < n_blocks; b++)
+    {
+        size_t begin = b * PCD_COMPACT_BLOCK_POINTS;
+        if(n_kept != begin && kept[b] != 0)
+        {
+            memmove(points + n_kept, points + begin, kept[b] * sizeof(vec3<float>));
+            if(rows != nullptr)
+                memmove(rows + n_kept, rows + begin, kept[b] * sizeof(uint32_t));
+        }
+        n_kept += kept[b];
+    }
+    return n_kept;
+}
+
+// Decompresses the points of a binary_compressed PCD file mapped at data into out, NaNs included
+// progress(float) is called with the fraction of the compressed body consumed
+// Returns false and sets error if the compressed body is corrupt
+template<typename ProgressFn>
+bool DecompressPcdPoints(const PcdHeader& header, const char* data, vec3<float>* out, std::string& error, ProgressFn progress)
+{
+    PcdFieldRouter router(header, out);
+    const uint8_t* in = (const uint8_t*)data + header.data_offset + 2 * sizeof(uint32_t);
+    bool ok = DecompressLzfStream(in, header.compressed_size, header.uncompressed_size, router,
+        [&](size_t consumed) {progress(float(consumed) / float(std::max<size_t>(1, header.compressed_size)));});
+    if(!ok)
+        error = "Failed to decompress PCD data";
+    return ok;
+}
+
+// Converts the PCD file at source_path into the paged layout at out_path, see ConvertTextToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertPcdToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk)
+{
+    MappedFile file;
+    PcdHeader header;
+    if(!OpenWithHeader(source_path, file, header, ReadPcdHeader, error))
+        return false;
+    // the rows of the points that are left are kept in 32 bits, like every source index
+    if(header.n_points > UINT32_MAX)
+    {
+        error = "Too many points in file";
+        return false;
+    }
+    if(header.format == PcdFormat::Ascii)
+    {
+        file.Close();
+        RawPoints raw;
+        if(!WriteTextToRawPoints(source_path, out_path, error, progress, on_chunk, header.data_offset, SIZE_MAX,
+            [&](const char* begin, const char* end, std::vector<float>& out) {return ParsePcdText(header, begin, end, out);},
+            true, raw))
+            return false;
+        // the NaN points count too, every line is a point of the header
+        if(raw.n_read != header.n_points)
+        {
+            std::error_code ec;
+            std::filesystem::remove(raw.path, ec);
+            if(!raw.rows_path.empty())
+                std::filesystem::remove(raw.rows_path, ec);
+            error = "Failed to parse file, the PCD header announces " + std::to_string(header.n_points) + " points";
+            return false;
+        }
+        return ConvertRawToPagedCloud(raw.path, raw.n, {0.0, 0.0, 0.0}, source_path, out_path, error, progress, raw.rows_path);
+    }
+    if(header.n_points == 0)
+    {
+        error = "No data found in file";
+        return false;
+    }
+    if(header.format == PcdFormat::Binary)
+    {
+        size_t first_byte = header.data_offset;
+        file.Advise(first_byte, header.n_points * header.point_stride, MappedFileAdvice::Sequential);
+        RawPoints raw;
+        if(!WriteBlocksToRawPoints(header.n_points,
+            [&](size_t first, size_t count, vec3<float>* out)
+            {
+                ReadPcdPoints(header, file.GetData(), first, count, out);
+                file.Advise(first_byte + first * header.point_stride, count * header.point_stride, MappedFileAdvice::DontNeed);
+                return count;
+            }, out_path, error, progress, on_chunk, true, raw))
+            return false;
+        file.Close();
+        return ConvertRawToPagedCloud(raw.path, raw.n, {0.0, 0.0, 0.0}, source_path, out_path, error, progress, raw.rows_path);
+    }
+
+    // the fields of a point only come together at the end of the stream, so the points are assembled
+    // in a mapping of the temporary file the conversion goes on from; there is no preview meanwhile
+    std::string raw_path = out_path + ".raw";
+    std::string rows_path = out_path + ".rows";
+    auto remove_raw = [&]()
+    {
+        std::error_code ec;
+        std::filesystem::remove(raw_path, ec);
+        std::filesystem::remove(rows_path, ec);
+    };
+    MappedFile raw;
+    MappedFile rows;
+    if(!raw.Create(raw_path, header.n_points * sizeof(vec3<float>)))
+    {
+        remove_raw();
+        error = "Failed to create " + raw_path;
+        return false;
+    }
+    if(!rows.Create(rows_path, header.n_points * sizeof(uint32_t)))
+    {
+        raw.Close();
+        remove_raw();
+        error = "Failed to create " + rows_path;
+        return false;
+    }
+    vec3<float>* points = (vec3<float>*)raw.GetWritableData();
+    if(!DecompressPcdPoints(header, file.GetData(), points, error, [&](float p) {progress(0.4f * p);}))
+    {
+        raw.Close();
+        rows.Close();
+        remove_raw();
+        return false;
+    }
+    size_t n = RemoveNanPoints(points, header.n_points, (uint32_t*)rows.GetWritableData());
+    bool ok = raw.Flush() && rows.Flush();
+    raw.Close();
+    rows.Close();
+    file.Close();
+    if(!ok)
+    {
+        remove_raw();
+        error = "Failed to write " + raw_path;
+        return false;
+    }
+    // the rows are only needed if points were dropped
+    if(n == header.n_points)
+    {
+        std::error_code ec;
+        std::filesystem::remove(rows_path, ec);
+        rows_path.clear();
+    }
+    return ConvertRawToPagedCloud(raw_path, n, {0.0, 0.0, 0.0}, source_path, out_path, error, progress, rows_path);
+}
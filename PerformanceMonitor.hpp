@@ -0,0 +1,137 @@
+#pragma once
+
+#include "hmain.hpp"
+
+// Rolling per frame measurements for the Performance window: CPU and GPU time, frame interval, points drawn, bytes uploaded
+// The GPU time of a frame comes from a GL_TIME_ELAPSED query that is read back once available, a few frames later,
+// so measuring it never stalls the pipeline; without timer queries (GL < 3.3 without the extension) there is none
+// Every history is a ring of HISTORY values, GetHistoryOffset() is the index of the oldest one (as ImGui::PlotLines wants it)
+// Requires a current GL context for its whole lifetime
+class PerformanceMonitor
+{
+    public:
+    // frames kept, a few seconds at usual frame rates
+    constexpr static const int HISTORY = 240;
+    protected:
+    // queries in flight, a frame goes unmeasured on the GPU if all of them are still pending
+    constexpr static const int QUERIES = 4;
+    using Clock = std::chrono::steady_clock;
+
+    float cpu_ms[HISTORY] = {};
+    float interval_ms[HISTORY] = {};
+    float drawn_points[HISTORY] = {};
+    float uploaded_mb[HISTORY] = {};
+    // filled as the queries complete, so it has its own position
+    float gpu_ms[HISTORY] = {};
+    uint64_t n_frames = 0;
+    uint64_t n_gpu_frames = 0;
+    Clock::time_point frame_start;
+    Clock::time_point last_frame_start;
+    size_t last_uploaded_bytes = 0;
+
+    bool has_timer;
+    GLuint queries[QUERIES] = {};
+    // queries [query_read, query_write) are issued and not read yet, index % QUERIES
+    uint64_t query_read = 0;
+    uint64_t query_write = 0;
+    bool query_running = false;
+
+    void CollectQueries()
+    {
+        while(query_read != query_write)
+        {
+            GLuint query = queries[query_read % QUERIES];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available)
+                return;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            gpu_ms[n_gpu_frames % HISTORY] = float(double(ns) / 1e6);
+            n_gpu_frames++;
+            query_read++;
+        }
+    }
+    public:
+    PerformanceMonitor(const PerformanceMonitor&) = delete;
+    PerformanceMonitor& operator=(const PerformanceMonitor&) = delete;
+    PerformanceMonitor()
+    {
+        // core since 3.3
+        has_timer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        if(has_timer)
+            glGenQueries(QUERIES, queries);
+        last_frame_start = Clock::now();
+    }
+    ~PerformanceMonitor()
+    {
+        if(has_timer)
+            glDeleteQueries(QUERIES, queries);
+    }
+    // Call before any GL work of the frame
+    void BeginFrame()
+    {
+        frame_start = Clock::now();
+        if(!has_timer)
+            return;
+        CollectQueries();
+        query_running = query_write - query_read < QUERIES;
+        if(query_running)
+            glBeginQuery(GL_TIME_ELAPSED, queries[query_write % QUERIES]);
+    }
+    // Call after the last GL work of the frame, before swapping buffers (which would add the wait for the display)
+    // uploaded_bytes is the renderer's running total, see PointRenderer::GetUploadedBytes()
+    void EndFrame(size_t drawn, size_t uploaded_bytes)
+    {
+        if(query_running)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            query_write++;
+            query_running = false;
+        }
+        int i = n_frames % HISTORY;
+        cpu_ms[i] = std::chrono::duration<float, std::milli>(Clock::now() - frame_start).count();
+        interval_ms[i] = std::chrono::duration<float, std::milli>(frame_start - last_frame_start).count();
+        drawn_points[i] = float(drawn);
+        uploaded_mb[i] = float(double(uploaded_bytes - last_uploaded_bytes) / double(1 << 20));
+        last_frame_start = frame_start;
+        last_uploaded_bytes = uploaded_bytes;
+        n_frames++;
+    }
+    bool HasGpuTimer()
+    {
+        return has_timer;
+    }
+    int GetHistoryOffset()
+    {
+        return n_frames % HISTORY;
+    }
+    int GetGpuHistoryOffset()
+    {
+        return n_gpu_frames % HISTORY;
+    }
+    // Milliseconds from BeginFrame() to EndFrame()
+    const float* GetCpuTimes()
+    {
+        return cpu_ms;
+    }
+    // Milliseconds, the GPU history has its own offset
+    const float* GetGpuTimes()
+    {
+        return gpu_ms;
+    }
+    // Milliseconds between the starts of consecutive frames
+    const float* GetFrameIntervals()
+    {
+        return interval_ms;
+    }
+    const float* GetDrawnPoints()
+    {
+        return drawn_points;
+    }
+    // MB (2^20 bytes) per frame
+    const float* GetUploadedMegabytes()
+    {
+        return uploaded_mb;
+    }
+};
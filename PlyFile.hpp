@@ -0,0 +1,486 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#include "MappedFile.hpp"
+#include "BinaryFileWriter.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "TextTokenizer.hpp"
+#include "PagedCloud.hpp"
+
+// Stanford PLY files, read straight from a mapping of the file
+// Only the x, y and z properties of the vertex element are loaded, every other element and property is skipped
+// Tightly packed little endian float x, y, z vertices are the body of the file as is and get copied without any conversion,
+// other binary layouts are gathered with a stride, ASCII bodies go through the text parser
+// The writer produces exactly that fast layout: binary little endian, float x, y, z and nothing else
+
+constexpr const char* PLY_EXTENSION = ".ply";
+// no sane header comes close, bounds the search for end_header in files that only start like a PLY file
+constexpr size_t PLY_MAX_HEADER_SIZE = 1 << 20;
+
+enum class PlyFormat
+{
+    Ascii,
+    BinaryLittleEndian,
+    BinaryBigEndian,
+};
+
+enum class PlyType
+{
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64,
+};
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type;
+    // a list is a count of list_count_type followed by that many values of type
+    bool is_list;
+    PlyType list_count_type;
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+struct PlyHeader
+{
+    PlyFormat format;
+    std::vector<PlyElement> elements;
+    size_t n_vertices;
+    // the vertices are bytes [vertex_offset, vertex_end) of the file
+    size_t vertex_offset;
+    size_t vertex_end;
+    // per vertex, bytes for binary bodies and values (columns) for ASCII ones
+    size_t vertex_stride;
+    // x, y, z: offset within a vertex in the same unit as the stride, and type
+    size_t xyz_offsets[3];
+    PlyType xyz_types[3];
+};
+
+inline size_t GetPlyTypeSize(PlyType type)
+{
+    static constexpr size_t SIZES[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return SIZES[int(type)];
+}
+
+// Both the original names and the sized ones newer writers use
+inline bool ParsePlyType(const std::string& name, PlyType& type)
+{
+    static const std::pair<const char*, PlyType> NAMES[] =
+    {
+        {"char", PlyType::Int8}, {"int8", PlyType::Int8}, {"uchar", PlyType::UInt8}, {"uint8", PlyType::UInt8},
+        {"short", PlyType::Int16}, {"int16", PlyType::Int16}, {"ushort", PlyType::UInt16}, {"uint16", PlyType::UInt16},
+        {"int", PlyType::Int32}, {"int32", PlyType::Int32}, {"uint", PlyType::UInt32}, {"uint32", PlyType::UInt32},
+        {"float", PlyType::Float32}, {"float32", PlyType::Float32}, {"double", PlyType::Float64}, {"float64", PlyType::Float64},
+    };
+    for(auto& it : NAMES)
+    {
+        if(name == it.first)
+        {
+            type = it.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool IsPlyFile(const char* data, size_t size)
+{
+    return (size >= 4 && memcmp(data, "ply\n", 4) == 0) || (size >= 5 && memcmp(data, "ply\r\n", 5) == 0);
+}
+
+// Whether the vertices are nothing but little endian float x, y, z in that order, which is how points are kept in memory
+inline bool IsPlyVertexPacked(const PlyHeader& header)
+{
+    return header.format == PlyFormat::BinaryLittleEndian && header.vertex_stride == 3 * sizeof(float)
+        && header.xyz_offsets[0] == 0 && header.xyz_offsets[1] == 4 && header.xyz_offsets[2] == 8
+        && header.xyz_types[0] == PlyType::Float32 && header.xyz_types[1] == PlyType::Float32
+        && header.xyz_types[2] == PlyType::Float32;
+}
+
+// Advances p past count lines, false if the data ends before that
+inline bool SkipPlyLines(const char*& p, const char* end, size_t count)
+{
+    for(size_t i = 0; i < count; i++)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if(eol == nullptr)
+            return false;
+        p = eol + 1;
+    }
+    return true;
+}
+
+// Parses the header of the PLY file in [data, data + size) and locates its vertices
+// Returns false and sets error if the file is broken or has no x, y, z vertices that can be read
+inline bool ReadPlyHeader(const char* data, size_t size, PlyHeader& header, std::string& error)
+{
+    header = PlyHeader();
+    if(!IsPlyFile(data, size))
+    {
+        error = "Not a PLY file";
+        return false;
+    }
+    const char* p = data;
+    const char* end = data + std::min(size, PLY_MAX_HEADER_SIZE);
+    bool has_format = false;
+    bool has_end = false;
+    while(!has_end)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if(eol == nullptr)
+        {
+            error = "Failed to parse PLY header, end_header not found";
+            return false;
+        }
+        std::vector<std::string> words;
+        const char* w = p;
+        while(w != eol)
+        {
+            while(w != eol && IsLineSpace(*w))
+                w++;
+            const char* word_end = w;
+            while(word_end != eol && !IsLineSpace(*word_end))
+                word_end++;
+            if(word_end != w)
+                words.push_back(std::string(w, word_end));
+            w = word_end;
+        }
+        p = eol + 1;
+        if(words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+            continue;
+        if(words[0] == "end_header")
+            has_end = true;
+        else if(words[0] == "format" && words.size() == 3)
+        {
+            if(words[1] == "ascii")
+                header.format = PlyFormat::Ascii;
+            else if(words[1] == "binary_little_endian")
+                header.format = PlyFormat::BinaryLittleEndian;
+            else if(words[1] == "binary_big_endian")
+                header.format = PlyFormat::BinaryBigEndian;
+            else
+            {
+                error = "Unknown PLY format " + words[1];
+                return false;
+            }
+            has_format = true;
+        }
+        else if(words[0] == "element" && words.size() == 3)
+        {
+            char* count_end;
+            size_t count = strtoull(words[2].c_str(), &count_end, 10);
+            if(*count_end != 0 || words[2][0] == '-')
+            {
+                error = "Failed to parse PLY header, invalid element count " + words[2];
+                return false;
+            }
+            header.elements.push_back({words[1], count, {}});
+        }
+        else if(words[0] == "property" && !header.elements.empty())
+        {
+            PlyProperty property = {};
+            bool valid;
+            if(words.size() == 5 && words[1] == "list")
+            {
+                property.is_list = true;
+                property.name = words[4];
+                valid = ParsePlyType(words[2], property.list_count_type) && ParsePlyType(words[3], property.type);
+            }
+            else
+            {
+                property.name = words.back();
+                valid = words.size() == 3 && ParsePlyType(words[1], property.type);
+            }
+            if(!valid)
+            {
+                error = "Failed to parse PLY header, invalid property " + property.name;
+                return false;
+            }
+            header.elements.back().properties.push_back(property);
+        }
+        else
+        {
+            error = "Failed to parse PLY header, unexpected " + words[0];
+            return false;
+        }
+    }
+    if(!has_format)
+    {
+        error = "Failed to parse PLY header, no format";
+        return false;
+    }
+    bool binary = header.format != PlyFormat::Ascii;
+
+    // everything up to the vertices is skipped, which needs the size of every element before them
+    size_t vertex_element = 0;
+    size_t offset = p - data;
+    while(vertex_element < header.elements.size() && header.elements[vertex_element].name != "vertex")
+    {
+        auto& element = header.elements[vertex_element];
+        if(binary)
+        {
+            size_t element_size = 0;
+            for(auto& property : element.properties)
+            {
+                if(property.is_list)
+                {
+                    error = "PLY files with lists before the vertices are not supported";
+                    return false;
+                }
+                element_size += GetPlyTypeSize(property.type);
+            }
+            if(element_size != 0 && element.count > (size - offset) / element_size)
+            {
+                error = "File is truncated";
+                return false;
+            }
+            offset += element.count * element_size;
+        }
+        else
+        {
+            const char* skipped = data + offset;
+            if(!SkipPlyLines(skipped, data + size, element.count))
+            {
+                error = "File is truncated";
+                return false;
+            }
+            offset = skipped - data;
+        }
+        vertex_element++;
+    }
+    if(vertex_element == header.elements.size())
+    {
+        error = "No vertices in PLY file";
+        return false;
+    }
+    auto& vertex = header.elements[vertex_element];
+    static const char* XYZ[] = {"x", "y", "z"};
+    bool found[3] = {false, false, false};
+    for(auto& property : vertex.properties)
+    {
+        if(property.is_list)
+        {
+            error = "PLY vertices with list properties are not supported";
+            return false;
+        }
+        for(int i = 0; i < 3; i++)
+        {
+            if(property.name == XYZ[i])
+            {
+                header.xyz_offsets[i] = header.vertex_stride;
+                header.xyz_types[i] = property.type;
+                found[i] = true;
+            }
+        }
+        header.vertex_stride += binary ? GetPlyTypeSize(property.type) : 1;
+    }
+    if(!found[0] || !found[1] || !found[2])
+    {
+        error = "PLY vertices have no x, y and z";
+        return false;
+    }
+    header.n_vertices = vertex.count;
+    header.vertex_offset = offset;
+    if(binary)
+    {
+        if(header.n_vertices > (size - offset) / header.vertex_stride)
+        {
+            error = "File is truncated";
+            return false;
+        }
+        header.vertex_end = offset + header.n_vertices * header.vertex_stride;
+    }
+    else if(vertex_element == header.elements.size() - 1)
+        header.vertex_end = size;
+    else
+    {
+        // only the vertex lines go to the parser, the elements after them have other columns
+        const char* vertex_end = data + offset;
+        if(!SkipPlyLines(vertex_end, data + size, header.n_vertices))
+        {
+            error = "File is truncated";
+            return false;
+        }
+        header.vertex_end = vertex_end - data;
+    }
+    return true;
+}
+
+inline float ReadPlyValue(const char* p, PlyType type, bool swap)
+{
+    auto read = [&](auto v)
+    {
+        memcpy(&v, p, sizeof(v));
+        if(swap)
+        {
+            // swap the bytes through an integer of the same size
+            if constexpr(sizeof(v) == 2)
+            {
+                uint16_t u;
+                memcpy(&u, &v, 2);
+                u = __builtin_bswap16(u);
+                memcpy(&v, &u, 2);
+            }
+            else if constexpr(sizeof(v) == 4)
+            {
+                uint32_t u;
+                memcpy(&u, &v, 4);
+                u = __builtin_bswap32(u);
+                memcpy(&v, &u, 4);
+            }
+            else if constexpr(sizeof(v) == 8)
+            {
+                uint64_t u;
+                memcpy(&u, &v, 8);
+                u = __builtin_bswap64(u);
+                memcpy(&v, &u, 8);
+            }
+        }
+        return float(v);
+    };
+    switch(type)
+    {
+        case PlyType::Int8: return read(int8_t());
+        case PlyType::UInt8: return read(uint8_t());
+        case PlyType::Int16: return read(int16_t());
+        case PlyType::UInt16: return read(uint16_t());
+        case PlyType::Int32: return read(int32_t());
+        case PlyType::UInt32: return read(uint32_t());
+        case PlyType::Float32: return read(float());
+        case PlyType::Float64: return read(double());
+    }
+    return 0.0f;
+}
+
+// Reads vertices [first, first + count) of a binary PLY file mapped at data into out
+// Returns false if any coordinate is NaN, which the text parser rejects as well
+inline bool ReadPlyVertices(const PlyHeader& header, const char* data, size_t first, size_t count, vec3<float>* out)
+{
+    assert(header.format != PlyFormat::Ascii);
+    assert(first + count <= header.n_vertices);
+    const char* begin = data + header.vertex_offset + first * header.vertex_stride;
+    size_t stride = header.vertex_stride;
+    const size_t* offsets = header.xyz_offsets;
+    bool floats = header.format == PlyFormat::BinaryLittleEndian && header.xyz_types[0] == PlyType::Float32
+        && header.xyz_types[1] == PlyType::Float32 && header.xyz_types[2] == PlyType::Float32;
+    if(IsPlyVertexPacked(header))
+    {
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        memcpy(out, begin, count * sizeof(vec3<float>));
+    }
+    else if(floats)
+    {
+        // the extra properties are interleaved, so every coordinate is picked out on its own
+        for(size_t i = 0; i < count; i++)
+        {
+            const char* vertex = begin + i * stride;
+            memcpy(&out[i].x, vertex + offsets[0], sizeof(float));
+            memcpy(&out[i].y, vertex + offsets[1], sizeof(float));
+            memcpy(&out[i].z, vertex + offsets[2], sizeof(float));
+        }
+    }
+    else
+    {
+        bool swap = header.format == PlyFormat::BinaryBigEndian;
+        for(size_t i = 0; i < count; i++)
+        {
+            const char* vertex = begin + i * stride;
+            for(int ii = 0; ii < 3; ii++)
+                out[i].data[ii] = ReadPlyValue(vertex + offsets[ii], header.xyz_types[ii], swap);
+        }
+    }
+    bool valid = true;
+    for(size_t i = 0; i < count; i++)
+        valid &= out[i].x == out[i].x && out[i].y == out[i].y && out[i].z == out[i].z;
+    return valid;
+}
+
+// Parses newline aligned vertex lines of an ASCII PLY file, same contract as ParseTextChunk
+inline TextParseError ParsePlyVertexText(const PlyHeader& header, const char* begin, const char* end, std::vector<float>& out)
+{
+    assert(header.format == PlyFormat::Ascii);
+    // plain x y z lines are what the vectorized parser is made for
+    if(header.vertex_stride == 3 && header.xyz_offsets[0] == 0 && header.xyz_offsets[1] == 1 && header.xyz_offsets[2] == 2)
+        return ParseTextChunk(begin, end, out);
+    int columns[3] = {int(header.xyz_offsets[0]), int(header.xyz_offsets[1]), int(header.xyz_offsets[2])};
+    return ParseTextColumns(begin, end, int(header.vertex_stride), columns, out);
+}
+
+// Converts the PLY file at source_path into the paged layout at out_path, see ConvertTextToPagedCloud()
+template<typename ProgressFn, typename ChunkFn>
+bool ConvertPlyToPagedCloud(const std::string& source_path, const std::string& out_path, std::string& error, ProgressFn progress,
+    ChunkFn on_chunk)
+{
+    MappedFile file;
+    PlyHeader header;
+    if(!OpenWithHeader(source_path, file, header, ReadPlyHeader, error))
+        return false;
+    if(header.format == PlyFormat::Ascii)
+    {
+        file.Close();
+        return ConvertTextToPagedCloud(source_path, out_path, error, progress, on_chunk, header.vertex_offset, header.vertex_end,
+            [&](const char* begin, const char* end, std::vector<float>& out) {return ParsePlyVertexText(header, begin, end, out);});
+    }
+
+    file.Advise(header.vertex_offset, header.vertex_end - header.vertex_offset, MappedFileAdvice::Sequential);
+    return ConvertBlocksToPagedCloud(header.n_vertices, {0.0, 0.0, 0.0},
+        [&](size_t first, size_t count, vec3<float>* out)
+        {
+            bool valid = ReadPlyVertices(header, file.GetData(), first, count, out);
+            // read once, the copy in the temporary file is what the conversion works with
+            file.Advise(header.vertex_offset + first * header.vertex_stride, count * header.vertex_stride,
+                MappedFileAdvice::DontNeed);
+            return valid ? count : SIZE_MAX;
+        }, source_path, out_path, error, progress, on_chunk);
+}
+
+// Writes a binary little endian PLY file of n_points float x, y, z vertices, or double ones if double_precision is set
+// The number of points goes in the header, so it has to be known up front, Close() fails if fewer were written
+class PlyWriter : public BinaryFileWriter
+{
+    protected:
+    bool double_precision = false;
+    public:
+    bool Open(const std::string& path, size_t n_points, bool double_precision = false)
+    {
+        this->double_precision = double_precision;
+        std::string type = double_precision ? "double" : "float";
+        std::string header = "ply\nformat binary_little_endian 1.0\ncomment written by points\nelement vertex "
+            + std::to_string(n_points) + "\nproperty " + type + " x\nproperty " + type + " y\nproperty " + type + " z\nend_header\n";
+        return BinaryFileWriter::Open(path, header, double_precision ? sizeof(vec3<double>) : sizeof(vec3<float>), n_points);
+    }
+    // Points are written as they are, the in-memory layout is the file layout
+    bool Write(const vec3<float>* points, size_t n)
+    {
+        assert(!double_precision);
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        return WriteRecords(points, n);
+    }
+    bool Write(const vec3<double>* points, size_t n)
+    {
+        assert(double_precision);
+        static_assert(sizeof(vec3<double>) == 3 * sizeof(double));
+        return WriteRecords(points, n);
+    }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <filesystem>
+#include <system_error>
+
+#include "MappedFile.hpp"
+#include "Octree.hpp"
+
+// Binary sidecar holding the loaded points together with everything computed from them,
+// so that reopening a file needs neither parsing, sorting nor building the octree
+// Layout: PointCacheHeader, n_points tightly packed float x, y, z triples in octree order,
+// n_points floats of Z sorted ascending, n_nodes OctreeNode, n_points uint32 indices of the points in the source
+// The cache is tied to the size and modification time of the source, any change makes it stale
+
+constexpr char POINT_CACHE_MAGIC[8] = {'P', 'T', 'S', 'C', 'A', 'C', 'H', 'E'};
+// bump whenever the layout or the meaning of a field changes
+constexpr uint32_t POINT_CACHE_VERSION = 5;
+constexpr const char* POINT_CACHE_EXTENSION = ".ptcache";
+
+struct PointCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    // reserved, 0
+    uint32_t flags;
+    uint64_t source_size;
+    int64_t source_mtime;
+    // checksum of source_size and source_mtime
+    uint64_t source_checksum;
+    uint64_t n_points;
+    uint64_t n_nodes;
+    float bounding_box_low[3];
+    float bounding_box_high[3];
+    float center_average[3];
+    float center_bounding[3];
+    float furthest_point_center_distance;
+    float furthest_point_zero_distance;
+    // the points are relative to this, which keeps far away coordinates precise as floats (see LasFile.hpp)
+    double origin[3];
+    // checksum of all of the above
+    uint64_t header_checksum;
+};
+static_assert(sizeof(PointCacheHeader) == 144, "the header layout is part of the file format");
+
+// 64 bit FNV-1a
+inline uint64_t PointCacheChecksum(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t PointCacheSourceChecksum(uint64_t size, int64_t mtime)
+{
+    return PointCacheChecksum(&mtime, sizeof(mtime), PointCacheChecksum(&size, sizeof(size)));
+}
+
+inline uint64_t PointCacheHeaderChecksum(const PointCacheHeader& header)
+{
+    return PointCacheChecksum(&header, offsetof(PointCacheHeader, header_checksum));
+}
+
+inline size_t GetPointCacheSize(const PointCacheHeader& header)
+{
+    return sizeof(PointCacheHeader) + header.n_points * (4 * sizeof(float) + sizeof(uint32_t)) + header.n_nodes * sizeof(OctreeNode);
+}
+
+inline std::string GetPointCachePath(const std::string& source_path)
+{
+    return source_path + POINT_CACHE_EXTENSION;
+}
+
+inline bool GetPointCacheSourceStamp(const std::string& source_path, uint64_t& size, int64_t& mtime)
+{
+    std::error_code ec;
+    size = std::filesystem::file_size(source_path, ec);
+    if(ec)
+        return false;
+    auto time = std::filesystem::last_write_time(source_path, ec);
+    if(ec)
+        return false;
+    mtime = time.time_since_epoch().count();
+    return true;
+}
+
+// Maps the cache belonging to source_path and validates it against the source
+// Returns false if there is no cache, it is damaged or stale; the points follow the header in the mapping
+inline bool OpenPointCache(const std::string& source_path, MappedFile& file, PointCacheHeader& header)
+{
+    std::string cache_path = GetPointCachePath(source_path);
+    if(!std::filesystem::is_regular_file(cache_path))
+        return false;
+    if(!file.Open(cache_path) || file.GetSize() < sizeof(PointCacheHeader))
+        return false;
+    memcpy(&header, file.GetData(), sizeof(header));
+    if(memcmp(header.magic, POINT_CACHE_MAGIC, sizeof(POINT_CACHE_MAGIC)) != 0
+        || header.version != POINT_CACHE_VERSION
+        || header.header_checksum != PointCacheHeaderChecksum(header))
+        return false;
+    if(file.GetSize() != GetPointCacheSize(header))
+        return false;
+    uint64_t source_size;
+    int64_t source_mtime;
+    if(!GetPointCacheSourceStamp(source_path, source_size, source_mtime))
+        return false;
+    return header.source_size == source_size && header.source_mtime == source_mtime
+        && header.source_checksum == PointCacheSourceChecksum(source_size, source_mtime);
+}
+
+inline const float* GetPointCacheData(MappedFile& file)
+{
+    return (const float*)(file.GetData() + sizeof(PointCacheHeader));
+}
+
+inline const float* GetPointCacheSortedZ(MappedFile& file, const PointCacheHeader& header)
+{
+    return GetPointCacheData(file) + header.n_points * 3;
+}
+
+inline const OctreeNode* GetPointCacheNodes(MappedFile& file, const PointCacheHeader& header)
+{
+    return (const OctreeNode*)(GetPointCacheSortedZ(file, header) + header.n_points);
+}
+
+inline const uint32_t* GetPointCacheSourceIndices(MappedFile& file, const PointCacheHeader& header)
+{
+    return (const uint32_t*)(GetPointCacheNodes(file, header) + header.n_nodes);
+}
+
+// Writes the cache for source_path, header must have the counts and the statistics filled in
+// The file is written under a temporary name and renamed, so readers never see a partial cache
+// Failure is not an error, e.g. the directory might simply not be writable
+inline bool WritePointCache(const std::string& source_path, PointCacheHeader header, const float* xyz,
+    const float* sorted_z, const OctreeNode* nodes, const uint32_t* source_indices)
+{
+    memcpy(header.magic, POINT_CACHE_MAGIC, sizeof(POINT_CACHE_MAGIC));
+    header.version = POINT_CACHE_VERSION;
+    if(!GetPointCacheSourceStamp(source_path, header.source_size, header.source_mtime))
+        return false;
+    header.source_checksum = PointCacheSourceChecksum(header.source_size, header.source_mtime);
+    header.header_checksum = PointCacheHeaderChecksum(header);
+
+    std::string cache_path = GetPointCachePath(source_path);
+    std::string temp_path = cache_path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if(file == nullptr)
+        return false;
+    size_t xyz_size = header.n_points * 3 * sizeof(float);
+    size_t z_size = header.n_points * sizeof(float);
+    size_t nodes_size = header.n_nodes * sizeof(OctreeNode);
+    size_t indices_size = header.n_points * sizeof(uint32_t);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if(ok && xyz_size > 0)
+        ok = fwrite(xyz, xyz_size, 1, file) == 1;
+    if(ok && z_size > 0)
+        ok = fwrite(sorted_z, z_size, 1, file) == 1;
+    if(ok && nodes_size > 0)
+        ok = fwrite(nodes, nodes_size, 1, file) == 1;
+    if(ok && indices_size > 0)
+        ok = fwrite(source_indices, indices_size, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    std::error_code ec;
+    if(ok)
+        std::filesystem::rename(temp_path, cache_path, ec);
+    if(!ok || ec)
+    {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
@@ -1,36 +1,92 @@
 #pragma once
 
-#include "hmain.hpp"
+#include "hcore.hpp"
+
+// Formats LoadFile() understands, told apart by their first bytes
+enum class PointFileFormat
+{
+    // whitespace separated x y z lines
+    Text,
+    // see PlyFile.hpp
+    Ply,
+    // see LasFile.hpp
+    Las,
+    // see PcdFile.hpp
+    Pcd,
+    // see NpyFile.hpp
+    Npy,
+    // gzip or zstd compressed text, see CompressedText.hpp
+    CompressedText,
+};
 
 // Handles point processing as well as file loading
-// All heavy operations are done in a separate thread
+// All heavy operations run as jobs on the shared JobSystem, an idle PointProcessor costs no thread
+// Files too large to hold in memory are converted to the paged layout once and read on demand from then on (see PagedCloud.hpp)
+// Besides text (plain, gzip or zstd compressed), PLY, LAS, PCD and NumPy .npy files are loaded, picked by their header rather than their extension
+// While a text file is parsed, a subsample of every parsed chunk is published as a preview, so it can be shown before the load completes
 // Certain functions require using the Lock() and Unlock() functions to ensure thread safety
 class PointProcessor
 {
     protected:
     // Assuming most of the loading time will be spent fetching data from disk and parsing it
-    constexpr static const float WEIGHT_PARSE = 0.7f;
+    constexpr static const float WEIGHT_PARSE = 0.6f;
     constexpr static const float WEIGHT_COMPUTE = 0.1f;
-    // Assuming 7 characters per line + 2 spaces
-    constexpr static const int ASSUMED_BYTES_PER_LINE = 23;
+    // Only used to presize the per-chunk buffers, assuming 7 characters + a separator per value
+    constexpr static const int ASSUMED_BYTES_PER_VALUE = 8;
+    // Small enough for the progress to move smoothly, large enough for the per-chunk overhead to vanish
+    constexpr static const size_t PARSE_CHUNK_SIZE = 4 << 20;
+    constexpr static const size_t CACHE_COPY_BLOCK_POINTS = 1 << 20;
+    // peak memory of an in-memory load per point: the points, the parse buffers, the octree's sort entries and copy, sorted Z,
+    // the source indices
+    constexpr static const size_t IN_CORE_BYTES_PER_POINT = 52;
+    // the preview of larger files is thinned to about this many points
+    constexpr static const size_t PREVIEW_MAX_POINTS = 1 << 24;
+    // points an export filters and writes at a time
+    constexpr static const size_t EXPORT_BLOCK_POINTS = 1 << 20;
+    // blocks filtered at once by an export, then written in order
+    constexpr static const size_t EXPORT_BATCH_BLOCKS = 16;
 
     std::string file_name;
     std::string path;
+    PointFileFormat file_format = PointFileFormat::Text;
     size_t file_size;
     size_t memory_used;
-    // sorted in ascending order
+    // in octree order, every node of the octree covers a contiguous range
     std::vector<vec3<float>> points;
+    std::vector<OctreeNode> octree;
+    // Z of every point, ascending, for the section boundaries
+    std::vector<float> sorted_z;
+    // index in the file of every point, in octree order like points
+    std::vector<uint32_t> source_indices;
+    // index in the file of every point as loaded, only set by loaders that leave points out (NaN points of PCD files)
+    // and folded into source_indices by BuildSpatialIndex
+    std::vector<uint32_t> source_rows;
+    // 0 if the octree came from the cache
+    float octree_build_time = 0.0f;
+    // the whole load, in seconds
+    float load_time = 0.0f;
+    // set for out-of-core files, which leave points, octree and sorted_z empty
+    std::unique_ptr<PagedCloud> paged;
+    bool force_out_of_core;
+    // nothing shows the preview without a window, so headless loads skip it
+    bool preview_enabled;
     std::vector<float> sections;
     std::vector<size_t> section_indices;
     std::mutex access_mx;
-    std::mutex notify_mx;
-    std::thread processing_thread;
-    std::condition_variable process_notify;
+    // published parsed chunks, guarded by preview_mx; cleared once the load completes
+    std::mutex preview_mx;
+    std::vector<std::shared_ptr<const std::vector<vec3<float>>>> preview_chunks;
+    size_t preview_stride = 1;
+    vec3<float> preview_low;
+    vec3<float> preview_high;
+    float preview_furthest_zero_distance = 0.0f;
+    JobCounter load_job;
     bool is_loaded = false;
-    bool must_update = true;
-    float loading_state_parse = 0.0f;
-    float loading_state_compute[3] = {0.0f, 0.0f, 0.0f};
-    bool exit = false;
+    std::atomic<float> loading_state_parse = 0.0f;
+    // statistics (2 sweeps), sorted Z, octree
+    std::atomic<float> loading_state_compute[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    // fraction of the points the running export has gone through
+    std::atomic<float> export_state = 0.0f;
     bool failed_to_load = false;
     std::string file_load_error;
     float furthest_point_center_distance;
@@ -41,6 +97,10 @@ class PointProcessor
     vec3<float> center_bounding;
     vec3<float> bounding_box_low;
     vec3<float> bounding_box_high;
+    // the points are relative to it, 0 unless the format has its own (LAS)
+    vec3<double> origin = {0.0, 0.0, 0.0};
+    // first sweep of the statistics, for loaders that compute it while decoding; consumed by ComputeStatistics()
+    std::vector<PointStatsPartial> stats_partials;
     void SetLoadError(std::string text)
     {
         Lock();
@@ -48,136 +108,757 @@ class PointProcessor
         file_load_error = text;
         Unlock();
     }
-    bool LoadFile(std::string path)
+    // Publishes every preview_stride-th point of a loaded chunk, called from the loading jobs
+    void PublishPreview(const vec3<float>* chunk_points, size_t n)
     {
-        FILE* file = fopen(path.c_str(), "r");
-        if(file == nullptr)
+        if(n == 0 || !preview_enabled)
+            return;
+        auto chunk = std::make_shared<std::vector<vec3<float>>>();
+        chunk->reserve(n / preview_stride + 1);
+        vec3<float> low = vec3<float>{INFINITY, INFINITY, INFINITY};
+        vec3<float> high = vec3<float>{-INFINITY, -INFINITY, -INFINITY};
+        float furthest = 0.0f;
+        for(size_t i = 0; i < n; i += preview_stride)
         {
-            SetLoadError("Failed to open file!");
-            return false;
+            vec3<float> p = chunk_points[i];
+            // NaN points of PCD files, which are only dropped once the whole file is parsed
+            if(std::isnan(p.x) || std::isnan(p.y) || std::isnan(p.z))
+                continue;
+            chunk->push_back(p);
+            for(int ii = 0; ii < 3; ii++)
+            {
+                low.data[ii] = std::min(low.data[ii], p.data[ii]);
+                high.data[ii] = std::max(high.data[ii], p.data[ii]);
+            }
+            furthest = std::max(furthest, p.x*p.x + p.y*p.y + p.z*p.z);
+        }
+        if(chunk->empty())
+            return;
+        std::lock_guard<std::mutex> lock(preview_mx);
+        if(preview_chunks.empty())
+        {
+            preview_low = low;
+            preview_high = high;
         }
-        file_size = std::filesystem::file_size(path);
-        while(true)
+        for(int i = 0; i < 3; i++)
         {
-            float x, y, z;
-            int res = fscanf(file, "%f%f%f", &x, &y, &z);
-            
-            if(res == EOF)
-                break;
-            if(res != 3)
+            preview_low.data[i] = std::min(preview_low.data[i], low.data[i]);
+            preview_high.data[i] = std::max(preview_high.data[i], high.data[i]);
+        }
+        preview_furthest_zero_distance = std::max(preview_furthest_zero_distance, std::sqrt(furthest));
+        preview_chunks.push_back(std::move(chunk));
+    }
+    void PublishPreview(const std::vector<float>& values)
+    {
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        PublishPreview((const vec3<float>*)values.data(), values.size() / 3);
+    }
+    // Fills points from the cache of the file at path, if there is an up to date one
+    bool LoadCache(std::string path)
+    {
+        TraceScope trace("Read cache");
+        MappedFile file;
+        PointCacheHeader header;
+        if(!OpenPointCache(path, file, header) || header.n_points == 0)
+            return false;
+        file_size = header.source_size;
+        const float* data = GetPointCacheData(file);
+        points.resize(header.n_points);
+        // plain copies, this is bound by the disk
+        size_t n_blocks = (points.size() + CACHE_COPY_BLOCK_POINTS - 1) / CACHE_COPY_BLOCK_POINTS;
+        std::atomic<size_t> blocks_copied = 0;
+        ParallelFor(n_blocks, [&](size_t i)
+        {
+            size_t begin = i * CACHE_COPY_BLOCK_POINTS;
+            size_t end = std::min(points.size(), begin + CACHE_COPY_BLOCK_POINTS);
+            for(size_t ii = begin; ii < end; ii++)
+                points[ii] = vec3<float>{data[ii*3], data[ii*3+1], data[ii*3+2]};
+            loading_state_parse = float(++blocks_copied)/float(n_blocks);
+        });
+        const float* z = GetPointCacheSortedZ(file, header);
+        sorted_z.assign(z, z + header.n_points);
+        const OctreeNode* nodes = GetPointCacheNodes(file, header);
+        octree.assign(nodes, nodes + header.n_nodes);
+        const uint32_t* indices = GetPointCacheSourceIndices(file, header);
+        source_indices.assign(indices, indices + header.n_points);
+        auto to_vec3 = [](const float* v) {return vec3<float>{v[0], v[1], v[2]};};
+        bounding_box_low = to_vec3(header.bounding_box_low);
+        bounding_box_high = to_vec3(header.bounding_box_high);
+        center_average = to_vec3(header.center_average);
+        center_bounding = to_vec3(header.center_bounding);
+        furthest_point_center_distance = header.furthest_point_center_distance;
+        furthest_point_zero_distance = header.furthest_point_zero_distance;
+        origin = {header.origin[0], header.origin[1], header.origin[2]};
+        for(int i = 0; i < ArraySize(loading_state_compute); i++)
+            loading_state_compute[i] = 1.0f;
+        return true;
+    }
+    void WriteCache(std::string path)
+    {
+        TraceScope trace("Write cache");
+        PointCacheHeader header = {};
+        header.n_points = points.size();
+        header.n_nodes = octree.size();
+        auto from_vec3 = [](vec3<float> v, float* out) {out[0] = v.x; out[1] = v.y; out[2] = v.z;};
+        from_vec3(bounding_box_low, header.bounding_box_low);
+        from_vec3(bounding_box_high, header.bounding_box_high);
+        from_vec3(center_average, header.center_average);
+        from_vec3(center_bounding, header.center_bounding);
+        header.furthest_point_center_distance = furthest_point_center_distance;
+        header.furthest_point_zero_distance = furthest_point_zero_distance;
+        header.origin[0] = origin.x;
+        header.origin[1] = origin.y;
+        header.origin[2] = origin.z;
+        static_assert(sizeof(vec3<float>) == 3 * sizeof(float));
+        WritePointCache(path, header, (const float*)points.data(), sorted_z.data(), octree.data(), source_indices.data());
+    }
+    // Parses bytes [begin, end) of file into points
+    // parse(const char* begin, const char* end, std::vector<float>& out) parses newline aligned pieces like ParseTextChunk
+    template<typename ParseFn>
+    bool ParseText(MappedFile& file, size_t begin, size_t end, ParseFn parse)
+    {
+        TraceScope trace("Parse");
+        // parse newline aligned chunks concurrently, each into its own buffer
+        auto chunks = SplitTextChunks(file.GetData() + begin, end - begin, PARSE_CHUNK_SIZE);
+        std::vector<std::vector<float>> chunk_values(chunks.size());
+        std::vector<TextParseError> chunk_errors(chunks.size(), TextParseError::None);
+        std::atomic<size_t> first_failed_chunk = SIZE_MAX;
+        std::atomic<size_t> bytes_parsed = 0;
+        ParallelFor(chunks.size(), [&](size_t i)
+        {
+            // anything after a broken chunk would be thrown away anyway
+            if(i > first_failed_chunk)
+                return;
+            TraceScope trace("Parse chunk");
+            auto& chunk = chunks[i];
+            chunk_values[i].reserve((chunk.end - chunk.begin) / ASSUMED_BYTES_PER_VALUE);
+            chunk_errors[i] = parse(chunk.begin, chunk.end, chunk_values[i]);
+            if(chunk_errors[i] == TextParseError::None)
+                PublishPreview(chunk_values[i]);
+            else
+            {
+                size_t failed = first_failed_chunk;
+                while(i < failed && !first_failed_chunk.compare_exchange_weak(failed, i));
+            }
+            size_t parsed = bytes_parsed += chunk.end - chunk.begin;
+            loading_state_parse = float(parsed)/float(end - begin);
+        });
+        return CheckParseErrors(chunk_errors) && JoinChunks(chunk_values);
+    }
+    // Reports the first error in file order, same as a sequential parse would
+    bool CheckParseErrors(const std::vector<TextParseError>& chunk_errors)
+    {
+        for(auto error : chunk_errors)
+        {
+            if(error == TextParseError::InvalidFormat)
             {
                 SetLoadError("Failed to parse file, invalid format");
-                fclose(file);
                 return false;
             }
-            if(isnan(x) || isnan(y) || isnan(z))
-            {    
+            if(error == TextParseError::InvalidValue)
+            {
                 SetLoadError("Failed to parse file: invalid value(s) encountered");
-                fclose(file);
                 return false;
             }
-            loading_state_parse += float(ASSUMED_BYTES_PER_LINE)/float(file_size);
-            points.push_back({x, y, z});
         }
-        fclose(file);
+        return true;
+    }
+    // Moves the x, y, z values parsed per chunk into points, in order, with a single allocation
+    // Fails if there are none
+    bool JoinChunks(std::vector<std::vector<float>>& chunk_values)
+    {
+        TraceScope trace("Join chunks");
+        std::vector<size_t> chunk_offsets(chunk_values.size() + 1, 0);
+        for(size_t i = 0; i < chunk_values.size(); i++)
+            chunk_offsets[i+1] = chunk_offsets[i] + chunk_values[i].size()/3;
+        points.resize(chunk_offsets.back());
+        ParallelFor(chunk_values.size(), [&](size_t i)
+        {
+            auto& values = chunk_values[i];
+            vec3<float>* out = points.data() + chunk_offsets[i];
+            for(size_t ii = 0; ii < values.size()/3; ii++)
+                out[ii] = vec3<float>{values[ii*3], values[ii*3+1], values[ii*3+2]};
+            // release as we go to keep the peak memory down
+            values = std::vector<float>();
+        });
         if(points.size() == 0)
         {
             SetLoadError("No data found in file");
             return false;
         }
-        bounding_box_high = points[0];
-        bounding_box_low = points[0];
-        // find center and the furthest point from (0, 0, 0)
-        // also find the bounding box
-        furthest_point_zero_distance = 0.0f;
-        center_average = vec3<float>{0, 0, 0};
-        for(int i = 0; i < points.size(); i++)
-        {
-            auto& p = points[i];
-            center_average += p/float(points.size());
-            float l = p.length();
-            if(l > furthest_point_zero_distance)
-                furthest_point_zero_distance =  l;
-            
-            bounding_box_high = p.max(bounding_box_high);
-            bounding_box_low = p.min(bounding_box_low);
-
-            loading_state_compute[0] = float(i)/float(points.size());
+        return true;
+    }
+    // Maps the file at path for a loader
+    bool OpenFile(std::string path, MappedFile& file)
+    {
+        if(!file.Open(path))
+        {
+            SetLoadError("Failed to open file!");
+            return false;
         }
-        center_bounding = (bounding_box_low + bounding_box_high) / 2.0f;
-
-        // find greatest distance from center
-        vec3<float> furthest_point_center;
-        furthest_point_center_distance = 0.0f;
-        for(int i = 0; i < points.size(); i++)
-        {
-            auto p = points[i] - center_average;
-            float l = p.length();
-            if(l > furthest_point_center_distance)
+        file_size = file.GetSize();
+        return true;
+    }
+    // Maps the file at path and reads its header with read_header(const char* data, size_t size, Header&, std::string& error)
+    template<typename Header, typename ReadHeaderFn>
+    bool OpenFile(std::string path, MappedFile& file, Header& header, ReadHeaderFn read_header)
+    {
+        std::string error;
+        if(!OpenWithHeader(path, file, header, read_header, error))
+        {
+            SetLoadError(error);
+            return false;
+        }
+        file_size = file.GetSize();
+        return true;
+    }
+    // Reads n points into points, a block per job, with read(size_t first, size_t count, vec3<float>* out), which returns
+    // false if any of them is invalid; every block goes to the preview once read
+    template<typename ReadFn>
+    bool ReadBlocks(size_t n, ReadFn read)
+    {
+        points.resize(n);
+        size_t n_blocks = (n + CACHE_COPY_BLOCK_POINTS - 1) / CACHE_COPY_BLOCK_POINTS;
+        std::atomic<size_t> blocks_read = 0;
+        std::atomic<bool> valid = true;
+        ParallelFor(n_blocks, [&](size_t i)
+        {
+            size_t begin = i * CACHE_COPY_BLOCK_POINTS;
+            size_t count = std::min(n, begin + CACHE_COPY_BLOCK_POINTS) - begin;
+            if(read(begin, count, points.data() + begin))
+                PublishPreview(points.data() + begin, count);
+            else
+                valid = false;
+            loading_state_parse = float(++blocks_read)/float(n_blocks);
+        });
+        if(!valid)
+        {
+            SetLoadError("Failed to parse file: invalid value(s) encountered");
+            return false;
+        }
+        return true;
+    }
+    bool ParseTextFile(std::string path)
+    {
+        MappedFile file;
+        if(!OpenFile(path, file))
+            return false;
+        return ParseText(file, 0, file.GetSize(),
+            [](const char* begin, const char* end, std::vector<float>& out) {return ParseTextChunk(begin, end, out);});
+    }
+    // Same as ParseTextFile() while the file is decompressed, see CompressedText.hpp
+    bool ParseCompressedTextFile(std::string path)
+    {
+        MappedFile file;
+        if(!OpenFile(path, file))
+            return false;
+        TraceScope trace("Parse");
+        file.Advise(0, file.GetSize(), MappedFileAdvice::Sequential);
+        // the number of blocks is only known at the end
+        std::mutex chunks_mx;
+        std::vector<std::vector<float>> chunk_values;
+        std::vector<TextParseError> chunk_errors;
+        std::string error;
+        bool decompressed = ParseCompressedText(file.GetData(), file.GetSize(), DetectTextCompression(file.GetData(), file.GetSize()),
+            [](const char* begin, const char* end, std::vector<float>& out) {return ParseTextChunk(begin, end, out);},
+            [&](size_t index, TextParseError chunk_error, std::vector<float>& values)
             {
-                furthest_point_center_distance = l;
-                furthest_point_center = p;
+                if(chunk_error == TextParseError::None)
+                    PublishPreview(values);
+                std::lock_guard<std::mutex> lock(chunks_mx);
+                if(index >= chunk_values.size())
+                {
+                    chunk_values.resize(index + 1);
+                    chunk_errors.resize(index + 1, TextParseError::None);
+                }
+                chunk_values[index] = std::move(values);
+                chunk_errors[index] = chunk_error;
+                // anything after a broken chunk would be thrown away anyway
+                return chunk_error == TextParseError::None;
+            }, [&](float progress) {loading_state_parse = progress;}, error);
+        if(!CheckParseErrors(chunk_errors))
+            return false;
+        if(!decompressed)
+        {
+            SetLoadError(error);
+            return false;
+        }
+        return JoinChunks(chunk_values);
+    }
+    bool LoadPlyFile(std::string path)
+    {
+        MappedFile file;
+        PlyHeader header;
+        if(!OpenFile(path, file, header, ReadPlyHeader))
+            return false;
+        if(header.format == PlyFormat::Ascii)
+        {
+            if(!ParseText(file, header.vertex_offset, header.vertex_end,
+                [&](const char* begin, const char* end, std::vector<float>& out) {return ParsePlyVertexText(header, begin, end, out);}))
+                return false;
+            if(points.size() != header.n_vertices)
+            {
+                SetLoadError("Failed to parse file, the PLY header announces " + std::to_string(header.n_vertices) + " vertices");
+                return false;
             }
-            loading_state_compute[1] = float(i)/float(points.size());
+            return true;
         }
-
-        // sort by the Z axis, ascending
-        // also approximates, which probably slows this down quite a bit
-        std::sort(points.begin(), points.end(), [&](vec3<float> l, vec3<float> r) {loading_state_compute[2] += 0.1f * 1.0f/float(points.size()); return l.z < r.z;});
-        loading_state_compute[2] = 1.0f;
-        memory_used = sizeof(points[0]) * points.size();
+        if(header.n_vertices == 0)
+        {
+            SetLoadError("No data found in file");
+            return false;
+        }
+        // binary vertices are read in place, a straight copy if they hold nothing but float x, y, z
+        TraceScope trace("Read vertices");
+        file.Advise(header.vertex_offset, header.vertex_end - header.vertex_offset, MappedFileAdvice::Sequential);
+        return ReadBlocks(header.n_vertices,
+            [&](size_t first, size_t count, vec3<float>* out) {return ReadPlyVertices(header, file.GetData(), first, count, out);});
+    }
+    bool LoadLasFile(std::string path)
+    {
+        MappedFile file;
+        LasHeader header;
+        if(!OpenFile(path, file, header, ReadLasHeader))
+            return false;
+        if(header.n_points == 0)
+        {
+            SetLoadError("No data found in file");
+            return false;
+        }
+        TraceScope trace("Decode LAS");
+        origin = {header.offset[0], header.offset[1], header.offset[2]};
+        file.Advise(header.point_offset, header.n_points * header.record_length, MappedFileAdvice::Sequential);
+        points.resize(header.n_points);
+        stats_partials.resize((points.size() + POINT_STATS_BLOCK_SIZE - 1) / POINT_STATS_BLOCK_SIZE);
+        size_t n_blocks = (points.size() + CACHE_COPY_BLOCK_POINTS - 1) / CACHE_COPY_BLOCK_POINTS;
+        std::atomic<size_t> blocks_read = 0;
+        static_assert(CACHE_COPY_BLOCK_POINTS % POINT_STATS_BLOCK_SIZE == 0);
+        ParallelFor(n_blocks, [&](size_t i)
+        {
+            size_t begin = i * CACHE_COPY_BLOCK_POINTS;
+            size_t end = std::min(points.size(), begin + CACHE_COPY_BLOCK_POINTS);
+            // the first sweep of the statistics runs on every piece while it is still in cache
+            for(size_t piece = begin; piece < end; piece += POINT_STATS_BLOCK_SIZE)
+            {
+                size_t piece_end = std::min(end, piece + POINT_STATS_BLOCK_SIZE);
+                DecodeLasPoints(header, file.GetData(), piece, piece_end - piece, points.data() + piece);
+                stats_partials[piece / POINT_STATS_BLOCK_SIZE] = ComputePointStatsPartial(
+                    [&](size_t ii) {return points[ii];}, piece, piece_end);
+            }
+            PublishPreview(points.data() + begin, end - begin);
+            loading_state_parse = float(++blocks_read)/float(n_blocks);
+        });
+        loading_state_compute[0] = 1.0f;
+        return true;
+    }
+    bool LoadPcdFile(std::string path)
+    {
+        MappedFile file;
+        PcdHeader header;
+        if(!OpenFile(path, file, header, ReadPcdHeader))
+            return false;
+        // the rows of the points that are left are kept in 32 bits, like every source index
+        if(header.n_points > UINT32_MAX)
+        {
+            SetLoadError("Too many points in file");
+            return false;
+        }
+        if(header.format == PcdFormat::Ascii)
+        {
+            if(!ParseText(file, header.data_offset, file.GetSize(),
+                [&](const char* begin, const char* end, std::vector<float>& out) {return ParsePcdText(header, begin, end, out);}))
+                return false;
+            // the NaN points count too, every line is a point of the header
+            if(points.size() != header.n_points)
+            {
+                SetLoadError("Failed to parse file, the PCD header announces " + std::to_string(header.n_points) + " points");
+                return false;
+            }
+        }
+        else if(header.format == PcdFormat::Binary)
+        {
+            TraceScope trace("Read points");
+            file.Advise(header.data_offset, header.n_points * header.point_stride, MappedFileAdvice::Sequential);
+            ReadBlocks(header.n_points, [&](size_t first, size_t count, vec3<float>* out)
+            {
+                ReadPcdPoints(header, file.GetData(), first, count, out);
+                return true;
+            });
+        }
+        else
+        {
+            // a single LZF stream, the fields come one after the other so the points are only whole at its end
+            TraceScope trace("Decompress PCD");
+            points.resize(header.n_points);
+            std::string error;
+            if(!DecompressPcdPoints(header, file.GetData(), points.data(), error, [&](float p) {loading_state_parse = p;}))
+            {
+                SetLoadError(error);
+                return false;
+            }
+        }
+        source_rows.resize(points.size());
+        size_t n_kept = RemoveNanPoints(points.data(), points.size(), source_rows.data());
+        // the rows are only needed if points were dropped
+        if(n_kept == points.size())
+            source_rows = std::vector<uint32_t>();
+        else
+            source_rows.resize(n_kept);
+        points.resize(n_kept);
+        if(points.size() == 0)
+        {
+            SetLoadError("No data found in file");
+            return false;
+        }
+        // the rest was previewed as it was read
+        if(header.format != PcdFormat::BinaryCompressed)
+            return true;
+        for(size_t begin = 0; begin < points.size(); begin += CACHE_COPY_BLOCK_POINTS)
+            PublishPreview(points.data() + begin, std::min(points.size() - begin, CACHE_COPY_BLOCK_POINTS));
+        return true;
+    }
+    bool LoadNpyFile(std::string path)
+    {
+        MappedFile file;
+        NpyHeader header;
+        if(!OpenFile(path, file, header, ReadNpyHeader))
+            return false;
+        if(header.n_points == 0)
+        {
+            SetLoadError("No data found in file");
+            return false;
+        }
+        // C ordered float32 is a straight copy, the rest is converted, in both cases a block per job
+        TraceScope trace("Read array");
+        file.Advise(header.data_offset, header.n_points * 3 * header.value_size, MappedFileAdvice::Sequential);
+        return ReadBlocks(header.n_points,
+            [&](size_t first, size_t count, vec3<float>* out) {return ReadNpyPoints(header, file.GetData(), first, count, out);});
+    }
+    void ComputeStatistics()
+    {
+        TraceScope trace("Statistics");
+        auto progress = [&](int sweep, float progress) {loading_state_compute[sweep] = progress;};
+        PointStats stats;
+        if(!stats_partials.empty())
+        {
+            stats = FinishPointStats(points.size(), [&](size_t i) {return points[i];}, stats_partials, progress);
+            stats_partials = std::vector<PointStatsPartial>();
+        }
+        else
+            stats = ComputePointStats(points.data(), points.size(), progress);
+        bounding_box_low = stats.bounding_box_low;
+        bounding_box_high = stats.bounding_box_high;
+        center_average = stats.center_average;
+        center_bounding = stats.center_bounding;
+        furthest_point_zero_distance = stats.furthest_point_zero_distance;
+        furthest_point_center_distance = stats.furthest_point_center_distance;
+    }
+    void SortZ()
+    {
+        TraceScope trace("Sort Z");
+        sorted_z.resize(points.size());
+        ParallelFor(points.size() / CACHE_COPY_BLOCK_POINTS + 1, [&](size_t b)
+        {
+            size_t end = std::min(points.size(), (b + 1) * CACHE_COPY_BLOCK_POINTS);
+            for(size_t i = b * CACHE_COPY_BLOCK_POINTS; i < end; i++)
+                sorted_z[i] = points[i].z;
+        });
+        RadixSort(sorted_z, [](float z) {return FloatSortKey(z);},
+            [&](float progress) {loading_state_compute[2] = progress;});
+    }
+    void BuildSpatialIndex()
+    {
+        TraceScope trace("Octree");
+        auto start = std::chrono::steady_clock::now();
+        octree = BuildOctree(points, source_indices, bounding_box_low, bounding_box_high,
+            [&](float progress) {loading_state_compute[3] = progress;});
+        if(!source_rows.empty())
+        {
+            ParallelFor(source_indices.size() / CACHE_COPY_BLOCK_POINTS + 1, [&](size_t b)
+            {
+                size_t end = std::min(source_indices.size(), (b + 1) * CACHE_COPY_BLOCK_POINTS);
+                for(size_t i = b * CACHE_COPY_BLOCK_POINTS; i < end; i++)
+                    source_indices[i] = source_rows[source_indices[i]];
+            });
+            source_rows = std::vector<uint32_t>();
+        }
+        octree_build_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    }
+    // Picks the format by the first bytes of the file, anything unknown is taken for text
+    PointFileFormat DetectFileFormat(std::string path)
+    {
+        char head[8] = {};
+        size_t n = 0;
+        FILE* f = fopen(path.c_str(), "rb");
+        if(f != nullptr)
+        {
+            n = fread(head, 1, sizeof(head), f);
+            fclose(f);
+        }
+        if(IsPlyFile(head, n))
+            return PointFileFormat::Ply;
+        if(IsLasFile(head, n))
+            return PointFileFormat::Las;
+        if(IsPcdFile(head, n))
+            return PointFileFormat::Pcd;
+        if(IsNpyFile(head, n))
+            return PointFileFormat::Npy;
+        if(DetectTextCompression(head, n) != TextCompression::None)
+            return PointFileFormat::CompressedText;
+        return PointFileFormat::Text;
+    }
+    // Reads the count of points off the header of the file at path, false if it does not read
+    template<typename Header>
+    static bool ReadHeaderPoints(std::string path, bool (*read_header)(const char*, size_t, Header&, std::string&),
+        size_t Header::* count, size_t& n_points)
+    {
+        MappedFile file;
+        Header header;
+        std::string error;
+        if(!OpenWithHeader(path, file, header, read_header, error))
+            return false;
+        n_points = header.*count;
+        return true;
+    }
+    // Exact for formats that count their points in a header, guessed from the size for text
+    size_t EstimatePoints(std::string path)
+    {
+        size_t n_points;
+        if(file_format == PointFileFormat::Ply && ReadHeaderPoints(path, ReadPlyHeader, &PlyHeader::n_vertices, n_points))
+            return n_points;
+        if(file_format == PointFileFormat::Las && ReadHeaderPoints(path, ReadLasHeader, &LasHeader::n_points, n_points))
+            return n_points;
+        if(file_format == PointFileFormat::Pcd && ReadHeaderPoints(path, ReadPcdHeader, &PcdHeader::n_points, n_points))
+            return n_points;
+        if(file_format == PointFileFormat::Npy && ReadHeaderPoints(path, ReadNpyHeader, &NpyHeader::n_points, n_points))
+            return n_points;
+        if(file_format == PointFileFormat::CompressedText)
+        {
+            MappedFile file;
+            if(file.Open(path))
+            {
+                TextCompression compression = DetectTextCompression(file.GetData(), file.GetSize());
+                return EstimateDecompressedSize(file.GetData(), file.GetSize(), compression) / ASSUMED_BYTES_PER_VALUE / 3;
+            }
+        }
+        return std::filesystem::file_size(path) / ASSUMED_BYTES_PER_VALUE / 3;
+    }
+    // Whether an in-memory load would take more than half of the installed memory
+    bool ShouldLoadOutOfCore(size_t estimated_points)
+    {
+        size_t physical = GetPhysicalMemory();
+        return physical != 0 && estimated_points * IN_CORE_BYTES_PER_POINT > physical / 2;
+    }
+    bool LoadPaged(std::string path)
+    {
+        // pages are dropped again past a quarter of the installed memory
+        size_t physical = GetPhysicalMemory();
+        paged = std::make_unique<PagedCloud>(physical != 0 ? physical / 4 : size_t(1) << 30);
+        if(!paged->Open(path))
+        {
+            // the conversion reports its progress as one fraction, split across the loading stages
+            auto progress = [&](float p)
+            {
+                loading_state_parse = p / 0.4f;
+                for(int i = 0; i < ArraySize(loading_state_compute); i++)
+                    loading_state_compute[i] = std::clamp((p - 0.4f) / 0.6f * ArraySize(loading_state_compute) - i, 0.0f, 1.0f);
+            };
+            std::string error;
+            TraceScope trace("Convert to pages");
+            auto start = std::chrono::steady_clock::now();
+            auto on_chunk = [&](const std::vector<float>& values) {PublishPreview(values);};
+            bool converted;
+            if(file_format == PointFileFormat::Ply)
+                converted = ConvertPlyToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            else if(file_format == PointFileFormat::Las)
+                converted = ConvertLasToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            else if(file_format == PointFileFormat::Pcd)
+                converted = ConvertPcdToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            else if(file_format == PointFileFormat::Npy)
+                converted = ConvertNpyToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            else if(file_format == PointFileFormat::CompressedText)
+                converted = ConvertCompressedTextToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            else
+                converted = ConvertToPagedCloud(path, GetPagedCloudPath(path), error, progress, on_chunk);
+            if(!converted)
+            {
+                SetLoadError(error);
+                return false;
+            }
+            octree_build_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+            if(!paged->Open(path))
+            {
+                SetLoadError("Failed to open " + GetPagedCloudPath(path));
+                return false;
+            }
+        }
+        auto& header = paged->GetHeader();
+        file_size = header.source_size;
+        auto to_vec3 = [](const float* v) {return vec3<float>{v[0], v[1], v[2]};};
+        bounding_box_low = to_vec3(header.bounding_box_low);
+        bounding_box_high = to_vec3(header.bounding_box_high);
+        center_average = to_vec3(header.center_average);
+        center_bounding = to_vec3(header.center_bounding);
+        furthest_point_center_distance = header.furthest_point_center_distance;
+        furthest_point_zero_distance = header.furthest_point_zero_distance;
+        origin = {header.origin[0], header.origin[1], header.origin[2]};
+        loading_state_parse = 1.0f;
+        for(int i = 0; i < ArraySize(loading_state_compute); i++)
+            loading_state_compute[i] = 1.0f;
+        memory_used = paged->GetTotalMemoryUsage();
+        return true;
+    }
+    bool LoadFile(std::string path)
+    {
+        file_format = DetectFileFormat(path);
+        size_t estimated_points = EstimatePoints(path);
+        preview_stride = std::max<size_t>(1, estimated_points / PREVIEW_MAX_POINTS);
+        if(force_out_of_core || ShouldLoadOutOfCore(estimated_points) || std::filesystem::exists(GetPagedCloudPath(path)))
+            return LoadPaged(path);
+        // an up to date cache already holds the ordered points, the indices and the statistics
+        if(!LoadCache(path))
+        {
+            bool parsed;
+            if(file_format == PointFileFormat::Ply)
+                parsed = LoadPlyFile(path);
+            else if(file_format == PointFileFormat::Las)
+                parsed = LoadLasFile(path);
+            else if(file_format == PointFileFormat::Pcd)
+                parsed = LoadPcdFile(path);
+            else if(file_format == PointFileFormat::Npy)
+                parsed = LoadNpyFile(path);
+            else
+                parsed = (file_format == PointFileFormat::CompressedText) ? ParseCompressedTextFile(path) : ParseTextFile(path);
+            if(!parsed)
+                return false;
+            // the octree and the source indices count points in 32 bits, the paged layout has the same limit
+            if(points.size() > UINT32_MAX)
+            {
+                SetLoadError("Too many points in file");
+                return false;
+            }
+            ComputeStatistics();
+            BuildSpatialIndex();
+            SortZ();
+            WriteCache(path);
+        }
+        memory_used = sizeof(points[0]) * points.size() + GetIndexMemoryUsage();
         return true;
     }
     void ProcessingFunction()
     {
-        if(!LoadFile(path))
-            return;      
-        while(true)
+        TraceScope trace("Load");
+        auto start = std::chrono::steady_clock::now();
+        bool loaded = LoadFile(path);
+        load_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
         {
-            if(!must_update)
+            // whoever still shows the preview holds on to the chunks it has
+            std::lock_guard<std::mutex> lock(preview_mx);
+            preview_chunks.clear();
+            preview_chunks.shrink_to_fit();
+        }
+        if(!loaded)
+            return;
+        Lock();
+        is_loaded = true;
+        Unlock();
+    }
+    // Lock() required
+    // sorted_z is sorted, so every boundary is a binary search: O(k log n) for k sections
+    // section_indices[i] is the number of points up to the end of section i
+    void UpdateSectionIndices()
+    {
+        TraceScope trace("Section update");
+        section_indices.resize(sections.size());
+        float pos = 0.0f;
+        if(paged != nullptr)
+        {
+            for(size_t i = 0; i < sections.size(); i++)
             {
-                auto lock = std::unique_lock<std::mutex>(notify_mx);
-                process_notify.wait(lock);
+                pos += sections[i];
+                section_indices[i] = paged->CountUpTo(pos);
             }
-            
-            if(exit)
-                return;
-            Lock();
-            std::vector<float> sections = this->sections;
-            must_update = false;
-            Unlock();
-            if(sections.size() != 0)
+            return;
+        }
+        auto begin = sorted_z.begin();
+        for(size_t i = 0; i < sections.size(); i++)
+        {
+            pos += sections[i];
+            begin = std::upper_bound(begin, sorted_z.end(), pos);
+            section_indices[i] = begin - sorted_z.begin();
+        }
+    }
+    // Number of points with z_above < Z <= z_up_to
+    size_t CountBetween(float z_above, float z_up_to)
+    {
+        return (z_up_to > z_above) ? CountUpTo(z_up_to) - CountUpTo(z_above) : 0;
+    }
+    // Passes select(points, i) of every point i with z_above < Z <= z_up_to to write(const T*, size_t), in order
+    // Blocks are filtered a batch at a time concurrently, then written one after the other
+    template<typename T, typename SelectFn, typename WriteFn>
+    void ForEachSelected(float z_above, float z_up_to, SelectFn select, WriteFn write)
+    {
+        const vec3<float>* source = (paged != nullptr) ? paged->GetMappedPoints() : points.data();
+        size_t n = GetNPoints();
+        export_state = 0.0f;
+        if(CountBetween(z_above, z_up_to) == 0)
+            return;
+        size_t n_blocks = (n + EXPORT_BLOCK_POINTS - 1) / EXPORT_BLOCK_POINTS;
+        std::vector<std::vector<T>> selected(EXPORT_BATCH_BLOCKS);
+        for(size_t batch = 0; batch < n_blocks; batch += EXPORT_BATCH_BLOCKS)
+        {
+            size_t batch_blocks = std::min(EXPORT_BATCH_BLOCKS, n_blocks - batch);
+            ParallelFor(batch_blocks, [&](size_t b)
             {
-                int current_section = 0;
-                std::vector<size_t> section_indices;
-                section_indices.resize(sections.size(), 0);
-                float pos = sections[0];
-                for(size_t i = 0; i < points.size(); i++)
+                size_t begin = (batch + b) * EXPORT_BLOCK_POINTS;
+                size_t end = std::min(n, begin + EXPORT_BLOCK_POINTS);
+                selected[b].clear();
+                for(size_t i = begin; i < end; i++)
                 {
-                    auto p = points[i];
-                    if(p.z > pos)
-                    {
-                        section_indices[current_section] = i;
-                        current_section++;
-                        if(current_section == sections.size())
-                            break;
-                        pos += sections[current_section];
-                    }
+                    if(source[i].z > z_above && source[i].z <= z_up_to)
+                        selected[b].push_back(select(source, i));
                 }
-                if(current_section != sections.size())
-                    section_indices[current_section] = points.size();
-                this->section_indices = section_indices;
-            }
-            Lock();
-            is_loaded = true;
-            Unlock();
+            });
+            for(size_t b = 0; b < batch_blocks; b++)
+                write(selected[b].data(), selected[b].size());
+            export_state = float(batch + batch_blocks) / float(n_blocks);
         }
     }
-    void ProcessorNotify()
+    // Passes the points with z_above < Z <= z_up_to to write(const vec3<float>*, size_t), in order
+    template<typename WriteFn>
+    void ExportPoints(float z_above, float z_up_to, WriteFn write)
     {
-        auto lock = std::unique_lock<std::mutex>(notify_mx);
-        lock.unlock();
-        process_notify.notify_one();
+        const vec3<float>* source = (paged != nullptr) ? paged->GetMappedPoints() : points.data();
+        size_t n = GetNPoints();
+        if(CountBetween(z_above, z_up_to) == n)
+        {
+            // the points are the body of the file as they are
+            export_state = 0.0f;
+            write(source, n);
+            export_state = 1.0f;
+            return;
+        }
+        ForEachSelected<vec3<float>>(z_above, z_up_to, [](const vec3<float>* p, size_t i) {return p[i];}, write);
+    }
+    // Same as ExportPoints() with the origin added, as doubles: the actual coordinates of the points
+    template<typename WriteFn>
+    void ExportAbsolutePoints(float z_above, float z_up_to, WriteFn write)
+    {
+        vec3<double> o = origin;
+        ForEachSelected<vec3<double>>(z_above, z_up_to,
+            [o](const vec3<float>* p, size_t i) {return vec3<double>{o.x + p[i].x, o.y + p[i].y, o.z + p[i].z};}, write);
+    }
+    // Without load the file is not loaded, for subclasses that run the steps of LoadFile() themselves (see bench/bench.cpp)
+    PointProcessor(std::string path, bool out_of_core, bool preview, bool load)
+    {
+        force_out_of_core = out_of_core;
+        preview_enabled = preview;
+        assert(std::filesystem::exists(path));
+        this->path = std::filesystem::absolute(path);
+        this->file_name = std::filesystem::path(path).filename();
+        // whole files are low priority, so a running load splits across all cores before the next one starts
+        if(load)
+            JobSystem::Get().Submit(JobPriority::Low, &load_job, [this]() {ProcessingFunction();});
     }
     public:
     // Lock() required
@@ -195,13 +876,18 @@ class PointProcessor
     float LoadingState()
     {
         float v = 0.0f;
-        v += std::min(1.0f, loading_state_parse) * WEIGHT_PARSE;
+        v += std::min(1.0f, loading_state_parse.load()) * WEIGHT_PARSE;
         for(int i = 0; i < ArraySize(loading_state_compute); i++)
         {
-            v += std::min(1.0f, loading_state_compute[i]) * WEIGHT_COMPUTE;
+            v += std::min(1.0f, loading_state_compute[i].load()) * WEIGHT_COMPUTE;
         }
         return v;
     }
+    // Same caveats as LoadingState(), for an export running on another thread
+    float ExportState()
+    {
+        return export_state;
+    }
     std::string GetLoadFailureError()
     {
         assert(HasFailedToLoad());
@@ -219,13 +905,19 @@ class PointProcessor
     {
         return file_size;
     }
+    // For out-of-core files the size of the data as if it was all in memory
     size_t GetMemoryUsage()
     {
         return memory_used;
     }
+    // Memory actually held, only less than GetMemoryUsage() for out-of-core files
+    size_t GetResidentMemoryUsage()
+    {
+        return (paged != nullptr) ? paged->GetResidentMemoryUsage() : memory_used;
+    }
     size_t GetNPoints()
     {
-        return points.size();
+        return (paged != nullptr) ? paged->GetNPoints() : points.size();
     }
     float GetFurthestDistanceFromZero()
     {
@@ -251,19 +943,83 @@ class PointProcessor
     {
         return bounding_box_high;
     }
+    // Every point and statistic is relative to this, the actual coordinates are origin + point
+    vec3<double> GetOrigin()
+    {
+        return origin;
+    }
+    bool HasOrigin()
+    {
+        return origin.x != 0.0 || origin.y != 0.0 || origin.z != 0.0;
+    }
     // Lock() required
     void SetSections(std::vector<float>& sections)
     {
         assert(IsLoaded());
         assert(sections.size() > 0);
         this->sections = sections;
-        must_update = true;
-        ProcessorNotify();
+        UpdateSectionIndices();
     }
-    void GetPointsSorted(std::vector<vec3<float>>* out)
+    // In octree order, GetNPoints() of them, valid and unchanging for the lifetime of the processor once loaded
+    // Not available for out-of-core files, their points are read through GetPagedCloud()
+    const vec3<float>* GetPoints()
     {
         assert(IsLoaded());
-        *out = points;
+        assert(!IsOutOfCore());
+        return points.data();
+    }
+    // Breadth first, the root comes first; the same lifetime as GetPoints()
+    const std::vector<OctreeNode>& GetOctree()
+    {
+        assert(IsLoaded());
+        return (paged != nullptr) ? paged->GetNodes() : octree;
+    }
+    bool IsOutOfCore()
+    {
+        return paged != nullptr;
+    }
+    // nullptr unless out-of-core, the same lifetime as GetPoints()
+    PagedCloud* GetPagedCloud()
+    {
+        assert(IsLoaded());
+        return paged.get();
+    }
+    // Seconds the load took, valid once loaded
+    float GetLoadTime()
+    {
+        return load_time;
+    }
+    // Seconds (for out-of-core files the whole conversion), 0 if the octree came from the cache
+    float GetOctreeBuildTime()
+    {
+        return octree_build_time;
+    }
+    // Memory of the octree, the sorted Z values and the source indices, on top of the points themselves
+    size_t GetIndexMemoryUsage()
+    {
+        if(paged != nullptr)
+            return paged->GetNodes().size() * sizeof(OctreeNode);
+        return octree.size() * sizeof(OctreeNode) + sorted_z.size() * sizeof(float) + source_indices.size() * sizeof(uint32_t);
+    }
+    // Appends the preview chunks published since the first_chunk-th, returns the number published so far
+    // Once the load completes there are none anymore, the loaded points take over
+    size_t GetPreviewChunks(size_t first_chunk, std::vector<std::shared_ptr<const std::vector<vec3<float>>>>& out)
+    {
+        std::lock_guard<std::mutex> lock(preview_mx);
+        for(size_t i = first_chunk; i < preview_chunks.size(); i++)
+            out.push_back(preview_chunks[i]);
+        return preview_chunks.size();
+    }
+    // Bounds of the preview so far, false if nothing has been published yet
+    bool GetPreviewBounds(vec3<float>& low, vec3<float>& high, float& furthest_zero_distance)
+    {
+        std::lock_guard<std::mutex> lock(preview_mx);
+        if(preview_chunks.empty())
+            return false;
+        low = preview_low;
+        high = preview_high;
+        furthest_zero_distance = preview_furthest_zero_distance;
+        return true;
     }
     // Lock() required
     std::vector<size_t> GetSectionIndices()
@@ -271,6 +1027,118 @@ class PointProcessor
         assert(IsLoaded());
         return section_indices;
     }
+    // Number of points with Z <= z
+    size_t CountUpTo(float z)
+    {
+        assert(IsLoaded());
+        if(paged != nullptr)
+            return paged->CountUpTo(z);
+        return std::upper_bound(sorted_z.begin(), sorted_z.end(), z) - sorted_z.begin();
+    }
+    // Writes the points with z_above < Z <= z_up_to to out_path as binary PLY, in the order they are kept in
+    // Pass the boundaries of a section to export it, infinities to export everything
+    // If there is an origin the points are written with it added, as double x, y, z, so the file holds the actual coordinates
+    // Returns false and sets error if the file could not be written
+    bool ExportPly(std::string out_path, float z_above, float z_up_to, std::string& error)
+    {
+        assert(IsLoaded());
+        TraceScope trace("Export PLY");
+        size_t n_export = CountBetween(z_above, z_up_to);
+        bool absolute = HasOrigin();
+        PlyWriter writer;
+        if(!writer.Open(out_path, n_export, absolute))
+        {
+            error = "Failed to create " + out_path;
+            return false;
+        }
+        if(absolute)
+            ExportAbsolutePoints(z_above, z_up_to, [&](const vec3<double>* p, size_t n) {writer.Write(p, n);});
+        else
+            ExportPoints(z_above, z_up_to, [&](const vec3<float>* p, size_t n) {writer.Write(p, n);});
+        if(!writer.Close())
+        {
+            error = "Failed to write " + out_path;
+            return false;
+        }
+        return true;
+    }
+    // Same as ExportPly() as a C ordered float32 array of shape (N, 3), or float64 if there is an origin
+    bool ExportNpy(std::string out_path, float z_above, float z_up_to, std::string& error)
+    {
+        assert(IsLoaded());
+        TraceScope trace("Export NPY");
+        size_t n_export = CountBetween(z_above, z_up_to);
+        bool absolute = HasOrigin();
+        NpyWriter writer;
+        bool opened = absolute ? writer.Open(out_path, "<f8", sizeof(double), n_export, 3)
+            : writer.Open(out_path, "<f4", sizeof(float), n_export, 3);
+        if(!opened)
+        {
+            error = "Failed to create " + out_path;
+            return false;
+        }
+        if(absolute)
+            ExportAbsolutePoints(z_above, z_up_to, [&](const vec3<double>* p, size_t n) {writer.Write(p, n);});
+        else
+            ExportPoints(z_above, z_up_to, [&](const vec3<float>* p, size_t n) {writer.Write(p, n);});
+        if(!writer.Close())
+        {
+            error = "Failed to write " + out_path;
+            return false;
+        }
+        return true;
+    }
+    // Writes the indices in the file of the points with z_above < Z <= z_up_to as a uint64 array of shape (N,), ascending:
+    // cloud[indices] of the file's points as an array is the section
+    bool ExportIndicesNpy(std::string out_path, float z_above, float z_up_to, std::string& error)
+    {
+        assert(IsLoaded());
+        TraceScope trace("Export indices");
+        size_t n_export = CountBetween(z_above, z_up_to);
+        NpyWriter writer;
+        if(!writer.Open(out_path, "<u8", sizeof(uint64_t), n_export, 0))
+        {
+            error = "Failed to create " + out_path;
+            return false;
+        }
+        // a bit per point of the file, set for the selected ones and read back in file order; the file can have more
+        // points than were loaded (NaN points of PCD files), so the bits grow with the largest index
+        const uint32_t* indices = (paged != nullptr) ? paged->GetMappedSourceIndices() : source_indices.data();
+        std::vector<uint64_t> selected((GetNPoints() + 63) / 64, 0);
+        ForEachSelected<uint32_t>(z_above, z_up_to, [indices](const vec3<float>*, size_t i) {return indices[i];},
+            [&](const uint32_t* s, size_t n)
+            {
+                for(size_t i = 0; i < n; i++)
+                {
+                    if(s[i] / 64 >= selected.size())
+                        selected.resize(s[i] / 64 + 1, 0);
+                    selected[s[i] / 64] |= uint64_t(1) << (s[i] % 64);
+                }
+            });
+        std::vector<uint64_t> block;
+        block.reserve(EXPORT_BLOCK_POINTS + 64);
+        for(size_t word = 0; word < selected.size(); word++)
+        {
+            for(uint64_t bits = selected[word]; bits != 0; bits &= bits - 1)
+                block.push_back(word * 64 + std::countr_zero(bits));
+            if(block.size() >= EXPORT_BLOCK_POINTS || word + 1 == selected.size())
+            {
+                writer.Write(block.data(), block.size());
+                block.clear();
+            }
+        }
+        if(!writer.Close())
+        {
+            error = "Failed to write " + out_path;
+            return false;
+        }
+        return true;
+    }
+    // Blocks until the load has finished or failed, meanwhile the calling thread helps with the load's jobs
+    void WaitForLoad()
+    {
+        JobSystem::Get().Wait(load_job);
+    }
     void Lock()
     {
         access_mx.lock();
@@ -283,18 +1151,13 @@ class PointProcessor
     {
         return access_mx.try_lock();
     }
-    PointProcessor(std::string path)
+    // out_of_core forces the paged mode, which is otherwise picked for files that would not fit in memory
+    // preview publishes the parsed chunks while loading, see GetPreviewChunks()
+    PointProcessor(std::string path, bool out_of_core = false, bool preview = true) : PointProcessor(path, out_of_core, preview, true)
     {
-        assert(std::filesystem::exists(path));
-        this->path = std::filesystem::absolute(path);
-        this->file_name = std::filesystem::path(path).filename();
-        processing_thread = std::thread(&PointProcessor::ProcessingFunction, this);
     }
     ~PointProcessor()
     {
-        exit = true;
-        if(!failed_to_load)
-            ProcessorNotify();
-        processing_thread.join();
+        JobSystem::Get().Wait(load_job);
     }
 };
\ No newline at end of file
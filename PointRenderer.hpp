@@ -0,0 +1,940 @@
+#pragma once
+
+#include "hmain.hpp"
+
+// Draws a point cloud and its section separators with core profile OpenGL (3.2+)
+// Points are colored in the vertex shader by comparing their Z against the section boundaries,
+// so editing sections never touches the vertex data
+// Only the octree nodes intersecting the view frustum are drawn, all of them with a single glMultiDrawArrays
+// In level of detail mode at most point_budget points are drawn per frame (see Lod.hpp); while nothing changes
+// the following frames add further points to an offscreen buffer until the whole visible cloud is shown
+// Points are streamed from the PointProcessor's storage in chunks of UPLOAD_CHUNK_SIZE, one per frame,
+// so a switch to a large cloud never stalls the UI; the uploaded prefix is drawn in the meantime
+// Every processor that has been shown keeps its buffer until the memory budget forces out the least recently shown,
+// so switching back to a recent file is instant; Prefetch() uploads a processor before it is shown
+// While a file is still loading its preview (PointProcessor::GetPreviewChunks) is drawn instead, growing as chunks are parsed,
+// until the loaded cloud has replaced it on the GPU
+// Out-of-core clouds never sit on the GPU whole: their buffer is a pool of page sized slots holding the visible leaves,
+// largest on screen first, which are refilled least recently visible first as the view moves
+// Requires a current GL context for its whole lifetime
+class PointRenderer
+{
+    public:
+    // size of the uniform arrays, sections past this are not drawn
+    constexpr static const int MAX_SECTIONS = 64;
+    protected:
+    constexpr static const char* POINT_VERTEX_SHADER = R"(
+in vec3 position;
+uniform mat4 view_projection;
+uniform int n_sections;
+uniform float boundaries[MAX_SECTIONS];
+uniform vec3 colors[MAX_SECTIONS];
+out vec3 point_color;
+void main()
+{
+    // section i holds the points with boundaries[i-1] < z <= boundaries[i]
+    int section = 0;
+    while(section < n_sections && position.z > boundaries[section])
+        section++;
+    if(section == n_sections)
+    {
+        // past the last boundary, outside of the clip volume
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+        point_color = vec3(0.0);
+        return;
+    }
+    gl_Position = view_projection * vec4(position, 1.0);
+    point_color = colors[section];
+}
+)";
+    constexpr static const char* POINT_FRAGMENT_SHADER = R"(
+in vec3 point_color;
+out vec4 frag_color;
+void main()
+{
+    frag_color = vec4(point_color, 1.0);
+}
+)";
+    // one instance per separator, the unit quad is scaled and moved to the boundary
+    constexpr static const char* PLANE_VERTEX_SHADER = R"(
+in vec2 corner;
+uniform mat4 view_projection;
+uniform float plane_size;
+uniform float boundaries[MAX_SECTIONS];
+uniform vec3 colors[MAX_SECTIONS];
+out vec3 plane_color;
+void main()
+{
+    gl_Position = view_projection * vec4(corner * plane_size, boundaries[gl_InstanceID], 1.0);
+    plane_color = colors[gl_InstanceID];
+}
+)";
+    constexpr static const char* PLANE_FRAGMENT_SHADER = R"(
+in vec3 plane_color;
+uniform float opacity;
+out vec4 frag_color;
+void main()
+{
+    frag_color = vec4(plane_color, opacity);
+}
+)";
+
+    // bytes copied per frame, ~1GB/s at 60 frames per second
+    constexpr static const size_t UPLOAD_CHUNK_SIZE = 16 << 20;
+    constexpr static const size_t DEFAULT_MEMORY_BUDGET = size_t(1) << 30;
+    constexpr static const size_t DEFAULT_POINT_BUDGET = 5000000;
+    // staging slots in flight, a slot is only reused once the GPU copy out of it has completed
+    constexpr static const int UPLOAD_SLOTS = 2;
+    // leaves of out-of-core clouds with more points are cut off, their points are shuffled so the rest is a subsample
+    constexpr static const size_t SLOT_POINTS = PAGED_CLOUD_PAGE_POINTS;
+    constexpr static const uint32_t NO_SLOT = UINT32_MAX;
+
+    // GPU copy of the points of one processor
+    struct GpuCloud
+    {
+        // identifies the processor, only compared, expired processors are dropped before any lookup
+        PointProcessor* key;
+        std::weak_ptr<PointProcessor> source;
+        GLuint vbo;
+        size_t n_points;
+        size_t n_uploaded;
+        // value of use_counter when last shown
+        uint64_t last_used;
+        // when the first chunk was copied, and seconds from then until the last one
+        std::chrono::steady_clock::time_point upload_start;
+        float upload_time;
+        // out-of-core clouds only, n_points is then the capacity of the slots
+        bool paged;
+        // per octree node its slot, per slot its leaf, the leaf's points in it and the frame it was last visible in
+        std::vector<uint32_t> leaf_slots;
+        std::vector<uint32_t> slot_leaves;
+        std::vector<uint32_t> slot_counts;
+        std::vector<uint64_t> slot_last_visible;
+        // changes whenever the contents of a slot change
+        size_t slot_version;
+    };
+    // a file that is still loading, drawn whole in the order the chunks arrive
+    struct PreviewCloud
+    {
+        // nullptr if there is no preview
+        PointProcessor* key;
+        std::weak_ptr<PointProcessor> source;
+        GLuint vbo;
+        size_t capacity;
+        size_t n_points;
+        // chunks fetched from the source so far
+        size_t n_chunks;
+    };
+    // a copy into a cloud's buffer
+    struct PendingUpload
+    {
+        size_t offset;
+        const void* data;
+        size_t size;
+    };
+
+    struct ProgramUniforms
+    {
+        GLint view_projection;
+        GLint n_sections;
+        GLint boundaries;
+        GLint colors;
+    };
+
+    GLuint point_program = 0;
+    GLuint plane_program = 0;
+    ProgramUniforms point_uniforms;
+    ProgramUniforms plane_uniforms;
+    GLint plane_size_uniform;
+    GLint plane_opacity_uniform;
+    GLuint point_vao = 0;
+    GLuint plane_vao = 0;
+    GLuint plane_vbo = 0;
+    std::vector<GpuCloud> clouds;
+    // index into clouds of the one being shown, -1 if none
+    int current = -1;
+    uint64_t use_counter = 0;
+    size_t memory_budget;
+    // persistently mapped staging buffer, only with ARB_buffer_storage, otherwise glBufferSubData is used
+    GLuint staging_buffer = 0;
+    char* staging_data = nullptr;
+    GLsync staging_fences[UPLOAD_SLOTS] = {};
+    int staging_slot = 0;
+    // visible point ranges of the last frame, kept to avoid reallocating every frame
+    std::vector<GLint> draw_firsts;
+    std::vector<GLsizei> draw_counts;
+    size_t n_drawn = 0;
+    // out-of-core clouds: visible leaves of the last frame, how many of them are in slots, frame count for the slots
+    std::vector<LodLeaf> paged_leaves;
+    size_t paged_ready = 0;
+    uint64_t paged_frame = 0;
+    std::vector<PendingUpload> uploads;
+    // everything Upload() has copied so far
+    size_t n_uploaded_bytes = 0;
+    // processors to upload once the current cloud is complete, in order
+    std::vector<PointProcessor*> prefetch_queue;
+    PreviewCloud preview = {};
+    // fetched preview chunks not on the GPU yet, the first one possibly in part
+    std::vector<std::shared_ptr<const std::vector<vec3<float>>>> preview_pending;
+    size_t preview_pending_uploaded = 0;
+    bool lod_enabled = true;
+    size_t point_budget = DEFAULT_POINT_BUDGET;
+    // level of detail state, everything the accumulated image depends on; any change starts it over
+    // laid out without padding, it is compared with memcmp
+    struct LodView
+    {
+        glm::mat4 view_projection;
+        // slot_version for out-of-core clouds
+        size_t n_uploaded;
+        int width;
+        int height;
+        int cloud;
+        int n_sections;
+        float boundaries[MAX_SECTIONS];
+        float colors[MAX_SECTIONS * 3];
+    };
+    LodView lod_view;
+    bool lod_restart = true;
+    std::vector<LodLeaf> lod_leaves;
+    size_t lod_available = 0;
+    size_t lod_shown = 0;
+    // the image being refined, the size of the viewport
+    GLuint lod_fbo = 0;
+    GLuint lod_color = 0;
+    int lod_width = 0;
+    int lod_height = 0;
+    int n_sections = 0;
+    float boundaries[MAX_SECTIONS];
+    float colors[MAX_SECTIONS * 3];
+
+    GLuint CompileShader(GLenum type, std::string header, const char* source)
+    {
+        std::string text = header + source;
+        const char* text_ptr = text.c_str();
+        GLuint shader = glCreateShader(type);
+        glShaderSource(shader, 1, &text_ptr, nullptr);
+        glCompileShader(shader);
+        GLint ok = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if(ok != GL_TRUE)
+        {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            fprintf(stderr, "Failed to compile shader: %s\n", log);
+        }
+        assert(ok == GL_TRUE);
+        return shader;
+    }
+    GLuint LinkProgram(std::string header, const char* vertex_source, const char* fragment_source, const char* position_name)
+    {
+        GLuint vertex = CompileShader(GL_VERTEX_SHADER, header, vertex_source);
+        GLuint fragment = CompileShader(GL_FRAGMENT_SHADER, header, fragment_source);
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glBindAttribLocation(program, 0, position_name);
+        glLinkProgram(program);
+        GLint ok = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if(ok != GL_TRUE)
+        {
+            char log[1024];
+            glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+            fprintf(stderr, "Failed to link shader program: %s\n", log);
+        }
+        assert(ok == GL_TRUE);
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return program;
+    }
+    void RemoveCloud(size_t i)
+    {
+        glDeleteBuffers(1, &clouds[i].vbo);
+        clouds.erase(clouds.begin() + i);
+        if(current == int(i))
+            current = -1;
+        else if(current > int(i))
+            current--;
+    }
+    int FindCloud(PointProcessor* source)
+    {
+        for(size_t i = 0; i < clouds.size(); i++)
+        {
+            if(clouds[i].key == source)
+                return int(i);
+        }
+        return -1;
+    }
+    // Creates the buffer for source, nothing is uploaded yet
+    int AddCloud(std::shared_ptr<PointProcessor> source)
+    {
+        GpuCloud cloud;
+        cloud.key = source.get();
+        cloud.source = source;
+        cloud.n_points = source->GetNPoints();
+        cloud.n_uploaded = 0;
+        cloud.upload_time = 0.0f;
+        cloud.paged = source->IsOutOfCore();
+        cloud.slot_version = 0;
+        if(cloud.paged)
+        {
+            // as many slots as the budget allows, the pool is sized once
+            auto& nodes = source->GetOctree();
+            size_t n_leaves = std::count_if(nodes.begin(), nodes.end(), [](const OctreeNode& n) {return IsOctreeLeaf(n);});
+            size_t n_slots = std::clamp<size_t>(memory_budget / (SLOT_POINTS * sizeof(vec3<float>)), 1, n_leaves);
+            cloud.n_points = n_slots * SLOT_POINTS;
+            cloud.leaf_slots.assign(nodes.size(), NO_SLOT);
+            cloud.slot_leaves.assign(n_slots, NO_SLOT);
+            cloud.slot_counts.assign(n_slots, 0);
+            cloud.slot_last_visible.assign(n_slots, 0);
+        }
+        glGenBuffers(1, &cloud.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, cloud.vbo);
+        glBufferData(GL_ARRAY_BUFFER, cloud.n_points * sizeof(vec3<float>), nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        clouds.push_back(cloud);
+        return int(clouds.size()) - 1;
+    }
+    // Frees the buffers of processors that no longer exist, so that closing a file releases its GPU memory
+    void DropExpired()
+    {
+        for(size_t i = clouds.size(); i-- > 0;)
+        {
+            if(clouds[i].source.expired())
+                RemoveCloud(i);
+        }
+    }
+    // Evicts the least recently shown clouds until the total fits the budget
+    void EnforceBudget()
+    {
+        while(GetTotalMemoryUsage() > memory_budget)
+        {
+            int lru = -1;
+            for(size_t i = 0; i < clouds.size(); i++)
+            {
+                if(int(i) != current && (lru == -1 || clouds[i].last_used < clouds[lru].last_used))
+                    lru = int(i);
+            }
+            if(lru == -1)
+                return;
+            RemoveCloud(lru);
+        }
+    }
+    void ResizeLodBuffer(int width, int height)
+    {
+        if(lod_fbo != 0 && width == lod_width && height == lod_height)
+            return;
+        if(lod_fbo == 0)
+        {
+            glGenFramebuffers(1, &lod_fbo);
+            glGenRenderbuffers(1, &lod_color);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, lod_color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, lod_fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, lod_color);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        lod_width = width;
+        lod_height = height;
+    }
+    // Copies uploads into the buffer, they must add up to at most UPLOAD_CHUNK_SIZE
+    void Upload(GLuint vbo, const std::vector<PendingUpload>& uploads)
+    {
+        if(staging_data != nullptr)
+        {
+            GLsync& fence = staging_fences[staging_slot];
+            if(fence != nullptr)
+            {
+                // submitted UPLOAD_SLOTS frames ago, so this practically never waits
+                glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                glDeleteSync(fence);
+            }
+            size_t staging_offset = staging_slot * UPLOAD_CHUNK_SIZE;
+            glBindBuffer(GL_COPY_READ_BUFFER, staging_buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+            for(auto& it : uploads)
+            {
+                assert(staging_offset + it.size <= (staging_slot + 1) * UPLOAD_CHUNK_SIZE);
+                memcpy(staging_data + staging_offset, it.data, it.size);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, staging_offset, it.offset, it.size);
+                staging_offset += it.size;
+            }
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            staging_slot = (staging_slot + 1) % UPLOAD_SLOTS;
+        }
+        else
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            for(auto& it : uploads)
+                glBufferSubData(GL_ARRAY_BUFFER, it.offset, it.size, it.data);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        for(auto& it : uploads)
+            n_uploaded_bytes += it.size;
+    }
+    // A free slot, or the one least recently visible before this frame, NO_SLOT if all of them are in view
+    uint32_t FindSlot(GpuCloud& cloud)
+    {
+        uint32_t best = NO_SLOT;
+        for(uint32_t i = 0; i < cloud.slot_leaves.size(); i++)
+        {
+            if(cloud.slot_leaves[i] == NO_SLOT)
+                return i;
+            if(cloud.slot_last_visible[i] != paged_frame
+                && (best == NO_SLOT || cloud.slot_last_visible[i] < cloud.slot_last_visible[best]))
+                best = i;
+        }
+        return best;
+    }
+    // Finds the visible leaves of an out-of-core cloud, requests the ones not in memory and moves the ones in memory into slots
+    void UpdateSlots(GpuCloud& cloud, PagedCloud* paged, const std::vector<OctreeNode>& nodes, const Frustum& frustum,
+        const float* view, float focal, float screen_area)
+    {
+        TraceScope trace("Update slots");
+        paged_frame++;
+        paged_leaves.clear();
+        CollectLodLeaves(nodes, frustum, view, focal, screen_area, SIZE_MAX, paged_leaves);
+        std::sort(paged_leaves.begin(), paged_leaves.end(), [](const LodLeaf& l, const LodLeaf& r) {return l.area > r.area;});
+        // the ones that would not get a slot are never shown
+        paged_leaves.resize(std::min(paged_leaves.size(), cloud.slot_leaves.size()));
+        uploads.clear();
+        size_t upload_size = 0;
+        paged_ready = 0;
+        for(auto& leaf : paged_leaves)
+        {
+            uint32_t slot = cloud.leaf_slots[leaf.node];
+            if(slot != NO_SLOT)
+            {
+                cloud.slot_last_visible[slot] = paged_frame;
+                paged_ready++;
+                continue;
+            }
+            if(!paged->IsLeafResident(leaf.node))
+            {
+                paged->RequestLeaf(leaf.node);
+                continue;
+            }
+            uint32_t n = uint32_t(std::min<size_t>(nodes[leaf.node].count, SLOT_POINTS));
+            if(upload_size + n * sizeof(vec3<float>) > UPLOAD_CHUNK_SIZE)
+                continue;
+            slot = FindSlot(cloud);
+            if(slot == NO_SLOT)
+                break;
+            if(cloud.slot_leaves[slot] != NO_SLOT)
+            {
+                cloud.leaf_slots[cloud.slot_leaves[slot]] = NO_SLOT;
+                cloud.n_uploaded -= cloud.slot_counts[slot];
+            }
+            cloud.leaf_slots[leaf.node] = slot;
+            cloud.slot_leaves[slot] = leaf.node;
+            cloud.slot_counts[slot] = n;
+            cloud.slot_last_visible[slot] = paged_frame;
+            cloud.n_uploaded += n;
+            cloud.slot_version++;
+            uploads.push_back({slot * SLOT_POINTS * sizeof(vec3<float>), paged->TouchLeaf(leaf.node), n * sizeof(vec3<float>)});
+            upload_size += n * sizeof(vec3<float>);
+            paged_ready++;
+        }
+        if(!uploads.empty())
+            Upload(cloud.vbo, uploads);
+        // the uploaded pages are not needed in memory anymore
+        paged->Trim();
+    }
+    // Where the points of a leaf start in the cloud's buffer
+    size_t GetLeafFirst(GpuCloud& cloud, const OctreeNode& node, uint32_t index)
+    {
+        return cloud.paged ? cloud.leaf_slots[index] * SLOT_POINTS : node.begin;
+    }
+    void ClearPreview()
+    {
+        if(preview.vbo != 0)
+            glDeleteBuffers(1, &preview.vbo);
+        preview = {};
+        preview_pending.clear();
+        preview_pending_uploaded = 0;
+    }
+    // Moves the preview to a buffer of at least n points, keeping its contents
+    void GrowPreview(size_t n)
+    {
+        size_t capacity = std::max({n, preview.capacity * 2, UPLOAD_CHUNK_SIZE / sizeof(vec3<float>)});
+        GLuint vbo;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(vec3<float>), nullptr, GL_STATIC_DRAW);
+        if(preview.n_points > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, preview.vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, preview.n_points * sizeof(vec3<float>));
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if(preview.vbo != 0)
+            glDeleteBuffers(1, &preview.vbo);
+        preview.vbo = vbo;
+        preview.capacity = capacity;
+    }
+    void DrawRanges(GLuint vbo, const glm::mat4& view_projection)
+    {
+        glUseProgram(point_program);
+        SetCommonUniforms(point_uniforms, view_projection);
+        glBindVertexArray(point_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3<float>), nullptr);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glMultiDrawArrays(GL_POINTS, draw_firsts.data(), draw_counts.data(), GLsizei(draw_firsts.size()));
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+    // Draws the next point_budget points of the current view into the offscreen image and shows it
+    void RenderLod(GpuCloud& cloud, const std::vector<OctreeNode>& nodes, const glm::mat4& view, const glm::mat4& projection,
+        int width, int height)
+    {
+        TraceScope trace("Render level of detail");
+        LodView current_view = {};
+        current_view.view_projection = projection * view;
+        current_view.width = width;
+        current_view.height = height;
+        current_view.cloud = current;
+        current_view.n_uploaded = cloud.paged ? cloud.slot_version : cloud.n_uploaded;
+        current_view.n_sections = n_sections;
+        std::copy(boundaries, boundaries + n_sections, current_view.boundaries);
+        std::copy(colors, colors + n_sections * 3, current_view.colors);
+        ResizeLodBuffer(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, lod_fbo);
+        if(lod_restart || memcmp(&current_view, &lod_view, sizeof(LodView)) != 0)
+        {
+            lod_view = current_view;
+            lod_restart = false;
+            lod_leaves.clear();
+            // the camera's FOV enters through the projection, its distance through the view
+            float focal = projection[1][1] * float(height) * 0.5f;
+            CollectLodLeaves(nodes, ExtractFrustum(glm::value_ptr(lod_view.view_projection)), glm::value_ptr(view), focal,
+                float(width) * float(height), cloud.paged ? SIZE_MAX : cloud.n_uploaded, lod_leaves);
+            if(cloud.paged)
+            {
+                // only what is in the slots can be drawn
+                for(auto& it : lod_leaves)
+                    it.available = (cloud.leaf_slots[it.node] == NO_SLOT) ? 0 : cloud.slot_counts[cloud.leaf_slots[it.node]];
+                std::erase_if(lod_leaves, [](const LodLeaf& l) {return l.available == 0;});
+            }
+            SortLodLeaves(lod_leaves);
+            lod_available = 0;
+            for(auto& it : lod_leaves)
+                lod_available += it.available;
+            lod_shown = 0;
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        // only the points that are not in the image yet
+        std::vector<uint32_t> shown(lod_leaves.size());
+        for(size_t i = 0; i < lod_leaves.size(); i++)
+            shown[i] = lod_leaves[i].target;
+        AssignLodTargets(lod_leaves, std::min(lod_available, lod_shown + point_budget));
+        draw_firsts.clear();
+        draw_counts.clear();
+        lod_shown = 0;
+        for(size_t i = 0; i < lod_leaves.size(); i++)
+        {
+            auto& leaf = lod_leaves[i];
+            lod_shown += leaf.target;
+            if(leaf.target > shown[i])
+            {
+                draw_firsts.push_back(GLint(GetLeafFirst(cloud, nodes[leaf.node], leaf.node) + shown[i]));
+                draw_counts.push_back(GLsizei(leaf.target - shown[i]));
+                n_drawn += leaf.target - shown[i];
+            }
+        }
+        if(!draw_firsts.empty())
+            DrawRanges(cloud.vbo, lod_view.view_projection);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, lod_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    ProgramUniforms GetUniforms(GLuint program)
+    {
+        ProgramUniforms u;
+        u.view_projection = glGetUniformLocation(program, "view_projection");
+        u.n_sections = glGetUniformLocation(program, "n_sections");
+        u.boundaries = glGetUniformLocation(program, "boundaries");
+        u.colors = glGetUniformLocation(program, "colors");
+        return u;
+    }
+    void SetCommonUniforms(ProgramUniforms& u, const glm::mat4& view_projection)
+    {
+        glUniformMatrix4fv(u.view_projection, 1, GL_FALSE, glm::value_ptr(view_projection));
+        glUniform1i(u.n_sections, n_sections);
+        glUniform1fv(u.boundaries, n_sections, boundaries);
+        glUniform3fv(u.colors, n_sections, colors);
+    }
+    public:
+    // glsl_version is the "#version ..." line matching the context
+    PointRenderer(const char* glsl_version, size_t memory_budget = DEFAULT_MEMORY_BUDGET)
+    {
+        this->memory_budget = memory_budget;
+        std::string header = std::string(glsl_version) + "\n#define MAX_SECTIONS " + std::to_string(MAX_SECTIONS) + "\n";
+        // GLSL ES has no default float precision in fragment shaders
+        if(header.find(" es") != std::string::npos)
+            header += "precision highp float;\n";
+        point_program = LinkProgram(header, POINT_VERTEX_SHADER, POINT_FRAGMENT_SHADER, "position");
+        point_uniforms = GetUniforms(point_program);
+        plane_program = LinkProgram(header, PLANE_VERTEX_SHADER, PLANE_FRAGMENT_SHADER, "corner");
+        plane_uniforms = GetUniforms(plane_program);
+        plane_size_uniform = glGetUniformLocation(plane_program, "plane_size");
+        plane_opacity_uniform = glGetUniformLocation(plane_program, "opacity");
+
+        // the buffer is attached at draw time, every cloud has its own
+        glGenVertexArrays(1, &point_vao);
+        glBindVertexArray(point_vao);
+        glEnableVertexAttribArray(0);
+
+        // two triangles spanning [-1, 1]
+        const float quad[] = {-1, -1, 1, -1, 1, 1, 1, 1, -1, 1, -1, -1};
+        glGenVertexArrays(1, &plane_vao);
+        glGenBuffers(1, &plane_vbo);
+        glBindVertexArray(plane_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, plane_vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if(GLEW_ARB_buffer_storage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glGenBuffers(1, &staging_buffer);
+            glBindBuffer(GL_COPY_READ_BUFFER, staging_buffer);
+            glBufferStorage(GL_COPY_READ_BUFFER, UPLOAD_CHUNK_SIZE * UPLOAD_SLOTS, nullptr, flags);
+            staging_data = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, UPLOAD_CHUNK_SIZE * UPLOAD_SLOTS, flags);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+    }
+    ~PointRenderer()
+    {
+        for(auto& it : staging_fences)
+        {
+            if(it != nullptr)
+                glDeleteSync(it);
+        }
+        // deleting a mapped buffer unmaps it
+        if(staging_buffer != 0)
+            glDeleteBuffers(1, &staging_buffer);
+        for(auto& it : clouds)
+            glDeleteBuffers(1, &it.vbo);
+        ClearPreview();
+        if(lod_fbo != 0)
+        {
+            glDeleteFramebuffers(1, &lod_fbo);
+            glDeleteRenderbuffers(1, &lod_color);
+        }
+        glDeleteVertexArrays(1, &point_vao);
+        glDeleteVertexArrays(1, &plane_vao);
+        glDeleteBuffers(1, &plane_vbo);
+        glDeleteProgram(point_program);
+        glDeleteProgram(plane_program);
+    }
+    PointRenderer(const PointRenderer&) = delete;
+    PointRenderer& operator=(const PointRenderer&) = delete;
+    // Shows the points of source (which must be loaded), or nothing if source is null
+    // A cloud that is not resident yet is transferred by ContinueUpload, evicting others if over the budget
+    void SetCurrent(std::shared_ptr<PointProcessor> source)
+    {
+        DropExpired();
+        current = -1;
+        if(source == nullptr)
+            return;
+        current = FindCloud(source.get());
+        if(current == -1)
+            current = AddCloud(source);
+        clouds[current].last_used = ++use_counter;
+        EnforceBudget();
+    }
+    // Queues the upload of source (which must be loaded) behind the current cloud, without showing it
+    // Prefetched clouds count as just shown, the budget evicts them like any other
+    void Prefetch(std::shared_ptr<PointProcessor> source)
+    {
+        DropExpired();
+        int i = FindCloud(source.get());
+        if(i == -1)
+            i = AddCloud(source);
+        clouds[i].last_used = ++use_counter;
+        if(std::find(prefetch_queue.begin(), prefetch_queue.end(), source.get()) == prefetch_queue.end())
+            prefetch_queue.push_back(source.get());
+        EnforceBudget();
+    }
+    // Seconds from the first chunk of source to the last, 0 until it is uploaded and for out-of-core clouds
+    float GetUploadTime(PointProcessor* source)
+    {
+        int i = FindCloud(source);
+        return (i != -1) ? clouds[i].upload_time : 0.0f;
+    }
+    // Whether source's points are all on the GPU, out-of-core clouds count as soon as they have a buffer
+    bool IsUploaded(PointProcessor* source)
+    {
+        int i = FindCloud(source);
+        return i != -1 && (clouds[i].paged || clouds[i].n_uploaded == clouds[i].n_points);
+    }
+    // Copies the next chunk of the current cloud, or of the next prefetched one once it is complete, call once per frame
+    // Out-of-core clouds are uploaded by Render() instead, what they need depends on the view
+    void ContinueUpload()
+    {
+        TraceScope trace("Upload");
+        DropExpired();
+        EnforceBudget();
+        int target = -1;
+        if(current != -1 && !clouds[current].paged && IsUploading())
+            target = current;
+        while(target == -1 && !prefetch_queue.empty())
+        {
+            int i = FindCloud(prefetch_queue.front());
+            if(i != -1 && !clouds[i].paged && clouds[i].n_uploaded != clouds[i].n_points)
+                target = i;
+            else
+                prefetch_queue.erase(prefetch_queue.begin());
+        }
+        if(target == -1)
+            return;
+        GpuCloud& cloud = clouds[target];
+        auto source = cloud.source.lock();
+        if(cloud.n_uploaded == 0)
+            cloud.upload_start = std::chrono::steady_clock::now();
+        size_t n = std::min(UPLOAD_CHUNK_SIZE / sizeof(vec3<float>), cloud.n_points - cloud.n_uploaded);
+        uploads.clear();
+        uploads.push_back({cloud.n_uploaded * sizeof(vec3<float>), source->GetPoints() + cloud.n_uploaded, n * sizeof(vec3<float>)});
+        Upload(cloud.vbo, uploads);
+        cloud.n_uploaded += n;
+        if(cloud.n_uploaded == cloud.n_points)
+            cloud.upload_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - cloud.upload_start).count();
+    }
+    // Shows the preview of source, which should still be loading, until source is shown with SetCurrent() and uploaded
+    // nullptr drops the preview
+    void SetPreview(std::shared_ptr<PointProcessor> source)
+    {
+        if(source.get() == preview.key && !preview.source.expired())
+            return;
+        ClearPreview();
+        if(source == nullptr)
+            return;
+        preview.key = source.get();
+        preview.source = source;
+    }
+    bool HasPreview()
+    {
+        return preview.key != nullptr;
+    }
+    // Fetches the chunks published since the last call and copies up to UPLOAD_CHUNK_SIZE of them, call once per frame
+    void ContinuePreview()
+    {
+        TraceScope trace("Upload preview");
+        auto source = preview.source.lock();
+        if(source == nullptr)
+        {
+            if(preview.key != nullptr)
+                ClearPreview();
+            return;
+        }
+        // the count drops to 0 once the load completes, which leaves the fetched chunks to finish
+        preview.n_chunks = std::max(preview.n_chunks, source->GetPreviewChunks(preview.n_chunks, preview_pending));
+        uploads.clear();
+        size_t upload_points = 0;
+        size_t n_done = 0;
+        size_t offset = preview_pending_uploaded;
+        constexpr size_t MAX_POINTS = UPLOAD_CHUNK_SIZE / sizeof(vec3<float>);
+        for(; n_done < preview_pending.size() && upload_points < MAX_POINTS; n_done++)
+        {
+            auto& chunk = *preview_pending[n_done];
+            size_t n = std::min(chunk.size() - offset, MAX_POINTS - upload_points);
+            uploads.push_back({(preview.n_points + upload_points) * sizeof(vec3<float>), chunk.data() + offset, n * sizeof(vec3<float>)});
+            upload_points += n;
+            if(offset + n != chunk.size())
+            {
+                offset += n;
+                break;
+            }
+            offset = 0;
+        }
+        if(upload_points == 0)
+            return;
+        if(preview.n_points + upload_points > preview.capacity)
+            GrowPreview(preview.n_points + upload_points);
+        Upload(preview.vbo, uploads);
+        preview.n_points += upload_points;
+        preview_pending.erase(preview_pending.begin(), preview_pending.begin() + n_done);
+        preview_pending_uploaded = offset;
+    }
+    // For out-of-core clouds whether leaves in view are still missing
+    bool IsUploading()
+    {
+        if(current != -1 && clouds[current].paged)
+            return paged_ready != paged_leaves.size();
+        return current != -1 && clouds[current].n_uploaded != clouds[current].n_points;
+    }
+    float GetUploadProgress()
+    {
+        if(current != -1 && clouds[current].paged)
+            return paged_leaves.empty() ? 1.0f : float(paged_ready) / float(paged_leaves.size());
+        if(current == -1 || clouds[current].n_points == 0)
+            return 1.0f;
+        return float(clouds[current].n_uploaded) / float(clouds[current].n_points);
+    }
+    // Points submitted by the last Render(), in level of detail mode only the ones added to the image
+    size_t GetDrawnPoints()
+    {
+        return n_drawn;
+    }
+    // Bytes copied to the GPU since the renderer was created, by uploads, out-of-core slots and previews
+    size_t GetUploadedBytes()
+    {
+        return n_uploaded_bytes;
+    }
+    // GPU memory held for the points of source, 0 if they are not resident
+    size_t GetMemoryUsage(PointProcessor* source)
+    {
+        for(auto& it : clouds)
+        {
+            if(it.key == source)
+                return it.n_points * sizeof(vec3<float>);
+        }
+        return 0;
+    }
+    size_t GetTotalMemoryUsage()
+    {
+        size_t total = preview.capacity * sizeof(vec3<float>);
+        for(auto& it : clouds)
+            total += it.n_points * sizeof(vec3<float>);
+        return total;
+    }
+    size_t GetMemoryBudget()
+    {
+        return memory_budget;
+    }
+    // The current cloud is always kept, even if it alone exceeds the budget
+    void SetMemoryBudget(size_t bytes)
+    {
+        memory_budget = bytes;
+        EnforceBudget();
+    }
+    // sections holds the section lengths as passed to PointProcessor::SetSections, one color per section
+    void SetSections(const std::vector<float>& sections, const std::vector<vec3<float>>& section_colors)
+    {
+        assert(sections.size() == section_colors.size());
+        n_sections = std::min(int(sections.size()), MAX_SECTIONS);
+        // accumulated exactly like PointProcessor does, so colors always agree with the section counts
+        float pos = 0.0f;
+        for(int i = 0; i < n_sections; i++)
+        {
+            pos += sections[i];
+            boundaries[i] = pos;
+            colors[i * 3 + 0] = section_colors[i].x;
+            colors[i * 3 + 1] = section_colors[i].y;
+            colors[i * 3 + 2] = section_colors[i].z;
+        }
+    }
+    // width and height are the size of the viewport in pixels
+    void Render(const glm::mat4& view, const glm::mat4& projection, int width, int height)
+    {
+        TraceScope trace("Render points");
+        n_drawn = 0;
+        if(n_sections == 0)
+            return;
+        glm::mat4 view_projection = projection * view;
+        if(current != -1 && clouds[current].paged)
+        {
+            float focal = projection[1][1] * float(height) * 0.5f;
+            auto source = clouds[current].source.lock();
+            UpdateSlots(clouds[current], source->GetPagedCloud(), source->GetOctree(), ExtractFrustum(glm::value_ptr(view_projection)),
+                glm::value_ptr(view), focal, float(std::max(width, 1)) * float(std::max(height, 1)));
+        }
+        if(preview.key != nullptr)
+        {
+            // the preview stays until its file is shown and on the GPU
+            if(current != -1 && clouds[current].key == preview.key && !IsUploading())
+                ClearPreview();
+            else
+            {
+                draw_firsts.assign(1, 0);
+                draw_counts.assign(1, GLsizei(preview.n_points));
+                n_drawn = preview.n_points;
+                if(preview.n_points > 0)
+                    DrawRanges(preview.vbo, view_projection);
+                return;
+            }
+        }
+        if(current == -1 || clouds[current].n_uploaded == 0)
+            return;
+        GpuCloud& cloud = clouds[current];
+        auto source = cloud.source.lock();
+        if(lod_enabled && width > 0 && height > 0)
+        {
+            RenderLod(cloud, source->GetOctree(), view, projection, width, height);
+            return;
+        }
+        // only the octree nodes intersecting the view are submitted
+        draw_firsts.clear();
+        draw_counts.clear();
+        if(cloud.paged)
+        {
+            for(auto& it : paged_leaves)
+            {
+                uint32_t slot = cloud.leaf_slots[it.node];
+                if(slot != NO_SLOT)
+                {
+                    draw_firsts.push_back(GLint(slot * SLOT_POINTS));
+                    draw_counts.push_back(GLsizei(cloud.slot_counts[slot]));
+                }
+            }
+        }
+        else
+            CullOctree(source->GetOctree(), ExtractFrustum(glm::value_ptr(view_projection)), cloud.n_uploaded,
+                draw_firsts, draw_counts);
+        for(auto it : draw_counts)
+            n_drawn += it;
+        if(!draw_firsts.empty())
+            DrawRanges(cloud.vbo, view_projection);
+    }
+    bool IsLodEnabled()
+    {
+        return lod_enabled;
+    }
+    void SetLodEnabled(bool enabled)
+    {
+        lod_enabled = enabled;
+        // the accumulated image is stale by the time the mode is switched back on
+        lod_restart = true;
+    }
+    size_t GetPointBudget()
+    {
+        return point_budget;
+    }
+    void SetPointBudget(size_t points)
+    {
+        point_budget = std::max<size_t>(points, 1);
+    }
+    // Points of the current view in the level of detail image so far, and the ones that could be
+    size_t GetLodShownPoints()
+    {
+        return lod_shown;
+    }
+    size_t GetLodVisiblePoints()
+    {
+        return lod_available;
+    }
+    // Draws a square of half size plane_size at every section boundary
+    void RenderSeparators(const glm::mat4& view_projection, float plane_size, float opacity)
+    {
+        if(n_sections == 0)
+            return;
+        glUseProgram(plane_program);
+        SetCommonUniforms(plane_uniforms, view_projection);
+        glUniform1f(plane_size_uniform, plane_size);
+        glUniform1f(plane_opacity_uniform, opacity);
+        glBindVertexArray(plane_vao);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, n_sections);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+};
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "hmain.hpp"
+
+// Stages a frame of a sequence goes through before it can be shown
+enum class SequenceStage
+{
+    // reading the file into the page cache
+    IO,
+    // the PointProcessor load: parsing, statistics, octree, sort
+    Parse,
+    // copying the points to the GPU
+    Upload,
+};
+constexpr int SEQUENCE_STAGE_COUNT = 3;
+
+inline const char* GetSequenceStageName(SequenceStage stage)
+{
+    switch(stage)
+    {
+        case SequenceStage::IO:
+            return "I/O";
+        case SequenceStage::Parse:
+            return "parse";
+        case SequenceStage::Upload:
+            return "upload";
+    }
+    return "";
+}
+
+// Orders digit runs by their value, so frame_2 comes before frame_10
+inline bool NaturalLess(const std::string& l, const std::string& r)
+{
+    size_t i = 0;
+    size_t j = 0;
+    while(i < l.size() && j < r.size())
+    {
+        if(isdigit((unsigned char)l[i]) && isdigit((unsigned char)r[j]))
+        {
+            size_t i_end = i;
+            size_t j_end = j;
+            while(i_end < l.size() && isdigit((unsigned char)l[i_end]))
+                i_end++;
+            while(j_end < r.size() && isdigit((unsigned char)r[j_end]))
+                j_end++;
+            // without leading zeros a longer run is a larger number
+            size_t i_start = i;
+            size_t j_start = j;
+            while(i_start + 1 < i_end && l[i_start] == '0')
+                i_start++;
+            while(j_start + 1 < j_end && r[j_start] == '0')
+                j_start++;
+            if(i_end - i_start != j_end - j_start)
+                return i_end - i_start < j_end - j_start;
+            int c = l.compare(i_start, i_end - i_start, r, j_start, j_end - j_start);
+            if(c != 0)
+                return c < 0;
+            i = i_end;
+            j = j_end;
+            continue;
+        }
+        if(l[i] != r[j])
+            return l[i] < r[j];
+        i++;
+        j++;
+    }
+    return l.size() - i < r.size() - j;
+}
+
+// Matches name against a pattern with * (any run) and ? (any character)
+inline bool MatchesGlob(const char* name, const char* pattern)
+{
+    // the last * seen and where in name it has been resumed from
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while(*name != '\0')
+    {
+        if(*pattern == '*')
+        {
+            star = pattern++;
+            resume = name;
+        }
+        else if(*pattern == '?' || *pattern == *name)
+        {
+            pattern++;
+            name++;
+        }
+        else if(star != nullptr)
+        {
+            pattern = star + 1;
+            name = ++resume;
+        }
+        else
+            return false;
+    }
+    while(*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+// The frames of a sequence: the files of a directory, or the matches of a glob in the last path component (data_*.txt),
+// in natural order; the caches next to the files are left out
+inline std::vector<std::string> FindSequenceFiles(const std::string& pattern)
+{
+    std::vector<std::string> out;
+    std::filesystem::path path(pattern);
+    std::filesystem::path directory = path;
+    std::string name_pattern = "*";
+    if(!std::filesystem::is_directory(path))
+    {
+        directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        name_pattern = path.filename().string();
+    }
+    std::error_code ec;
+    for(auto& entry : std::filesystem::directory_iterator(directory, ec))
+    {
+        std::string name = entry.path().filename().string();
+        std::string extension = entry.path().extension().string();
+        if(entry.is_regular_file() && extension != ".ptcache" && extension != PAGED_CLOUD_EXTENSION
+            && MatchesGlob(name.c_str(), name_pattern.c_str()))
+            out.push_back(entry.path().string());
+    }
+    std::sort(out.begin(), out.end(), NaturalLess);
+    return out;
+}
+
+// Plays a sequence of files as the frames of an animation
+// Frames ahead of the shown one go through a pipeline, at most prefetch_depth of them at once:
+// a job reads the file into the page cache (I/O), a PointProcessor loads it (parse) and PointRenderer::Prefetch uploads it
+// Every stage is timed per frame, the stage with the highest average is what bounds the sustained frame rate
+// Only the frames in the pipeline are kept, so a sequence of any length takes the memory of prefetch_depth + 1 frames
+class PointSequence
+{
+    protected:
+    constexpr static const float DEFAULT_FPS = 10.0f;
+    constexpr static const int DEFAULT_PREFETCH_DEPTH = 4;
+    // stage times are averaged over this many frames
+    constexpr static const int STAGE_HISTORY = 16;
+    // the sustained frame rate is measured over this many seconds
+    constexpr static const float FPS_WINDOW = 2.0f;
+
+    enum class FrameState
+    {
+        Idle,
+        Reading,
+        Loading,
+        Uploading,
+        Ready,
+        Failed,
+    };
+    struct Frame
+    {
+        std::string path;
+        FrameState state = FrameState::Idle;
+        JobCounter io_job;
+        // written by the I/O job
+        float io_time = 0.0f;
+        std::shared_ptr<PointProcessor> points;
+        std::vector<float> applied_sections;
+    };
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::unique_ptr<Frame>> frames;
+    // index of the frame being shown, or to be shown first
+    size_t shown = 0;
+    bool has_shown = false;
+    bool playing = true;
+    bool loop = true;
+    float fps = DEFAULT_FPS;
+    int prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    Clock::time_point next_frame_time;
+    // whether the frame due at next_frame_time has been counted as a stall
+    bool stalled = false;
+    size_t n_stalls = 0;
+    std::deque<Clock::time_point> shown_times;
+    float stage_times[SEQUENCE_STAGE_COUNT][STAGE_HISTORY] = {};
+    int stage_counts[SEQUENCE_STAGE_COUNT] = {};
+
+    void AddStageTime(SequenceStage stage, float seconds)
+    {
+        int s = int(stage);
+        stage_times[s][stage_counts[s] % STAGE_HISTORY] = seconds;
+        stage_counts[s]++;
+    }
+    // The k-th frame after the shown one, SIZE_MAX past the end of a sequence that does not loop
+    size_t GetAhead(size_t k)
+    {
+        if(!loop && shown + k >= frames.size())
+            return SIZE_MAX;
+        return (shown + k) % frames.size();
+    }
+    bool IsInPipeline(size_t index)
+    {
+        for(int k = 0; k <= prefetch_depth && k < int(frames.size()); k++)
+        {
+            if(GetAhead(k) == index)
+                return true;
+        }
+        return false;
+    }
+    void StartRead(Frame& frame)
+    {
+        frame.state = FrameState::Reading;
+        // a processor reads the cache instead of the text if there is one
+        std::string path = std::filesystem::exists(GetPointCachePath(frame.path)) ? GetPointCachePath(frame.path) : frame.path;
+        JobSystem::Get().Submit(JobPriority::Low, &frame.io_job, [&frame, path]()
+        {
+            TraceScope trace("Read ahead");
+            auto start = Clock::now();
+            MappedFile file;
+            if(file.Open(path))
+            {
+                file.Advise(0, file.GetSize(), MappedFileAdvice::WillNeed);
+                volatile char sink = 0;
+                for(size_t i = 0; i < file.GetSize(); i += 4096)
+                    sink = sink + file.GetData()[i];
+            }
+            frame.io_time = std::chrono::duration<float>(Clock::now() - start).count();
+        });
+    }
+    // Moves a frame in the pipeline on as far as it can go this frame
+    void Advance(Frame& frame, bool is_shown, PointRenderer& renderer, std::vector<float>& sections)
+    {
+        if(frame.state == FrameState::Idle)
+            StartRead(frame);
+        if(frame.state == FrameState::Reading && frame.io_job.IsDone())
+        {
+            AddStageTime(SequenceStage::IO, frame.io_time);
+            frame.points = std::make_shared<PointProcessor>(frame.path);
+            frame.state = FrameState::Loading;
+        }
+        if(frame.state == FrameState::Loading)
+        {
+            frame.points->Lock();
+            bool failed = frame.points->HasFailedToLoad();
+            bool loaded = frame.points->IsLoaded();
+            frame.points->Unlock();
+            if(failed)
+            {
+                frame.state = FrameState::Failed;
+                frame.points = nullptr;
+                return;
+            }
+            if(!loaded)
+                return;
+            AddStageTime(SequenceStage::Parse, frame.points->GetLoadTime());
+            // frames ahead wait for GPU memory rather than evict the ones before them
+            size_t size = frame.points->GetNPoints() * sizeof(vec3<float>);
+            if(!is_shown && renderer.GetTotalMemoryUsage() + size > renderer.GetMemoryBudget())
+                return;
+            renderer.Prefetch(frame.points);
+            frame.state = FrameState::Uploading;
+        }
+        if(frame.state == FrameState::Uploading && renderer.IsUploaded(frame.points.get()))
+        {
+            AddStageTime(SequenceStage::Upload, renderer.GetUploadTime(frame.points.get()));
+            frame.state = FrameState::Ready;
+        }
+        if(frame.points != nullptr && frame.applied_sections != sections && (frame.state == FrameState::Uploading
+            || frame.state == FrameState::Ready))
+        {
+            frame.points->Lock();
+            frame.points->SetSections(sections);
+            frame.points->Unlock();
+            frame.applied_sections = sections;
+        }
+    }
+    // Releases a frame that left the pipeline, a load in flight is left to finish first
+    void Release(Frame& frame)
+    {
+        if(frame.state == FrameState::Reading && !frame.io_job.IsDone())
+            return;
+        if(frame.state == FrameState::Loading)
+        {
+            frame.points->Lock();
+            bool done = frame.points->IsLoaded() || frame.points->HasFailedToLoad();
+            frame.points->Unlock();
+            if(!done)
+                return;
+        }
+        if(frame.state != FrameState::Failed)
+            frame.state = FrameState::Idle;
+        frame.points = nullptr;
+        frame.applied_sections.clear();
+    }
+    public:
+    PointSequence(const std::vector<std::string>& paths)
+    {
+        assert(paths.size() > 0);
+        for(auto& it : paths)
+        {
+            frames.push_back(std::make_unique<Frame>());
+            frames.back()->path = it;
+        }
+    }
+    PointSequence(const PointSequence&) = delete;
+    PointSequence& operator=(const PointSequence&) = delete;
+    ~PointSequence()
+    {
+        // the I/O jobs refer to their frames
+        for(auto& it : frames)
+            JobSystem::Get().Wait(it->io_job, JobPriority::Low);
+    }
+    // Runs the pipeline and the playback clock, call once per frame
+    // Returns the processor to show if the shown frame changed, nullptr otherwise
+    std::shared_ptr<PointProcessor> Update(PointRenderer& renderer, std::vector<float>& sections)
+    {
+        for(int k = 0; k <= prefetch_depth && k < int(frames.size()); k++)
+        {
+            size_t index = GetAhead(k);
+            if(index != SIZE_MAX)
+                Advance(*frames[index], k == 0, renderer, sections);
+        }
+        for(size_t i = 0; i < frames.size(); i++)
+        {
+            if(frames[i]->state != FrameState::Idle && !IsInPipeline(i))
+                Release(*frames[i]);
+        }
+        auto now = Clock::now();
+        while(!shown_times.empty() && std::chrono::duration<float>(now - shown_times.front()).count() > FPS_WINDOW)
+            shown_times.pop_front();
+        if(!has_shown)
+        {
+            // failed frames are skipped
+            if(frames[shown]->state == FrameState::Failed && GetAhead(1) != SIZE_MAX && !IsAllFailed())
+                shown = GetAhead(1);
+            if(frames[shown]->state != FrameState::Ready)
+                return nullptr;
+            has_shown = true;
+            next_frame_time = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / fps));
+            shown_times.push_back(now);
+            return frames[shown]->points;
+        }
+        if(!playing || now < next_frame_time)
+            return nullptr;
+        size_t next = GetAhead(1);
+        while(next != SIZE_MAX && next != shown && frames[next]->state == FrameState::Failed)
+            next = (loop || next + 1 < frames.size()) ? (next + 1) % frames.size() : SIZE_MAX;
+        if(next == SIZE_MAX || next == shown)
+        {
+            playing = false;
+            return nullptr;
+        }
+        if(frames[next]->state != FrameState::Ready)
+        {
+            if(!stalled)
+                n_stalls++;
+            stalled = true;
+            return nullptr;
+        }
+        stalled = false;
+        shown = next;
+        auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / fps));
+        // after a stall the clock restarts rather than rushing through the frames it missed
+        next_frame_time = std::max(next_frame_time + interval, now);
+        shown_times.push_back(now);
+        return frames[shown]->points;
+    }
+    bool IsAllFailed()
+    {
+        for(auto& it : frames)
+        {
+            if(it->state != FrameState::Failed)
+                return false;
+        }
+        return true;
+    }
+    bool IsPlaying()
+    {
+        return playing;
+    }
+    void SetPlaying(bool playing)
+    {
+        this->playing = playing;
+        next_frame_time = Clock::now();
+    }
+    bool IsLooping()
+    {
+        return loop;
+    }
+    void SetLooping(bool loop)
+    {
+        this->loop = loop;
+    }
+    float GetTargetFps()
+    {
+        return fps;
+    }
+    void SetTargetFps(float fps)
+    {
+        this->fps = std::max(fps, 0.1f);
+    }
+    int GetPrefetchDepth()
+    {
+        return prefetch_depth;
+    }
+    void SetPrefetchDepth(int depth)
+    {
+        prefetch_depth = std::max(depth, 0);
+    }
+    // Shows frame index as soon as it is ready, the pipeline restarts from there
+    void Seek(size_t index)
+    {
+        assert(index < frames.size());
+        shown = index;
+        has_shown = false;
+        stalled = false;
+    }
+    size_t GetFrame()
+    {
+        return shown;
+    }
+    size_t GetFrameCount()
+    {
+        return frames.size();
+    }
+    std::string GetFramePath(size_t index)
+    {
+        return frames[index]->path;
+    }
+    // Frames shown per second over the last FPS_WINDOW seconds
+    float GetSustainedFps()
+    {
+        if(shown_times.size() < 2)
+            return 0.0f;
+        float span = std::chrono::duration<float>(shown_times.back() - shown_times.front()).count();
+        return (span > 0.0f) ? float(shown_times.size() - 1) / span : 0.0f;
+    }
+    // Frames that were due but not ready yet
+    size_t GetStallCount()
+    {
+        return n_stalls;
+    }
+    // Average seconds a frame spent in stage over the last STAGE_HISTORY frames, 0 before any frame went through it
+    float GetStageTime(SequenceStage stage)
+    {
+        int s = int(stage);
+        int n = std::min(stage_counts[s], STAGE_HISTORY);
+        if(n == 0)
+            return 0.0f;
+        float sum = 0.0f;
+        for(int i = 0; i < n; i++)
+            sum += stage_times[s][i];
+        return sum / float(n);
+    }
+    // The slowest stage on average; the stages of different frames overlap, so the slowest one limits the frame rate
+    SequenceStage GetBottleneck()
+    {
+        SequenceStage slowest = SequenceStage::IO;
+        for(int i = 1; i < SEQUENCE_STAGE_COUNT; i++)
+        {
+            if(GetStageTime(SequenceStage(i)) > GetStageTime(slowest))
+                slowest = SequenceStage(i);
+        }
+        return slowest;
+    }
+};
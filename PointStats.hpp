@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "Trace.hpp"
+#include "Parallel.hpp"
+
+// Summary statistics of a set of points
+struct PointStats
+{
+    size_t n_points = 0;
+    // average of all points
+    vec3<float> center_average = {0.0f, 0.0f, 0.0f};
+    // center of the bounding box of the points
+    vec3<float> center_bounding = {0.0f, 0.0f, 0.0f};
+    vec3<float> bounding_box_low = {0.0f, 0.0f, 0.0f};
+    vec3<float> bounding_box_high = {0.0f, 0.0f, 0.0f};
+    float furthest_point_zero_distance = 0.0f;
+    // measured from center_average
+    float furthest_point_center_distance = 0.0f;
+};
+
+// Per block partial results of the first sweep
+struct PointStatsPartial
+{
+    float low[3];
+    float high[3];
+    double sum[3];
+    float max_length_squared;
+};
+
+// Neumaier's variant of Kahan summation, used to combine the per block sums
+struct CompensatedSum
+{
+    double sum = 0.0;
+    double compensation = 0.0;
+    void Add(double v)
+    {
+        double t = sum + v;
+        if(std::fabs(sum) >= std::fabs(v))
+            compensation += (sum - t) + v;
+        else
+            compensation += (v - t) + sum;
+        sum = t;
+    }
+    double Get()
+    {
+        return sum + compensation;
+    }
+};
+
+constexpr size_t POINT_STATS_BLOCK_SIZE = 1 << 16;
+
+// First sweep over points [begin, end), get(i) returns the i-th point
+template<typename GetPoint>
+PointStatsPartial ComputePointStatsPartial(GetPoint get, size_t begin, size_t end)
+{
+    vec3<float> first = get(begin);
+    float low_x = first.x, low_y = first.y, low_z = first.z;
+    float high_x = first.x, high_y = first.y, high_z = first.z;
+    // a block's worth of floats sums up in double without any noticeable error
+    double sum_x = 0.0, sum_y = 0.0, sum_z = 0.0;
+    float max_length_squared = 0.0f;
+    for(size_t i = begin; i < end; i++)
+    {
+        vec3<float> p = get(i);
+        low_x = std::min(low_x, p.x);
+        low_y = std::min(low_y, p.y);
+        low_z = std::min(low_z, p.z);
+        high_x = std::max(high_x, p.x);
+        high_y = std::max(high_y, p.y);
+        high_z = std::max(high_z, p.z);
+        sum_x += p.x;
+        sum_y += p.y;
+        sum_z += p.z;
+        max_length_squared = std::max(max_length_squared, p.x*p.x + p.y*p.y + p.z*p.z);
+    }
+    return {{low_x, low_y, low_z}, {high_x, high_y, high_z}, {sum_x, sum_y, sum_z}, max_length_squared};
+}
+
+// Combines the partials of the first sweep, one per POINT_STATS_BLOCK_SIZE points, and runs the second sweep
+// Loaders that produce the points block by block can compute the partials while the points are still in cache,
+// which leaves only this (mostly skipped) sweep, see ComputePointStats()
+template<typename GetPoint, typename ProgressFn>
+PointStats FinishPointStats(size_t n, GetPoint get, const std::vector<PointStatsPartial>& partials, ProgressFn progress)
+{
+    PointStats stats;
+    stats.n_points = n;
+    if(n == 0)
+        return stats;
+    size_t n_blocks = partials.size();
+    assert(n_blocks == (n + POINT_STATS_BLOCK_SIZE - 1) / POINT_STATS_BLOCK_SIZE);
+    CompensatedSum sums[3];
+    float low[3], high[3];
+    float max_length_squared = 0.0f;
+    memcpy(low, partials[0].low, sizeof(low));
+    memcpy(high, partials[0].high, sizeof(high));
+    for(auto& it : partials)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            low[i] = std::min(low[i], it.low[i]);
+            high[i] = std::max(high[i], it.high[i]);
+            sums[i].Add(it.sum[i]);
+        }
+        max_length_squared = std::max(max_length_squared, it.max_length_squared);
+    }
+    stats.bounding_box_low = {low[0], low[1], low[2]};
+    stats.bounding_box_high = {high[0], high[1], high[2]};
+    stats.center_bounding = (stats.bounding_box_low + stats.bounding_box_high) / 2.0f;
+    stats.center_average = {float(sums[0].Get()/double(n)), float(sums[1].Get()/double(n)), float(sums[2].Get()/double(n))};
+    stats.furthest_point_zero_distance = std::sqrt(max_length_squared);
+
+    // upper bound of the squared distance from the center to any point of each block, via its bounding box
+    vec3<float> c = stats.center_average;
+    std::vector<float> bounds(n_blocks);
+    std::vector<size_t> order(n_blocks);
+    for(size_t b = 0; b < n_blocks; b++)
+    {
+        float d[3];
+        for(int i = 0; i < 3; i++)
+            d[i] = std::max(std::fabs(partials[b].low[i] - c.data[i]), std::fabs(partials[b].high[i] - c.data[i]));
+        bounds[b] = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+        order[b] = b;
+    }
+    // most promising blocks first, so that the rest can be skipped early
+    std::sort(order.begin(), order.end(), [&](size_t l, size_t r) {return bounds[l] > bounds[r];});
+    // non-negative floats order the same as their bit patterns
+    std::atomic<uint32_t> best_bits = 0;
+    std::atomic<size_t> blocks_done = 0;
+    uint64_t sweep_start = Trace::Get().Now();
+    ParallelFor(n_blocks, [&](size_t i)
+    {
+        size_t b = order[i];
+        float best;
+        uint32_t bits = best_bits;
+        memcpy(&best, &bits, sizeof(best));
+        if(bounds[b] > best)
+        {
+            size_t begin = b * POINT_STATS_BLOCK_SIZE;
+            size_t end = std::min(n, begin + POINT_STATS_BLOCK_SIZE);
+            float block_best = 0.0f;
+            for(size_t ii = begin; ii < end; ii++)
+            {
+                vec3<float> p = get(ii);
+                float dx = p.x - c.x, dy = p.y - c.y, dz = p.z - c.z;
+                block_best = std::max(block_best, dx*dx + dy*dy + dz*dz);
+            }
+            uint32_t block_bits;
+            memcpy(&block_bits, &block_best, sizeof(block_bits));
+            uint32_t current = best_bits;
+            while(block_bits > current && !best_bits.compare_exchange_weak(current, block_bits));
+        }
+        progress(1, float(++blocks_done)/float(n_blocks));
+    });
+    float furthest_squared;
+    uint32_t bits = best_bits;
+    memcpy(&furthest_squared, &bits, sizeof(furthest_squared));
+    stats.furthest_point_center_distance = std::sqrt(furthest_squared);
+    Trace::Get().Record("Statistics sweep 2", sweep_start, Trace::Get().Now());
+    return stats;
+}
+
+// Computes PointStats over n points, get(i) returns the i-th point
+// First sweep: per block min/max/sum/max length in parallel, combined with compensated summation for the mean
+// Second sweep: distance from the mean, which cannot be known before the first sweep is done;
+// blocks whose bounding box cannot hold a point further away than the best one found so far are skipped,
+// which removes most of the sweep when the points are spatially ordered
+// progress(sweep, fraction) may be called from any thread
+template<typename GetPoint, typename ProgressFn>
+PointStats ComputePointStats(size_t n, GetPoint get, ProgressFn progress)
+{
+    if(n == 0)
+        return FinishPointStats(n, get, {}, progress);
+    size_t n_blocks = (n + POINT_STATS_BLOCK_SIZE - 1) / POINT_STATS_BLOCK_SIZE;
+    std::vector<PointStatsPartial> partials(n_blocks);
+    std::atomic<size_t> blocks_done = 0;
+    uint64_t sweep_start = Trace::Get().Now();
+    ParallelFor(n_blocks, [&](size_t b)
+    {
+        size_t begin = b * POINT_STATS_BLOCK_SIZE;
+        partials[b] = ComputePointStatsPartial(get, begin, std::min(n, begin + POINT_STATS_BLOCK_SIZE));
+        progress(0, float(++blocks_done)/float(n_blocks));
+    });
+    Trace::Get().Record("Statistics sweep 1", sweep_start, Trace::Get().Now());
+    return FinishPointStats(n, get, partials, progress);
+}
+
+template<typename ProgressFn>
+PointStats ComputePointStats(const vec3<float>* points, size_t n, ProgressFn progress)
+{
+    return ComputePointStats(n, [points](size_t i) {return points[i];}, progress);
+}
+
+inline PointStats ComputePointStats(const vec3<float>* points, size_t n)
+{
+    return ComputePointStats(points, n, [](int, float) {});
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Trace.hpp"
+#include "Parallel.hpp"
+
+// Maps a float to an unsigned integer with the same ordering (NaNs aside)
+// Positive floats get the sign bit set, negative ones are inverted so that larger magnitudes sort first
+inline uint32_t FloatSortKey(float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// Stable parallel LSD radix sort of records by a 32 bit key, RADIX_BITS per pass
+// The input is split into one block per worker, every pass histograms the blocks in parallel,
+// turns the histograms into per block output offsets and scatters the blocks in parallel
+// Passes in which all keys share the same digit are skipped
+// key(const T&) -> uint32_t, progress(float) is called from the calling thread after every pass
+template<typename T, typename KeyFn, typename ProgressFn>
+void RadixSort(std::vector<T>& data, KeyFn key, ProgressFn progress)
+{
+    constexpr int RADIX_BITS = 8;
+    constexpr int RADIX_SIZE = 1 << RADIX_BITS;
+    constexpr int PASSES = 32 / RADIX_BITS;
+    TraceScope trace("Radix sort");
+
+    size_t n = data.size();
+    if(n < 2)
+    {
+        progress(1.0f);
+        return;
+    }
+    size_t n_blocks = std::min(GetWorkerCount(), (n + RADIX_SIZE - 1) / RADIX_SIZE);
+    size_t block_size = (n + n_blocks - 1) / n_blocks;
+    n_blocks = (n + block_size - 1) / block_size;
+    std::vector<T> scratch(n);
+    T* src = data.data();
+    T* dst = scratch.data();
+    // counts, then output offsets, per block and digit
+    std::vector<size_t> offsets(n_blocks * RADIX_SIZE);
+    for(int pass = 0; pass < PASSES; pass++)
+    {
+        int shift = pass * RADIX_BITS;
+        ParallelFor(n_blocks, [&](size_t b)
+        {
+            size_t* counts = &offsets[b * RADIX_SIZE];
+            std::fill(counts, counts + RADIX_SIZE, 0);
+            size_t end = std::min(n, (b + 1) * block_size);
+            for(size_t i = b * block_size; i < end; i++)
+                counts[(key(src[i]) >> shift) & (RADIX_SIZE - 1)]++;
+        });
+        // exclusive prefix sum over (digit, block), so equal digits keep their block order
+        size_t total = 0;
+        bool trivial = false;
+        for(int d = 0; d < RADIX_SIZE; d++)
+        {
+            size_t digit_total = 0;
+            for(size_t b = 0; b < n_blocks; b++)
+            {
+                size_t count = offsets[b * RADIX_SIZE + d];
+                offsets[b * RADIX_SIZE + d] = total + digit_total;
+                digit_total += count;
+            }
+            if(digit_total == n)
+                trivial = true;
+            total += digit_total;
+        }
+        if(!trivial)
+        {
+            ParallelFor(n_blocks, [&](size_t b)
+            {
+                size_t* out = &offsets[b * RADIX_SIZE];
+                size_t end = std::min(n, (b + 1) * block_size);
+                for(size_t i = b * block_size; i < end; i++)
+                    dst[out[(key(src[i]) >> shift) & (RADIX_SIZE - 1)]++] = src[i];
+            });
+            std::swap(src, dst);
+        }
+        progress(float(pass + 1) / float(PASSES));
+    }
+    // after an odd number of scatters the result sits in the scratch buffer
+    if(src != data.data())
+        data.swap(scratch);
+}
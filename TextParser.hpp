@@ -0,0 +1,289 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <charconv>
+#include <vector>
+
+// Parser for whitespace separated "x y z" text, one point per line
+// Works on raw memory and never touches stdio or the locale, so independent chunks
+// of a memory-mapped file can be parsed concurrently
+
+enum class TextParseError
+{
+    None,
+    // a line does not contain exactly three numbers
+    InvalidFormat,
+    // a number parsed to NaN
+    InvalidValue,
+};
+
+struct TextChunk
+{
+    const char* begin;
+    const char* end;
+};
+
+inline bool IsLineSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool IsDigit(char c)
+{
+    return unsigned(c - '0') < 10;
+}
+
+inline bool MatchesNoCase(const char* p, const char* end, const char* word)
+{
+    for(; *word != 0; p++, word++)
+    {
+        if(p == end || (*p | 0x20) != *word)
+            return false;
+    }
+    return true;
+}
+
+// Computes mantissa * 10^exponent if that can be done exactly with a single float operation
+// Both the mantissa and the power of 10 are then exactly representable as floats,
+// so one correctly rounded multiplication/division gives the correctly rounded result
+inline bool ComposeExactFloat(uint64_t mantissa, int exponent, bool negative, float& out)
+{
+    static constexpr float POWERS_OF_10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    constexpr uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 24;
+    constexpr int MAX_EXACT_EXPONENT = 10;
+    if(mantissa > MAX_EXACT_MANTISSA || exponent < -MAX_EXACT_EXPONENT || exponent > MAX_EXACT_EXPONENT)
+        return false;
+    float v = float(mantissa);
+    v = (exponent < 0) ? v / POWERS_OF_10[-exponent] : v * POWERS_OF_10[exponent];
+    out = negative ? -v : v;
+    return true;
+}
+
+// Parses a single number starting at p, advancing p past it
+// Handles the common short decimal case with ComposeExactFloat,
+// anything longer or with a large exponent is handed to std::from_chars (also exact)
+inline bool ParseFloat(const char*& p, const char* end, float& out)
+{
+    constexpr int MAX_MANTISSA_DIGITS = 19;
+
+    const char* start = p;
+    bool negative = false;
+    if(p != end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    if(p != end && !IsDigit(*p) && *p != '.')
+    {
+        // fscanf accepts these, so we do too
+        if(MatchesNoCase(p, end, "nan"))
+        {
+            p += 3;
+            out = std::numeric_limits<float>::quiet_NaN();
+            return true;
+        }
+        if(MatchesNoCase(p, end, "inf"))
+        {
+            p += MatchesNoCase(p, end, "infinity") ? 8 : 3;
+            out = negative ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::infinity();
+            return true;
+        }
+        return false;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    // leading zeros carry no information
+    while(p != end && *p == '0')
+    {
+        p++;
+        any_digits = true;
+    }
+    while(p != end && IsDigit(*p))
+    {
+        if(digits < MAX_MANTISSA_DIGITS)
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+        else
+            exponent++;
+        digits++;
+        p++;
+        any_digits = true;
+    }
+    if(p != end && *p == '.')
+    {
+        p++;
+        if(digits == 0)
+        {
+            while(p != end && *p == '0')
+            {
+                p++;
+                exponent--;
+                any_digits = true;
+            }
+        }
+        while(p != end && IsDigit(*p))
+        {
+            if(digits < MAX_MANTISSA_DIGITS)
+            {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                exponent--;
+            }
+            digits++;
+            p++;
+            any_digits = true;
+        }
+    }
+    if(!any_digits)
+        return false;
+    if(p != end && (*p == 'e' || *p == 'E'))
+    {
+        const char* e = p + 1;
+        bool exponent_negative = false;
+        if(e != end && (*e == '-' || *e == '+'))
+        {
+            exponent_negative = *e == '-';
+            e++;
+        }
+        if(e != end && IsDigit(*e))
+        {
+            int value = 0;
+            while(e != end && IsDigit(*e))
+            {
+                if(value < 100000)
+                    value = value * 10 + (*e - '0');
+                e++;
+            }
+            exponent += exponent_negative ? -value : value;
+            p = e;
+        }
+    }
+    if(mantissa == 0)
+    {
+        out = negative ? -0.0f : 0.0f;
+        return true;
+    }
+    if(digits <= MAX_MANTISSA_DIGITS && ComposeExactFloat(mantissa, exponent, negative, out))
+        return true;
+    // slow path, from_chars does not accept a leading '+'
+    const char* number_start = (*start == '+') ? start + 1 : start;
+    auto res = std::from_chars(number_start, p, out);
+    // out of range values saturate like strtof does
+    if(res.ec == std::errc::result_out_of_range)
+    {
+        bool tiny = exponent < 0;
+        out = tiny ? 0.0f : std::numeric_limits<float>::infinity();
+        if(negative)
+            out = -out;
+        return true;
+    }
+    return res.ec == std::errc() && res.ptr == p;
+}
+
+// Parses every line in [begin, end) and appends the values to out, three per point
+// Blank lines are skipped, any other line must hold exactly three numbers
+// Byte at a time reference implementation, see TextTokenizer.hpp for the vectorized version
+inline TextParseError ParseTextChunkScalar(const char* begin, const char* end, std::vector<float>& out)
+{
+    const char* p = begin;
+    while(p != end)
+    {
+        while(p != end && IsLineSpace(*p))
+            p++;
+        if(p == end)
+            break;
+        if(*p == '\n')
+        {
+            p++;
+            continue;
+        }
+        float v[3];
+        for(int i = 0; i < 3; i++)
+        {
+            if(!ParseFloat(p, end, v[i]))
+                return TextParseError::InvalidFormat;
+            // numbers must be followed by whitespace, "1.5abc" is not a number
+            if(p != end && *p != '\n' && !IsLineSpace(*p))
+                return TextParseError::InvalidFormat;
+            while(p != end && IsLineSpace(*p))
+                p++;
+            if(i != 2 && (p == end || *p == '\n'))
+                return TextParseError::InvalidFormat;
+        }
+        if(p != end && *p != '\n')
+            return TextParseError::InvalidFormat;
+        if(std::isnan(v[0]) || std::isnan(v[1]) || std::isnan(v[2]))
+            return TextParseError::InvalidValue;
+        out.push_back(v[0]);
+        out.push_back(v[1]);
+        out.push_back(v[2]);
+    }
+    return TextParseError::None;
+}
+
+// Like ParseTextChunkScalar for lines of n_columns numbers, of which the ones in columns x, y and z are kept
+// For tables with more than the coordinates, such as the vertices of ASCII PLY files
+// With keep_nan lines with a NaN coordinate are kept instead of rejected (PCD files mark missing points that way)
+inline TextParseError ParseTextColumns(const char* begin, const char* end, int n_columns, const int columns[3],
+    std::vector<float>& out, bool keep_nan = false)
+{
+    const char* p = begin;
+    while(p != end)
+    {
+        while(p != end && IsLineSpace(*p))
+            p++;
+        if(p == end)
+            break;
+        if(*p == '\n')
+        {
+            p++;
+            continue;
+        }
+        float v[3];
+        for(int i = 0; i < n_columns; i++)
+        {
+            float value;
+            if(!ParseFloat(p, end, value))
+                return TextParseError::InvalidFormat;
+            if(p != end && *p != '\n' && !IsLineSpace(*p))
+                return TextParseError::InvalidFormat;
+            while(p != end && IsLineSpace(*p))
+                p++;
+            if(i != n_columns - 1 && (p == end || *p == '\n'))
+                return TextParseError::InvalidFormat;
+            for(int ii = 0; ii < 3; ii++)
+            {
+                if(columns[ii] == i)
+                    v[ii] = value;
+            }
+        }
+        if(p != end && *p != '\n')
+            return TextParseError::InvalidFormat;
+        if(!keep_nan && (std::isnan(v[0]) || std::isnan(v[1]) || std::isnan(v[2])))
+            return TextParseError::InvalidValue;
+        out.push_back(v[0]);
+        out.push_back(v[1]);
+        out.push_back(v[2]);
+    }
+    return TextParseError::None;
+}
+
+// Cuts [data, data + size) into pieces of roughly chunk_size bytes, each ending right after a newline
+inline std::vector<TextChunk> SplitTextChunks(const char* data, size_t size, size_t chunk_size)
+{
+    std::vector<TextChunk> chunks;
+    const char* end = data + size;
+    const char* p = data;
+    while(p != end)
+    {
+        const char* chunk_end = (size_t(end - p) <= chunk_size) ? end : p + chunk_size;
+        while(chunk_end != end && chunk_end[-1] != '\n')
+            chunk_end++;
+        chunks.push_back({p, chunk_end});
+        p = chunk_end;
+    }
+    return chunks;
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <cstring>
+
+#include "TextParser.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define POINTS_TEXT_TOKENIZER_X86
+#include <immintrin.h>
+#endif
+
+// Vectorized tokenizer for the same "x y z" text format as ParseTextChunkScalar
+// Classifies 64 bytes at a time into bitmasks (separators, newlines, digits, dots, signs),
+// walks the token starts with bit scans and converts plain fixed-point decimals with SWAR arithmetic
+// Anything unusual (exponents, nan, long mantissas, tokens crossing a block) falls back to ParseFloat,
+// so the output is bit-identical to the scalar parser
+// Opt-in, see DetectTextParserPath()
+
+enum class TextParserPath
+{
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// One bit per byte of a 64 byte block
+struct TextBlockMasks
+{
+    // any whitespace, newlines included
+    uint64_t space;
+    uint64_t newline;
+    uint64_t digit;
+    uint64_t dot;
+    // '+' or '-'
+    uint64_t sign;
+    uint64_t minus;
+};
+
+constexpr size_t TEXT_BLOCK_SIZE = 64;
+// digit runs are read 9 bytes at a time, which may reach past the end of the block
+constexpr size_t TEXT_BLOCK_SLACK = 8;
+
+// A number found in a block, offsets are relative to the block
+struct TextToken
+{
+    uint8_t start;
+    uint8_t end;
+    // first digit and the dot (or end if there is none) of a plain decimal
+    uint8_t first;
+    uint8_t dot;
+    bool negative;
+    // a plain decimal of at most 8 digits, otherwise ParseFloat has to take care of it
+    bool simple;
+    // at least one newline between the previous token and this one
+    bool newline_before;
+};
+
+// Value of the plain decimal of n (at most 8) digits at p, with the dot at offset dot (dot >= n if there is none)
+// p must have 9 readable bytes
+inline uint64_t ParseDecimalSWAR(const char* p, int dot, int n)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    uint64_t next = uint8_t(p[8]);
+    // drop the dot by moving everything after it one byte down
+    uint64_t before_dot = (dot >= 8) ? ~uint64_t(0) : ((uint64_t(1) << (dot * 8)) - 1);
+    v = (v & before_dot) | (((v >> 8) | (next << 56)) & ~before_dot);
+    v -= 0x3030303030303030ull;
+    // little endian, so this drops the bytes after the digits and pads with leading zeros
+    v <<= (8 - n) * 8;
+    v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FFull;
+    v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFFull;
+    v = (v * 10000 + (v >> 32)) & 0xFFFFFFFFull;
+    return v;
+}
+
+// Shared block walker, Classify turns 64 bytes into TextBlockMasks
+// Each block is handled in three passes: find the tokens, convert them, assign them to lines
+// Keeping the conversions free of the token search lets their long multiply chains overlap
+// Always inlined so that the classification gets compiled with the caller's instruction set
+template<typename Classify>
+[[gnu::always_inline]] inline TextParseError ParseTextBlocks(const char* begin, const char* end, std::vector<float>& out, Classify classify)
+{
+    // the last few bytes are copied here so that the loads never leave the buffer
+    char tail[TEXT_BLOCK_SIZE + TEXT_BLOCK_SLACK];
+    // at most every other byte starts a token
+    TextToken tokens[TEXT_BLOCK_SIZE / 2];
+    float values[TEXT_BLOCK_SIZE / 2];
+    bool failed[TEXT_BLOCK_SIZE / 2];
+    float line[3];
+    int n_values = 0;
+    auto end_line = [&]()
+    {
+        if(n_values == 0)
+            return TextParseError::None;
+        if(n_values != 3)
+            return TextParseError::InvalidFormat;
+        n_values = 0;
+        if(std::isnan(line[0]) || std::isnan(line[1]) || std::isnan(line[2]))
+            return TextParseError::InvalidValue;
+        out.push_back(line[0]);
+        out.push_back(line[1]);
+        out.push_back(line[2]);
+        return TextParseError::None;
+    };
+
+    const char* p = begin;
+    while(p != end)
+    {
+        size_t available = end - p;
+        size_t valid = std::min(available, TEXT_BLOCK_SIZE);
+        bool reaches_end = available <= TEXT_BLOCK_SIZE;
+        const char* base = p;
+        if(available < TEXT_BLOCK_SIZE + TEXT_BLOCK_SLACK)
+        {
+            memcpy(tail, p, valid);
+            memset(tail + valid, ' ', sizeof(tail) - valid);
+            base = tail;
+        }
+        TextBlockMasks m = classify(base);
+        uint64_t valid_mask = (valid == 64) ? ~uint64_t(0) : ((uint64_t(1) << valid) - 1);
+        // bytes past the valid range act as separators
+        uint64_t space = m.space | ~valid_mask;
+        // blocks always start on a separator or at the start of a token
+        uint64_t starts = ~space & ((space << 1) | 1);
+        uint64_t newlines = m.newline & valid_mask;
+        size_t advance = valid;
+        // a token that does not fit into the rest of this block
+        bool crossed = false;
+
+        // find the tokens
+        int n_tokens = 0;
+        while(starts != 0)
+        {
+            int i = __builtin_ctzll(starts);
+            starts &= starts - 1;
+            uint64_t bit = uint64_t(1) << i;
+            uint64_t after = space & (~uint64_t(0) << i);
+            int e = (after != 0) ? __builtin_ctzll(after) : 64;
+            if(size_t(e) >= valid && !reaches_end)
+            {
+                crossed = true;
+                advance = i;
+                break;
+            }
+            uint64_t token = (e == 64) ? (~uint64_t(0) << i) : (((uint64_t(1) << e) - 1) & (~uint64_t(0) << i));
+            // signs are frequent and random, so strip them without branching
+            uint64_t body = token & ~(m.sign & bit);
+            uint64_t digits = m.digit & body;
+            uint64_t dots = m.dot & body;
+            int first = (body != 0) ? __builtin_ctzll(body) : e;
+            int dot = (dots != 0) ? __builtin_ctzll(dots) : e;
+            // the token is contiguous, so the digits can be counted from its length
+            int n_digits = e - first - ((dots != 0) ? 1 : 0);
+            auto& t = tokens[n_tokens++];
+            t.start = i;
+            t.end = e;
+            t.first = first;
+            t.dot = dot;
+            t.negative = (m.minus & bit) != 0;
+            t.simple = digits != 0 && (digits | dots) == body && (dots & (dots - 1)) == 0 && n_digits <= 8;
+            t.newline_before = (newlines & (bit - 1)) != 0;
+            newlines &= ~(bit - 1);
+        }
+
+        // convert them
+        for(int i = 0; i < n_tokens; i++)
+        {
+            auto& t = tokens[i];
+            bool converted = false;
+            if(t.simple)
+            {
+                int n_frac = (t.dot < t.end) ? t.end - t.dot - 1 : 0;
+                int n_digits = t.end - t.first - ((t.dot < t.end) ? 1 : 0);
+                uint64_t mantissa = ParseDecimalSWAR(base + t.first, t.dot - t.first, n_digits);
+                converted = ComposeExactFloat(mantissa, -n_frac, t.negative, values[i]);
+            }
+            failed[i] = false;
+            if(!converted)
+            {
+                const char* q = base + t.start;
+                failed[i] = !ParseFloat(q, base + t.end, values[i]) || q != base + t.end;
+            }
+        }
+
+        // and assign them to lines, in order so that the first error in the text is the one reported
+        for(int i = 0; i < n_tokens; i++)
+        {
+            if(tokens[i].newline_before)
+            {
+                auto error = end_line();
+                if(error != TextParseError::None)
+                    return error;
+            }
+            if(failed[i] || n_values == 3)
+                return TextParseError::InvalidFormat;
+            line[n_values++] = values[i];
+        }
+        if(crossed)
+        {
+            if(advance == 0)
+            {
+                // the token is longer than a whole block, parse it directly and restart right after it
+                if(n_values == 3)
+                    return TextParseError::InvalidFormat;
+                const char* q = p;
+                if(!ParseFloat(q, end, line[n_values]))
+                    return TextParseError::InvalidFormat;
+                if(q != end && *q != '\n' && !IsLineSpace(*q))
+                    return TextParseError::InvalidFormat;
+                n_values++;
+                advance = q - p;
+            }
+            // otherwise the next block starts on that token
+            else if((newlines & ((uint64_t(1) << advance) - 1)) != 0)
+            {
+                auto error = end_line();
+                if(error != TextParseError::None)
+                    return error;
+            }
+        }
+        else if(newlines != 0)
+        {
+            auto error = end_line();
+            if(error != TextParseError::None)
+                return error;
+        }
+        p += advance;
+    }
+    return end_line();
+}
+
+#ifdef POINTS_TEXT_TOKENIZER_X86
+
+// (c - low) <= (high - low) as unsigned bytes
+__attribute__((target("sse2"))) inline __m128i InRangeSSE2(__m128i c, char low, char high)
+{
+    __m128i t = _mm_sub_epi8(c, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(char(high - low))), t);
+}
+
+__attribute__((target("sse2"))) inline TextBlockMasks ClassifyTextBlockSSE2(const char* p)
+{
+    TextBlockMasks m = {0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < 4; i++)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)(p + i * 16));
+        // '\t', '\n', '\v', '\f' and '\r' are consecutive
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), InRangeSSE2(c, '\t', '\r'));
+        __m128i minus = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+        __m128i sign = _mm_or_si128(minus, _mm_cmpeq_epi8(c, _mm_set1_epi8('+')));
+        int shift = i * 16;
+        m.space |= uint64_t(uint32_t(_mm_movemask_epi8(space))) << shift;
+        m.newline |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))))) << shift;
+        m.digit |= uint64_t(uint32_t(_mm_movemask_epi8(InRangeSSE2(c, '0', '9')))) << shift;
+        m.dot |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('.'))))) << shift;
+        m.sign |= uint64_t(uint32_t(_mm_movemask_epi8(sign))) << shift;
+        m.minus |= uint64_t(uint32_t(_mm_movemask_epi8(minus))) << shift;
+    }
+    return m;
+}
+
+__attribute__((target("avx2"))) inline __m256i InRangeAVX2(__m256i c, char low, char high)
+{
+    __m256i t = _mm256_sub_epi8(c, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(char(high - low))), t);
+}
+
+__attribute__((target("avx2"))) inline TextBlockMasks ClassifyTextBlockAVX2(const char* p)
+{
+    TextBlockMasks m = {0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < 2; i++)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p + i * 32));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), InRangeAVX2(c, '\t', '\r'));
+        __m256i minus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'));
+        __m256i sign = _mm256_or_si256(minus, _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')));
+        int shift = i * 32;
+        m.space |= uint64_t(uint32_t(_mm256_movemask_epi8(space))) << shift;
+        m.newline |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n'))))) << shift;
+        m.digit |= uint64_t(uint32_t(_mm256_movemask_epi8(InRangeAVX2(c, '0', '9')))) << shift;
+        m.dot |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.'))))) << shift;
+        m.sign |= uint64_t(uint32_t(_mm256_movemask_epi8(sign))) << shift;
+        m.minus |= uint64_t(uint32_t(_mm256_movemask_epi8(minus))) << shift;
+    }
+    return m;
+}
+
+__attribute__((target("sse2"))) inline TextParseError ParseTextChunkSSE2(const char* begin, const char* end, std::vector<float>& out)
+{
+    return ParseTextBlocks(begin, end, out, ClassifyTextBlockSSE2);
+}
+
+__attribute__((target("avx2"))) inline TextParseError ParseTextChunkAVX2(const char* begin, const char* end, std::vector<float>& out)
+{
+    return ParseTextBlocks(begin, end, out, ClassifyTextBlockAVX2);
+}
+
+#endif
+
+inline bool IsTextParserPathSupported(TextParserPath path)
+{
+    switch(path)
+    {
+        case TextParserPath::Scalar:
+            return true;
+#ifdef POINTS_TEXT_TOKENIZER_X86
+        case TextParserPath::SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case TextParserPath::AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+// Path ParseTextChunk() uses: the scalar one unless built with POINTS_SIMD_TOKENIZER, then the best one the CPU supports
+// The vectorized paths measured within noise of the scalar one (bench_parser, 60-100MB files: AVX2 0.76x to 1.18x),
+// so they stay opt-in until they are clearly faster
+inline TextParserPath DetectTextParserPath()
+{
+#ifdef POINTS_SIMD_TOKENIZER
+    if(IsTextParserPathSupported(TextParserPath::AVX2))
+        return TextParserPath::AVX2;
+    if(IsTextParserPathSupported(TextParserPath::SSE2))
+        return TextParserPath::SSE2;
+#endif
+    return TextParserPath::Scalar;
+}
+
+inline const char* GetTextParserPathName(TextParserPath path)
+{
+    switch(path)
+    {
+        case TextParserPath::SSE2:
+            return "SSE2";
+        case TextParserPath::AVX2:
+            return "AVX2";
+        default:
+            return "Scalar";
+    }
+}
+
+// The path must be supported by the CPU, see IsTextParserPathSupported()
+inline TextParseError ParseTextChunkWithPath(TextParserPath path, const char* begin, const char* end, std::vector<float>& out)
+{
+    switch(path)
+    {
+#ifdef POINTS_TEXT_TOKENIZER_X86
+        case TextParserPath::SSE2:
+            return ParseTextChunkSSE2(begin, end, out);
+        case TextParserPath::AVX2:
+            return ParseTextChunkAVX2(begin, end, out);
+#endif
+        default:
+            return ParseTextChunkScalar(begin, end, out);
+    }
+}
+
+// Parses every line in [begin, end) with the path DetectTextParserPath() picks
+// Same contract as ParseTextChunkScalar
+inline TextParseError ParseTextChunk(const char* begin, const char* end, std::vector<float>& out)
+{
+    static const TextParserPath path = DetectTextParserPath();
+    return ParseTextChunkWithPath(path, begin, end, out);
+}
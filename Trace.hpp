@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Scoped timing of the expensive steps (loading phases, uploads, frames), to see where the time goes
+// Every thread records into its own ring buffer: recording takes no lock and never allocates,
+// once a buffer is full its oldest events are overwritten
+// WriteChromeTrace() exports whatever the buffers hold in the Chrome trace format (chrome://tracing, Perfetto)
+
+// per thread, 24 bytes each
+constexpr size_t TRACE_BUFFER_EVENTS = 1 << 14;
+
+class Trace
+{
+    protected:
+    // the fields are atomic so that an export can read a buffer while its thread keeps writing
+    struct Event
+    {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> begin;
+        std::atomic<uint64_t> end;
+    };
+    struct ThreadBuffer
+    {
+        uint32_t thread_id;
+        // guarded by Trace::mx
+        std::string thread_name;
+        std::atomic<uint64_t> n_recorded = 0;
+        Event events[TRACE_BUFFER_EVENTS];
+    };
+    static inline thread_local ThreadBuffer* own_buffer = nullptr;
+
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex mx;
+    // buffers outlive their threads, so that what a finished thread did can still be exported
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer* GetOwnBuffer()
+    {
+        if(own_buffer == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            own_buffer = buffers.back().get();
+            own_buffer->thread_id = uint32_t(buffers.size());
+            own_buffer->thread_name = "Thread " + std::to_string(buffers.size());
+        }
+        return own_buffer;
+    }
+    static void WriteJsonString(FILE* f, const std::string& s)
+    {
+        fputc('"', f);
+        for(unsigned char c : s)
+        {
+            if(c == '"' || c == '\\')
+                fprintf(f, "\\%c", c);
+            else if(c < 0x20)
+                fprintf(f, "\\u%04x", c);
+            else
+                fputc(c, f);
+        }
+        fputc('"', f);
+    }
+    Trace()
+    {
+        epoch = std::chrono::steady_clock::now();
+    }
+    public:
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+    // Never destroyed, workers may still record while static objects are torn down
+    static Trace& Get()
+    {
+        static Trace* trace = new Trace();
+        return *trace;
+    }
+    // Nanoseconds since the trace started
+    uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+    // name must live forever, only the pointer is kept; a string literal is best
+    void Record(const char* name, uint64_t begin, uint64_t end)
+    {
+        ThreadBuffer* buffer = GetOwnBuffer();
+        uint64_t i = buffer->n_recorded.load(std::memory_order_relaxed);
+        Event& event = buffer->events[i % TRACE_BUFFER_EVENTS];
+        event.name.store(name, std::memory_order_relaxed);
+        event.begin.store(begin, std::memory_order_relaxed);
+        event.end.store(end, std::memory_order_relaxed);
+        buffer->n_recorded.store(i + 1, std::memory_order_release);
+    }
+    // Shown as the name of the calling thread's row
+    void SetThreadName(std::string name)
+    {
+        ThreadBuffer* buffer = GetOwnBuffer();
+        std::lock_guard<std::mutex> lock(mx);
+        buffer->thread_name = name;
+    }
+    // Writes the recorded events in the Chrome trace JSON format, false if the file could not be written
+    bool WriteChromeTrace(std::string path)
+    {
+        FILE* f = fopen(path.c_str(), "w");
+        if(f == nullptr)
+            return false;
+        std::lock_guard<std::mutex> lock(mx);
+        fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for(auto& buffer : buffers)
+        {
+            fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ",
+                first ? "" : ",\n", buffer->thread_id);
+            WriteJsonString(f, buffer->thread_name);
+            fprintf(f, "}}");
+            first = false;
+            uint64_t n = buffer->n_recorded.load(std::memory_order_acquire);
+            uint64_t begin = (n > TRACE_BUFFER_EVENTS) ? n - TRACE_BUFFER_EVENTS : 0;
+            std::vector<std::pair<const char*, std::pair<uint64_t, uint64_t>>> events;
+            events.reserve(n - begin);
+            for(uint64_t i = begin; i < n; i++)
+            {
+                Event& event = buffer->events[i % TRACE_BUFFER_EVENTS];
+                events.push_back({event.name.load(std::memory_order_relaxed),
+                    {event.begin.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed)}});
+            }
+            // the thread kept recording meanwhile, whatever it has overwritten since is dropped
+            uint64_t n_after = buffer->n_recorded.load(std::memory_order_acquire);
+            uint64_t valid = (n_after > TRACE_BUFFER_EVENTS) ? n_after - TRACE_BUFFER_EVENTS : 0;
+            for(uint64_t i = std::max(begin, valid); i < n; i++)
+            {
+                auto& event = events[i - begin];
+                fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    event.first, buffer->thread_id, double(event.second.first) / 1e3,
+                    double(event.second.second - event.second.first) / 1e3);
+            }
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
+    }
+};
+
+// Records the time from its construction to its destruction under name, which must be a string literal
+class TraceScope
+{
+    protected:
+    const char* name;
+    uint64_t begin;
+    public:
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+    TraceScope(const char* name)
+    {
+        this->name = name;
+        begin = Trace::Get().Now();
+    }
+    ~TraceScope()
+    {
+        Trace::Get().Record(name, begin, Trace::Get().Now());
+    }
+};
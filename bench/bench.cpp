@@ -0,0 +1,557 @@
+// Benchmark suite: generates synthetic clouds and times every loading phase and the render path on its own
+// Prints one JSON object per line, the first one describes the machine, then one per phase of every run:
+//   {"distribution": ..., "points": ..., "phase": ..., "seconds": ..., "points_per_second": ..., "mb_per_second": ..., "peak_rss_mb": ...}
+// mb_per_second is null for phases that do not move file data, peak_rss_mb is the peak of that phase alone where
+// the OS can reset it (Linux), otherwise the peak of the process so far
+// sections is the time of one update of 16 section boundaries, render_frame and render_frame_lod are per frame
+// and count the points actually drawn
+// The generated files are written to a temporary directory and are in the page cache when they are read back,
+// so the parse and load phases measure the CPU side, not the disk
+//
+// Usage: points-bench [--points 1M,10M] [--distribution uniform,clustered,scan] [--dir path]
+//                     [--no-render] [--no-paged] [--keep]
+//   --points        cloud sizes, K/M/G suffixes are allowed (default 1M,10M)
+//   --distribution  any of uniform, clustered, scan (default all three)
+//   --no-render     skip the render phases, which need a display for their (hidden) window
+//   --no-paged      skip the conversion to the out-of-core layout
+//   --keep          keep the generated files
+
+#include "hmain.hpp"
+
+#include <stdlib.h>
+#include <charconv>
+#include <random>
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+enum class BenchDistribution
+{
+    // a box, the worst case for the octree's leaf sizes
+    Uniform,
+    // gaussian blobs of different sizes
+    Clustered,
+    // rings of a rotating sensor hitting the ground and surrounding walls, dense near the sensor like real scans
+    Scan,
+};
+constexpr BenchDistribution BENCH_DISTRIBUTIONS[] = {BenchDistribution::Uniform, BenchDistribution::Clustered, BenchDistribution::Scan};
+
+constexpr size_t BENCH_BLOCK_POINTS = 1 << 20;
+// blocks formatted in memory before being written out
+constexpr size_t BENCH_WRITE_BATCH_BLOCKS = 64;
+constexpr int BENCH_CLUSTERS = 256;
+constexpr int BENCH_SCAN_BEAMS = 64;
+constexpr int BENCH_SECTION_UPDATES = 1000;
+constexpr int BENCH_SECTIONS = 16;
+constexpr int BENCH_RENDER_FRAMES = 30;
+constexpr int BENCH_WIDTH = 1280;
+constexpr int BENCH_HEIGHT = 720;
+
+const char* GetBenchDistributionName(BenchDistribution distribution)
+{
+    switch(distribution)
+    {
+        case BenchDistribution::Uniform: return "uniform";
+        case BenchDistribution::Clustered: return "clustered";
+        case BenchDistribution::Scan: return "scan";
+    }
+    return "";
+}
+
+// Resets the peak the next GetPeakMemoryUsage() returns, only possible on Linux
+static void ResetPeakMemoryUsage()
+{
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if(f != nullptr)
+    {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+static size_t GetPeakMemoryUsage()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+#if defined(__linux__)
+    // VmHWM follows the resets, ru_maxrss does not
+    FILE* f = fopen("/proc/self/status", "r");
+    if(f != nullptr)
+    {
+        char line[256];
+        size_t kb = 0;
+        while(fgets(line, sizeof(line), f) != nullptr)
+        {
+            if(sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+                break;
+        }
+        fclose(f);
+        if(kb != 0)
+            return kb * 1024;
+    }
+#endif
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static void WriteJsonNumber(double v)
+{
+    if(std::isfinite(v))
+        printf("%.9g", v);
+    else
+        printf("null");
+}
+
+struct BenchRun
+{
+    BenchDistribution distribution;
+    size_t n_points;
+};
+
+// bytes is the amount of file data the phase reads or writes, 0 if none
+static void Report(const BenchRun& run, const char* phase, double seconds, size_t n_points, size_t bytes)
+{
+    printf("{\"distribution\": \"%s\", \"points\": %zu, \"phase\": \"%s\", \"seconds\": ",
+        GetBenchDistributionName(run.distribution), run.n_points, phase);
+    WriteJsonNumber(seconds);
+    printf(", \"points_per_second\": ");
+    WriteJsonNumber(double(n_points) / seconds);
+    printf(", \"mb_per_second\": ");
+    WriteJsonNumber((bytes != 0) ? double(bytes) / seconds / 1e6 : NAN);
+    printf(", \"peak_rss_mb\": ");
+    WriteJsonNumber(double(GetPeakMemoryUsage()) / 1e6);
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void ReportSkipped(const BenchRun& run, const char* phase, const char* reason)
+{
+    printf("{\"distribution\": \"%s\", \"points\": %zu, \"phase\": \"%s\", \"skipped\": \"%s\"}\n",
+        GetBenchDistributionName(run.distribution), run.n_points, phase, reason);
+    fflush(stdout);
+}
+
+template<typename F>
+static void TimePhase(const BenchRun& run, const char* phase, size_t bytes, F&& fn)
+{
+    ResetPeakMemoryUsage();
+    auto start = chrono::steady_clock::now();
+    fn();
+    Report(run, phase, chrono::duration<double>(chrono::steady_clock::now() - start).count(), run.n_points, bytes);
+}
+
+// Deterministic for a given distribution and size, every block has its own generator
+static vector<vec3<float>> GenerateCloud(BenchDistribution distribution, size_t n)
+{
+    vector<vec3<float>> points(n);
+    struct Cluster
+    {
+        vec3<float> center;
+        float sigma;
+    };
+    vector<Cluster> clusters(BENCH_CLUSTERS);
+    minstd_rand cluster_random(1);
+    uniform_real_distribution<float> cluster_position(-50.0f, 50.0f);
+    uniform_real_distribution<float> cluster_sigma(0.2f, 4.0f);
+    for(auto& c : clusters)
+        c = {{cluster_position(cluster_random), cluster_position(cluster_random), cluster_position(cluster_random) * 0.2f},
+            cluster_sigma(cluster_random)};
+
+    ParallelFor((n + BENCH_BLOCK_POINTS - 1) / BENCH_BLOCK_POINTS, [&](size_t b)
+    {
+        minstd_rand random(uint32_t(b) + 1);
+        uniform_real_distribution<float> unit(0.0f, 1.0f);
+        normal_distribution<float> normal(0.0f, 1.0f);
+        size_t end = std::min(n, (b + 1) * BENCH_BLOCK_POINTS);
+        for(size_t i = b * BENCH_BLOCK_POINTS; i < end; i++)
+        {
+            vec3<float>& p = points[i];
+            if(distribution == BenchDistribution::Uniform)
+                p = {unit(random) * 100.0f - 50.0f, unit(random) * 100.0f - 50.0f, unit(random) * 22.0f - 2.0f};
+            else if(distribution == BenchDistribution::Clustered)
+            {
+                const Cluster& c = clusters[random() % BENCH_CLUSTERS];
+                p = {c.center.x + normal(random) * c.sigma, c.center.y + normal(random) * c.sigma, c.center.z + normal(random) * c.sigma};
+            }
+            else
+            {
+                // the sensor sits 1.7 above the ground, beams from 25 degrees down to 5 degrees up
+                constexpr float HEIGHT = 1.7f;
+                int beam = random() % BENCH_SCAN_BEAMS;
+                float elevation = (-25.0f + 30.0f * float(beam) / float(BENCH_SCAN_BEAMS - 1)) * float(M_PI) / 180.0f;
+                float azimuth = unit(random) * 2.0f * float(M_PI);
+                float wall = 8.0f + 30.0f * (0.5f + 0.5f * std::sin(azimuth * 7.0f) * std::cos(azimuth * 3.0f));
+                float range = (elevation < 0.0f) ? std::min(wall, HEIGHT / std::tan(-elevation)) : wall;
+                range += normal(random) * 0.02f;
+                p = {range * std::cos(azimuth), range * std::sin(azimuth), range * std::tan(elevation)};
+            }
+        }
+    });
+    return points;
+}
+
+// Writes the cloud in the XYZ text format the viewer reads, returns the file size or 0 on failure
+static size_t WriteTextFile(const vector<vec3<float>>& points, string path)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if(f == nullptr)
+        return 0;
+    size_t n_blocks = (points.size() + BENCH_BLOCK_POINTS - 1) / BENCH_BLOCK_POINTS;
+    size_t written = 0;
+    vector<string> texts(BENCH_WRITE_BATCH_BLOCKS);
+    for(size_t batch = 0; batch < n_blocks; batch += BENCH_WRITE_BATCH_BLOCKS)
+    {
+        size_t batch_blocks = std::min(BENCH_WRITE_BATCH_BLOCKS, n_blocks - batch);
+        ParallelFor(batch_blocks, [&](size_t i)
+        {
+            size_t begin = (batch + i) * BENCH_BLOCK_POINTS;
+            size_t end = std::min(points.size(), begin + BENCH_BLOCK_POINTS);
+            string& text = texts[i];
+            // 3 values of at most 16 characters and their separators
+            text.resize((end - begin) * 3 * 17);
+            char* out = text.data();
+            char* out_end = text.data() + text.size();
+            for(size_t p = begin; p < end; p++)
+            {
+                for(int ii = 0; ii < 3; ii++)
+                {
+                    out = std::to_chars(out, out_end, points[p].data[ii], std::chars_format::fixed, 4).ptr;
+                    *out++ = (ii == 2) ? '\n' : ' ';
+                }
+            }
+            text.resize(out - text.data());
+        });
+        for(size_t i = 0; i < batch_blocks; i++)
+            written += fwrite(texts[i].data(), 1, texts[i].size(), f);
+    }
+    bool ok = fclose(f) == 0;
+    return ok ? written : 0;
+}
+
+// A PointProcessor that does not load by itself, the bench runs the steps of its load one at a time
+class BenchProcessor : public PointProcessor
+{
+    public:
+    BenchProcessor(string path) : PointProcessor(path, false, false, false)
+    {
+    }
+    using PointProcessor::ParseTextFile;
+    using PointProcessor::ComputeStatistics;
+    using PointProcessor::BuildSpatialIndex;
+    using PointProcessor::SortZ;
+    using PointProcessor::WriteCache;
+    // Once every step has run, so that the rest of the interface can be used
+    void SetLoaded()
+    {
+        Lock();
+        is_loaded = true;
+        Unlock();
+    }
+};
+
+// Loads path through a PointProcessor, returns nullptr if it failed
+static shared_ptr<PointProcessor> Load(string path)
+{
+    auto processor = make_shared<PointProcessor>(path, false, false);
+    processor->WaitForLoad();
+    processor->Lock();
+    bool loaded = processor->IsLoaded();
+    processor->Unlock();
+    return loaded ? processor : nullptr;
+}
+
+// The hidden window the render phases draw into, nullptr if there is no display
+static GLFWwindow* CreateBenchWindow()
+{
+    if(!glfwInit())
+        return nullptr;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if defined(__APPLE__)
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#else
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+#endif
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window = glfwCreateWindow(BENCH_WIDTH, BENCH_HEIGHT, "points-bench", nullptr, nullptr);
+    if(window == nullptr)
+        return nullptr;
+    glfwMakeContextCurrent(window);
+    // frames are timed, not shown
+    glfwSwapInterval(0);
+    glewExperimental = GL_TRUE;
+    glewInit();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    return window;
+}
+
+// Upload, then full frames and level of detail frames orbiting the cloud
+static void BenchRender(const BenchRun& run, GLFWwindow* window, shared_ptr<PointProcessor> processor)
+{
+#if defined(__APPLE__)
+    const char* glsl_version = "#version 150";
+#else
+    const char* glsl_version = "#version 330";
+#endif
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glViewport(0, 0, width, height);
+    OrbitCamera camera(50.0f, 0, 10000, float(width) / float(height));
+    camera.SetCenter(processor->GetCenterBounding());
+    camera.SetDistance(processor->GetFurthestDistanceFromCenter() * 2.0f);
+    vector<float> sections = {-1, 1.5, 100000};
+    vector<vec3<float>> section_colors = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+    // the current cloud stays resident even if it exceeds the default budget
+    auto renderer = make_shared<PointRenderer>(glsl_version);
+    renderer->SetSections(sections, section_colors);
+
+    ResetPeakMemoryUsage();
+    auto start = chrono::steady_clock::now();
+    renderer->SetCurrent(processor);
+    do
+    {
+        renderer->ContinueUpload();
+    } while(renderer->IsUploading());
+    glFinish();
+    Report(run, "render_upload", chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+        run.n_points, run.n_points * sizeof(vec3<float>));
+
+    for(bool lod : {false, true})
+    {
+        renderer->SetLodEnabled(lod);
+        ResetPeakMemoryUsage();
+        double seconds = 0.0;
+        size_t drawn = 0;
+        for(int frame = 0; frame < BENCH_RENDER_FRAMES; frame++)
+        {
+            camera.Rotate(0.05f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            auto frame_start = chrono::steady_clock::now();
+            renderer->Render(camera.GetModelViewMatrix(), camera.GetProjectionMatrix(), width, height);
+            glFinish();
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - frame_start).count();
+            drawn += renderer->GetDrawnPoints();
+        }
+        // per frame, the throughput counts the points actually drawn
+        Report(run, lod ? "render_frame_lod" : "render_frame", seconds / BENCH_RENDER_FRAMES, drawn / BENCH_RENDER_FRAMES, 0);
+        glfwPollEvents();
+    }
+}
+
+static void Bench(const BenchRun& run, string directory, GLFWwindow* window, bool paged, bool keep)
+{
+    string path = (filesystem::path(directory) / ("points_bench_" + string(GetBenchDistributionName(run.distribution))
+        + "_" + to_string(run.n_points) + ".txt")).string();
+    size_t file_size = 0;
+    {
+        vector<vec3<float>> generated;
+        TimePhase(run, "generate", 0, [&]() {generated = GenerateCloud(run.distribution, run.n_points);});
+        ResetPeakMemoryUsage();
+        auto start = chrono::steady_clock::now();
+        file_size = WriteTextFile(generated, path);
+        if(file_size == 0)
+        {
+            fprintf(stderr, "Failed to write %s\n", path.c_str());
+            return;
+        }
+        Report(run, "write_text", chrono::duration<double>(chrono::steady_clock::now() - start).count(), run.n_points, file_size);
+    }
+
+    // the phases of a load, one after another on the same data
+    {
+        BenchProcessor processor(path);
+        bool parsed = false;
+        TimePhase(run, "parse", file_size, [&]() {parsed = processor.ParseTextFile(path);});
+        if(!parsed || processor.GetNPoints() != run.n_points)
+        {
+            fprintf(stderr, "Failed to parse %s\n", path.c_str());
+            return;
+        }
+        TimePhase(run, "stats", 0, [&]() {processor.ComputeStatistics();});
+        TimePhase(run, "octree", 0, [&]() {processor.BuildSpatialIndex();});
+        TimePhase(run, "sort_z", 0, [&]() {processor.SortZ();});
+        processor.SetLoaded();
+        {
+            // as dragging a section slider does, per update
+            ResetPeakMemoryUsage();
+            float low = processor.GetBoundingBoxLow().z;
+            float step = (processor.GetBoundingBoxHigh().z - low) / BENCH_SECTIONS;
+            vector<float> sections(BENCH_SECTIONS, step);
+            auto start = chrono::steady_clock::now();
+            for(int update = 0; update < BENCH_SECTION_UPDATES; update++)
+            {
+                // the first section reaches from 0 to its end
+                sections[0] = low + step * float(update) / BENCH_SECTION_UPDATES + step;
+                processor.Lock();
+                processor.SetSections(sections);
+                processor.Unlock();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / BENCH_SECTION_UPDATES;
+            Report(run, "sections", seconds, run.n_points, 0);
+        }
+        PointCacheHeader header = {};
+        header.n_points = processor.GetNPoints();
+        header.n_nodes = processor.GetOctree().size();
+        TimePhase(run, "cache_write", GetPointCacheSize(header), [&]() {processor.WriteCache(path);});
+    }
+
+    // whole loads through PointProcessor, from the cache just written and from the text
+    size_t cache_size = filesystem::exists(GetPointCachePath(path)) ? filesystem::file_size(GetPointCachePath(path)) : 0;
+    TimePhase(run, "load_cached", cache_size, [&]() {Load(path);});
+    filesystem::remove(GetPointCachePath(path));
+    shared_ptr<PointProcessor> processor;
+    TimePhase(run, "load", file_size, [&]() {processor = Load(path);});
+    if(processor == nullptr)
+        fprintf(stderr, "Failed to load %s\n", path.c_str());
+    else if(window != nullptr)
+        BenchRender(run, window, processor);
+    else
+        ReportSkipped(run, "render", "no window");
+    processor = nullptr;
+
+    if(paged)
+    {
+        string error;
+        bool converted = false;
+        TimePhase(run, "convert_paged", file_size, [&]()
+        {
+            converted = ConvertToPagedCloud(path, GetPagedCloudPath(path), error, [](float) {}, [](const vector<float>&) {});
+        });
+        if(!converted)
+            fprintf(stderr, "Failed to convert %s: %s\n", path.c_str(), error.c_str());
+    }
+
+    if(!keep)
+    {
+        filesystem::remove(path);
+        filesystem::remove(GetPointCachePath(path));
+        filesystem::remove(GetPagedCloudPath(path));
+    }
+}
+
+// "10M" -> 10000000
+static bool ParseCount(string text, size_t& out)
+{
+    char* end;
+    double v = strtod(text.c_str(), &end);
+    string suffix = end;
+    double scale = 1.0;
+    if(suffix == "K" || suffix == "k")
+        scale = 1e3;
+    else if(suffix == "M" || suffix == "m")
+        scale = 1e6;
+    else if(suffix == "G" || suffix == "g")
+        scale = 1e9;
+    else if(!suffix.empty())
+        return false;
+    out = size_t(v * scale);
+    return end != text.c_str() && out > 0;
+}
+
+static vector<string> SplitList(string text)
+{
+    vector<string> out;
+    size_t begin = 0;
+    while(begin <= text.size())
+    {
+        size_t end = text.find(',', begin);
+        if(end == string::npos)
+            end = text.size();
+        out.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    vector<size_t> sizes = {1000000, 10000000};
+    vector<BenchDistribution> distributions(begin(BENCH_DISTRIBUTIONS), end(BENCH_DISTRIBUTIONS));
+    string directory = filesystem::temp_directory_path().string();
+    bool render = true;
+    bool paged = true;
+    bool keep = false;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool valid = true;
+        if(arg == "--points" && i + 1 < argc)
+        {
+            sizes.clear();
+            for(auto& s : SplitList(argv[++i]))
+            {
+                size_t n = 0;
+                valid = valid && ParseCount(s, n);
+                sizes.push_back(n);
+            }
+        }
+        else if(arg == "--distribution" && i + 1 < argc)
+        {
+            distributions.clear();
+            for(auto& s : SplitList(argv[++i]))
+            {
+                auto it = find_if(begin(BENCH_DISTRIBUTIONS), end(BENCH_DISTRIBUTIONS),
+                    [&](BenchDistribution d) {return s == GetBenchDistributionName(d);});
+                valid = valid && it != end(BENCH_DISTRIBUTIONS);
+                if(valid)
+                    distributions.push_back(*it);
+            }
+        }
+        else if(arg == "--dir" && i + 1 < argc)
+            directory = argv[++i];
+        else if(arg == "--no-render")
+            render = false;
+        else if(arg == "--no-paged")
+            paged = false;
+        else if(arg == "--keep")
+            keep = true;
+        else
+            valid = false;
+        if(!valid)
+        {
+            fprintf(stderr, "Usage: points-bench [--points 1M,10M] [--distribution uniform,clustered,scan] [--dir path] [--no-render] [--no-paged] [--keep]\n");
+            return 2;
+        }
+    }
+
+    GLFWwindow* window = render ? CreateBenchWindow() : nullptr;
+    printf("{\"threads\": %zu, \"parser\": \"%s\", \"physical_memory_mb\": ", GetWorkerCount(),
+        GetTextParserPathName(DetectTextParserPath()));
+    WriteJsonNumber(double(GetPhysicalMemory()) / 1e6);
+    printf(", \"renderer\": ");
+    if(window != nullptr)
+        printf("\"%s\"}\n", (const char*)glGetString(GL_RENDERER));
+    else
+        printf("null}\n");
+    for(auto distribution : distributions)
+    {
+        for(size_t n : sizes)
+            Bench({distribution, n}, directory, window, paged, keep);
+    }
+    if(window != nullptr)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+// Round trip check for compressed text input
+// Writes a text cloud, compresses it as one gzip/zstd frame, as several concatenated frames and truncated, then loads
+// every file in memory and out-of-core and compares the result with the load of the plain text
+//
+// Usage: check_compressed [directory] (defaults to the temporary directory)
+
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hcore.hpp"
+
+#ifdef POINTS_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef POINTS_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+constexpr size_t CHECK_POINTS = 2000000;
+constexpr size_t CHECK_FRAMES = 3;
+
+static int failures = 0;
+
+static void Fail(const std::string& what)
+{
+    printf("FAIL %s\n", what.c_str());
+    failures++;
+}
+
+static bool WriteFile(const std::string& path, const std::string& data)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if(file == nullptr)
+        return false;
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+    return (fclose(file) == 0) && ok;
+}
+
+static void RemoveLoadFiles(const std::string& path)
+{
+    std::filesystem::remove(GetPointCachePath(path));
+    std::filesystem::remove(GetPagedCloudPath(path));
+}
+
+static std::unique_ptr<PointProcessor> Load(const std::string& path, bool out_of_core)
+{
+    RemoveLoadFiles(path);
+    auto processor = std::make_unique<PointProcessor>(path, out_of_core, false);
+    processor->WaitForLoad();
+    return processor;
+}
+
+// Whether both loaded the same points, compared point by point in memory and by their statistics out-of-core
+static bool SameCloud(PointProcessor& a, PointProcessor& b)
+{
+    if(a.GetNPoints() != b.GetNPoints())
+        return false;
+    if(!a.IsOutOfCore())
+        return memcmp(a.GetPoints(), b.GetPoints(), a.GetNPoints() * sizeof(vec3<float>)) == 0;
+    for(int i = 0; i < 3; i++)
+    {
+        if(a.GetBoundingBoxLow().data[i] != b.GetBoundingBoxLow().data[i] || a.GetBoundingBoxHigh().data[i] != b.GetBoundingBoxHigh().data[i]
+            || a.GetCenterAverage().data[i] != b.GetCenterAverage().data[i])
+            return false;
+    }
+    return true;
+}
+
+static void CheckSame(const std::string& name, const std::string& path, PointProcessor& plain, bool out_of_core)
+{
+    auto processor = Load(path, out_of_core);
+    std::string mode = out_of_core ? " (out-of-core)" : "";
+    processor->Lock();
+    if(processor->HasFailedToLoad())
+        Fail(name + mode + ": " + processor->GetLoadFailureError());
+    else if(!SameCloud(plain, *processor))
+        Fail(name + mode + ": points differ from the plain text");
+    else
+        printf("ok   %s%s\n", name.c_str(), mode.c_str());
+    processor->Unlock();
+    RemoveLoadFiles(path);
+}
+
+static void CheckFails(const std::string& name, const std::string& path, bool out_of_core)
+{
+    auto processor = Load(path, out_of_core);
+    std::string mode = out_of_core ? " (out-of-core)" : "";
+    processor->Lock();
+    if(!processor->HasFailedToLoad())
+        Fail(name + mode + ": loaded " + std::to_string(processor->GetNPoints()) + " points");
+    else
+        printf("ok   %s%s: %s\n", name.c_str(), mode.c_str(), processor->GetLoadFailureError().c_str());
+    processor->Unlock();
+    RemoveLoadFiles(path);
+}
+
+// Checks the frames, compressed one by one, as a single file and concatenated, then the first file truncated
+template<typename CompressFn>
+static void CheckFormat(const std::string& name, const std::string& directory, const std::vector<std::string>& frames,
+    PointProcessor& whole, PointProcessor& first, bool out_of_core, CompressFn compress)
+{
+    std::string single = compress(frames[0]);
+    std::string several;
+    for(auto& frame : frames)
+        several += compress(frame);
+    std::string base = directory + "/check_compressed_" + name;
+    if(!WriteFile(base + "_single", single) || !WriteFile(base + "_several", several)
+        || !WriteFile(base + "_truncated", single.substr(0, single.size() / 2)))
+    {
+        Fail(name + ": failed to write the test files");
+        return;
+    }
+    CheckSame(name + " single frame", base + "_single", first, out_of_core);
+    CheckSame(name + " several frames", base + "_several", whole, out_of_core);
+    CheckFails(name + " truncated", base + "_truncated", out_of_core);
+    for(const char* suffix : {"_single", "_several", "_truncated"})
+        std::filesystem::remove(base + suffix);
+}
+
+int main(int argc, char** argv)
+{
+    std::string directory = (argc > 1) ? argv[1] : std::filesystem::temp_directory_path().string();
+    // each frame is a whole number of lines, so the frames joined are the plain text
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    std::vector<std::string> frames(CHECK_FRAMES);
+    char line[64];
+    for(size_t i = 0; i < CHECK_POINTS; i++)
+    {
+        snprintf(line, sizeof(line), "%.4f %.4f %.4f\n", coordinate(random), coordinate(random), coordinate(random));
+        frames[i * CHECK_FRAMES / CHECK_POINTS] += line;
+    }
+    std::string whole_path = directory + "/check_compressed_whole.txt";
+    std::string first_path = directory + "/check_compressed_first.txt";
+    std::string whole_text;
+    for(auto& frame : frames)
+        whole_text += frame;
+    if(!WriteFile(whole_path, whole_text) || !WriteFile(first_path, frames[0]))
+    {
+        printf("Failed to write to %s\n", directory.c_str());
+        return 1;
+    }
+    for(bool out_of_core : {false, true})
+    {
+        auto whole = Load(whole_path, out_of_core);
+        auto first = Load(first_path, out_of_core);
+        if(whole->HasFailedToLoad() || first->HasFailedToLoad())
+        {
+            Fail("plain text failed to load");
+            break;
+        }
+#ifdef POINTS_HAS_ZLIB
+        CheckFormat("gzip", directory, frames, *whole, *first, out_of_core, [](const std::string& text)
+            {
+                z_stream stream = {};
+                // 16 + window bits writes a gzip header and trailer
+                deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+                std::string out(deflateBound(&stream, text.size()), '\0');
+                stream.next_in = (Bytef*)text.data();
+                stream.avail_in = text.size();
+                stream.next_out = (Bytef*)out.data();
+                stream.avail_out = out.size();
+                deflate(&stream, Z_FINISH);
+                out.resize(stream.total_out);
+                deflateEnd(&stream);
+                return out;
+            });
+#endif
+#ifdef POINTS_HAS_ZSTD
+        CheckFormat("zstd", directory, frames, *whole, *first, out_of_core, [](const std::string& text)
+            {
+                std::string out(ZSTD_compressBound(text.size()), '\0');
+                out.resize(ZSTD_compress(out.data(), out.size(), text.data(), text.size(), 3));
+                return out;
+            });
+#endif
+        RemoveLoadFiles(whole_path);
+        RemoveLoadFiles(first_path);
+    }
+    std::filesystem::remove(whole_path);
+    std::filesystem::remove(first_path);
+#if !defined(POINTS_HAS_ZLIB) && !defined(POINTS_HAS_ZSTD)
+    printf("Built without zlib and libzstd, nothing to check\n");
+#endif
+    printf("%s\n", (failures == 0) ? "All checks passed" : "Some checks failed");
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+// Micro-benchmark for the text parser paths
+// Verifies every available path against strtof and reports single-threaded throughput
+//
+// Usage: bench_parser [files...] (defaults to test_data/data_*.txt)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "TextParser.hpp"
+#include "TextTokenizer.hpp"
+
+constexpr int REPEATS = 20;
+
+// Reference values, straight from strtof
+static bool ParseReference(const char* data, size_t size, std::vector<float>& out)
+{
+    std::string text(data, size);
+    const char* p = text.c_str();
+    while(true)
+    {
+        while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if(*p == 0)
+            return true;
+        char* next;
+        float v = strtof(p, &next);
+        if(next == p)
+            return false;
+        out.push_back(v);
+        p = next;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> files;
+    for(int i = 1; i < argc; i++)
+        files.push_back(argv[i]);
+    if(files.size() == 0)
+    {
+        for(int i = 1; i <= 5; i++)
+            files.push_back("test_data/data_" + std::to_string(i) + ".txt");
+    }
+    const TextParserPath paths[] = {TextParserPath::Scalar, TextParserPath::SSE2, TextParserPath::AVX2};
+    printf("Detected path: %s\n", GetTextParserPathName(DetectTextParserPath()));
+    int failures = 0;
+    for(auto& path : files)
+    {
+        MappedFile file;
+        if(!file.Open(path))
+        {
+            printf("%s: failed to open\n", path.c_str());
+            failures++;
+            continue;
+        }
+        std::vector<float> reference;
+        if(!ParseReference(file.GetData(), file.GetSize(), reference))
+        {
+            printf("%s: strtof failed to parse the file\n", path.c_str());
+            failures++;
+            continue;
+        }
+        for(auto parser_path : paths)
+        {
+            const char* name = GetTextParserPathName(parser_path);
+            if(!IsTextParserPathSupported(parser_path))
+            {
+                printf("%s: %-6s unsupported\n", path.c_str(), name);
+                continue;
+            }
+            std::vector<float> values;
+            values.reserve(reference.size());
+            double best = 1e30;
+            bool exact = true;
+            for(int i = 0; i < REPEATS; i++)
+            {
+                values.clear();
+                auto t0 = std::chrono::steady_clock::now();
+                auto error = ParseTextChunkWithPath(parser_path, file.GetData(), file.GetData() + file.GetSize(), values);
+                auto t1 = std::chrono::steady_clock::now();
+                best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+                if(error != TextParseError::None)
+                    exact = false;
+            }
+            exact = exact && values.size() == reference.size()
+                && memcmp(values.data(), reference.data(), values.size() * sizeof(float)) == 0;
+            if(!exact)
+                failures++;
+            printf("%s: %-6s %7.3f GB/s %s\n", path.c_str(), name, double(file.GetSize()) / best / 1e9,
+                exact ? "bit-exact" : "MISMATCH");
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// Benchmark of the statistics pass against the original two sequential loops
+// The test data is tiled (with a small offset per copy) up to the requested number of points
+//
+// Usage: bench_stats [points (default 100000000)] [source file (default test_data/data_1.txt)]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "RedCppLib/RedCppLib.hpp"
+
+using namespace Red;
+
+#include "MappedFile.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "TextTokenizer.hpp"
+#include "PointStats.hpp"
+
+volatile float loading_state_compute[2];
+
+// The loops LoadFile used before PointStats, progress writes included
+static PointStats LegacyStats(std::vector<vec3<float>>& points)
+{
+    PointStats stats;
+    stats.bounding_box_high = points[0];
+    stats.bounding_box_low = points[0];
+    for(int i = 0; i < points.size(); i++)
+    {
+        auto& p = points[i];
+        stats.center_average += p/float(points.size());
+        float l = p.length();
+        if(l > stats.furthest_point_zero_distance)
+            stats.furthest_point_zero_distance = l;
+        stats.bounding_box_high = p.max(stats.bounding_box_high);
+        stats.bounding_box_low = p.min(stats.bounding_box_low);
+        loading_state_compute[0] = float(i)/float(points.size());
+    }
+    stats.center_bounding = (stats.bounding_box_low + stats.bounding_box_high) / 2.0f;
+    for(int i = 0; i < points.size(); i++)
+    {
+        auto p = points[i] - stats.center_average;
+        float l = p.length();
+        if(l > stats.furthest_point_center_distance)
+            stats.furthest_point_center_distance = l;
+        loading_state_compute[1] = float(i)/float(points.size());
+    }
+    return stats;
+}
+
+static void Print(const char* name, double seconds, size_t n, PointStats& s)
+{
+    printf("%-8s %8.1f ms %8.1f Mpoints/s  center (%f %f %f) low (%f %f %f) high (%f %f %f) furthest zero %f center %f\n",
+        name, seconds * 1e3, double(n) / seconds / 1e6,
+        s.center_average.x, s.center_average.y, s.center_average.z,
+        s.bounding_box_low.x, s.bounding_box_low.y, s.bounding_box_low.z,
+        s.bounding_box_high.x, s.bounding_box_high.y, s.bounding_box_high.z,
+        s.furthest_point_zero_distance, s.furthest_point_center_distance);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 100000000;
+    std::string source = (argc > 2) ? argv[2] : "test_data/data_1.txt";
+    MappedFile file;
+    std::vector<float> values;
+    if(!file.Open(source) || ParseTextChunk(file.GetData(), file.GetData() + file.GetSize(), values) != TextParseError::None
+        || values.size() == 0)
+    {
+        printf("Failed to load %s\n", source.c_str());
+        return 1;
+    }
+    size_t n_source = values.size() / 3;
+    std::vector<vec3<float>> points(n);
+    ParallelFor((n + n_source - 1) / n_source, [&](size_t copy)
+    {
+        float offset = float(copy % 1000) * 0.001f;
+        for(size_t i = copy * n_source; i < std::min(n, (copy + 1) * n_source); i++)
+        {
+            size_t s = (i % n_source) * 3;
+            points[i] = vec3<float>{values[s] + offset, values[s+1] - offset, values[s+2] + offset};
+        }
+    });
+    printf("%zu points, %zu threads\n", n, GetWorkerCount());
+
+    auto t0 = std::chrono::steady_clock::now();
+    PointStats legacy = LegacyStats(points);
+    auto t1 = std::chrono::steady_clock::now();
+    PointStats fused = ComputePointStats(points.data(), points.size());
+    auto t2 = std::chrono::steady_clock::now();
+    Print("legacy", std::chrono::duration<double>(t1 - t0).count(), n, legacy);
+    Print("fused", std::chrono::duration<double>(t2 - t1).count(), n, fused);
+    return 0;
+}
@@ -0,0 +1,221 @@
+// Headless batch processing: loads files through PointProcessor and prints their statistics and section counts as JSON
+// One JSON object per line and per file, in the order the files were given, so the output can be streamed
+// Several files load at once, each one also splitting across all cores, which keeps every core busy
+// between the sequential parts of the loads
+//
+// Usage: points-cli [--sections a,b,...] [--jobs n] [--out-of-core] [--trace file] files...
+//   --sections   like the GUI's: the first value is where the first section ends, every other one is a length,
+//                a last section out to infinity is always added (default -1,1.5)
+//   --jobs       files loaded at the same time (default: one per core)
+//   --out-of-core  load every file through the paged layout, see PagedCloud.hpp
+//   --trace      writes the timings of the loading phases to file in the Chrome trace format, see Trace.hpp
+// The exit code is 0 if every file loaded, 1 if any failed and 2 for invalid arguments
+
+#include "hcore.hpp"
+
+#include <stdlib.h>
+#include <limits>
+
+using namespace std;
+
+static void PrintUsage()
+{
+    fprintf(stderr, "Usage: points-cli [--sections a,b,...] [--jobs n] [--out-of-core] [--trace file] files...\n");
+}
+
+static void WriteJsonString(string s)
+{
+    putchar('"');
+    for(unsigned char c : s)
+    {
+        if(c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if(c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+// JSON has no infinities or NaNs
+static void WriteJsonNumber(double v)
+{
+    if(std::isfinite(v))
+        printf("%.9g", v);
+    else
+        printf("null");
+}
+
+static void WriteJsonVec3(vec3<float> v)
+{
+    printf("[");
+    WriteJsonNumber(v.x);
+    printf(", ");
+    WriteJsonNumber(v.y);
+    printf(", ");
+    WriteJsonNumber(v.z);
+    printf("]");
+}
+
+// Origins are doubles (and always finite), 17 digits round trip them
+static void WriteJsonVec3(vec3<double> v)
+{
+    printf("[%.17g, %.17g, %.17g]", v.x, v.y, v.z);
+}
+
+static bool ParseSections(string text, vector<float>& sections)
+{
+    sections.clear();
+    size_t begin = 0;
+    while(begin <= text.size())
+    {
+        size_t end = text.find(',', begin);
+        if(end == string::npos)
+            end = text.size();
+        string value = text.substr(begin, end - begin);
+        char* value_end;
+        float v = strtof(value.c_str(), &value_end);
+        if(value.empty() || *value_end != 0 || !std::isfinite(v))
+            return false;
+        // every section but the first is a length
+        if(!sections.empty() && v < 0.0f)
+            return false;
+        sections.push_back(v);
+        begin = end + 1;
+    }
+    return true;
+}
+
+// Prints the result of one file, returns whether it loaded
+static bool WriteResult(string path, PointProcessor* processor, vector<float>& sections)
+{
+    printf("{\"file\": ");
+    WriteJsonString(path);
+    if(processor == nullptr)
+    {
+        printf(", \"ok\": false, \"error\": \"File does not exist\"}\n");
+        return false;
+    }
+    processor->Lock();
+    if(processor->HasFailedToLoad())
+    {
+        printf(", \"ok\": false, \"error\": ");
+        WriteJsonString(processor->GetLoadFailureError());
+        printf("}\n");
+        processor->Unlock();
+        return false;
+    }
+    assert(processor->IsLoaded());
+    processor->SetSections(sections);
+    auto indices = processor->GetSectionIndices();
+    printf(", \"ok\": true, \"points\": %zu, \"file_size\": %zu, \"out_of_core\": %s, \"load_time\": ",
+        processor->GetNPoints(), processor->GetFileSize(), processor->IsOutOfCore() ? "true" : "false");
+    WriteJsonNumber(processor->GetLoadTime());
+    // everything below is relative to the origin
+    printf(", \"origin\": ");
+    WriteJsonVec3(processor->GetOrigin());
+    printf(", \"bounding_box_low\": ");
+    WriteJsonVec3(processor->GetBoundingBoxLow());
+    printf(", \"bounding_box_high\": ");
+    WriteJsonVec3(processor->GetBoundingBoxHigh());
+    printf(", \"center_average\": ");
+    WriteJsonVec3(processor->GetCenterAverage());
+    printf(", \"center_bounding\": ");
+    WriteJsonVec3(processor->GetCenterBounding());
+    printf(", \"furthest_distance_from_zero\": ");
+    WriteJsonNumber(processor->GetFurthestDistanceFromZero());
+    printf(", \"furthest_distance_from_center\": ");
+    WriteJsonNumber(processor->GetFurthestDistanceFromCenter());
+    // the same boundaries and counts the GUI shows
+    printf(", \"sections\": [");
+    float end = 0.0f;
+    size_t section_pos = 0;
+    for(size_t i = 0; i < indices.size(); i++)
+    {
+        end += sections[i];
+        printf("%s{\"end\": ", (i == 0) ? "" : ", ");
+        WriteJsonNumber(end);
+        printf(", \"points\": %zu}", indices[i] - section_pos);
+        section_pos = indices[i];
+    }
+    printf("]}\n");
+    processor->Unlock();
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Trace::Get().SetThreadName("Main");
+    vector<float> sections = {-1.0f, 1.5f};
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool out_of_core = false;
+    string trace_path;
+    vector<string> paths;
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if(arg == "--sections" && i + 1 < argc)
+        {
+            if(!ParseSections(argv[++i], sections))
+            {
+                fprintf(stderr, "Invalid sections: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if(arg == "--jobs" && i + 1 < argc)
+        {
+            jobs = strtoul(argv[++i], nullptr, 10);
+            if(jobs == 0)
+            {
+                fprintf(stderr, "Invalid number of jobs: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if(arg == "--out-of-core")
+            out_of_core = true;
+        else if(arg == "--trace" && i + 1 < argc)
+            trace_path = argv[++i];
+        else if(arg.size() > 1 && arg[0] == '-' && arg[1] == '-')
+        {
+            PrintUsage();
+            return 2;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if(paths.empty())
+    {
+        PrintUsage();
+        return 2;
+    }
+    // the last section goes out to infinity
+    sections.push_back(std::numeric_limits<float>::infinity());
+
+    // up to jobs files are in flight, results come out in order as the oldest one finishes
+    deque<unique_ptr<PointProcessor>> in_flight;
+    size_t next = 0;
+    size_t written = 0;
+    bool all_loaded = true;
+    while(written < paths.size())
+    {
+        while(next < paths.size() && in_flight.size() < jobs)
+        {
+            // without a window there is nobody to show a preview to
+            if(std::filesystem::is_regular_file(paths[next]))
+                in_flight.push_back(make_unique<PointProcessor>(paths[next], out_of_core, false));
+            else
+                in_flight.push_back(nullptr);
+            next++;
+        }
+        if(in_flight.front() != nullptr)
+            in_flight.front()->WaitForLoad();
+        all_loaded = WriteResult(paths[written], in_flight.front().get(), sections) && all_loaded;
+        fflush(stdout);
+        in_flight.pop_front();
+        written++;
+    }
+    if(!trace_path.empty() && !Trace::Get().WriteChromeTrace(trace_path))
+        fprintf(stderr, "Failed to write the trace to %s\n", trace_path.c_str());
+    return all_loaded ? 0 : 1;
+}
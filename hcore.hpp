@@ -0,0 +1,44 @@
+#pragma once
+
+// Everything that does not need a window or a GL context: loading, indexing and section counting
+// points-cli builds against this alone, hmain.hpp adds the GUI and the renderer on top
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <bit>
+
+#include "RedCppLib/RedCppLib.hpp"
+
+using namespace Red;
+
+#include "Trace.hpp"
+#include "MappedFile.hpp"
+#include "BinaryFileWriter.hpp"
+#include "JobSystem.hpp"
+#include "Parallel.hpp"
+#include "TextParser.hpp"
+#include "TextTokenizer.hpp"
+#include "RadixSort.hpp"
+#include "Octree.hpp"
+#include "Frustum.hpp"
+#include "Lod.hpp"
+#include "PointCache.hpp"
+#include "PointStats.hpp"
+#include "PagedCloud.hpp"
+#include "PlyFile.hpp"
+#include "LasFile.hpp"
+#include "PcdFile.hpp"
+#include "NpyFile.hpp"
+#include "CompressedText.hpp"
+
+#include "PointProcessor.hpp"
@@ -24,20 +24,10 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
-#include <stdio.h>
-#include <vector>
-#include <string>
-#include <memory>
-#include <mutex>
-#include <condition_variable>
-#include <filesystem>
-#include <thread>
-#include <algorithm>
-
-#include "RedCppLib/RedCppLib.hpp"
-
-using namespace Red;
+#include "hcore.hpp"
 
 #include "camera.hpp"
 
-#include "PointProcessor.hpp"
\ No newline at end of file
+#include "PointRenderer.hpp"
+#include "PointSequence.hpp"
+#include "PerformanceMonitor.hpp"
\ No newline at end of file
@@ -16,12 +16,42 @@ constexpr float SLICE_QUAD_SIZE = 20;
 
 GLFWwindow* window;
 shared_ptr<OrbitCamera> camera;
+shared_ptr<PointRenderer> renderer;
+shared_ptr<PerformanceMonitor> performance;
+// what drawing the Performance window itself took last frame
+float performance_window_ms = 0.0f;
 int display_w, display_h; 
 shared_ptr<PointProcessor> current_points = nullptr;
 vector<shared_ptr<PointProcessor>> loading_points;
 vector<shared_ptr<PointProcessor>> open_points;
 vector<shared_ptr<PointProcessor>> failed_to_load_points;
 bool must_update_vbos = false;
+// --out-of-core, loads every file in paged mode regardless of its size
+bool force_out_of_core = false;
+// played instead of the open files while set
+shared_ptr<PointSequence> sequence = nullptr;
+char sequence_pattern[512] = "";
+string sequence_error;
+// the camera follows the preview of a loading file while its extent grows
+PointProcessor* previewed_points = nullptr;
+float preview_fit_distance = 0.0f;
+// --trace <file>, the trace is written there on exit; "Save trace" writes it there too
+string trace_path = "points_trace.json";
+bool trace_on_exit = false;
+string trace_status;
+// exports in the Tools window: export_path is the name without extension, "Export PLY" writes <name>.ply,
+// "Export NPY" <name>.npy and "Export indices" <name>_indices.npy; section -1 exports every point
+// One export runs at a time as a background job, export_status says how the last one went
+char export_path[512] = "export";
+int export_section = -1;
+string export_status;
+JobCounter export_job;
+// the cloud of the running export, released here once export_job is done so it never goes away on a worker
+shared_ptr<PointProcessor> export_points = nullptr;
+string export_target;
+// written by the export job, read once export_job is done
+bool export_ok = false;
+string export_error;
 bool slice_quads_enabled = false;
 float slice_quads_opacity = 0.1f;
 
@@ -41,87 +71,78 @@ void SetCurrentPoints(shared_ptr<PointProcessor> points)
 
 void Render3D()
 {
+    TraceScope trace("Render3D");
     glClearColor(0.05, 0.05, 0.05, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
-    
-    // Compute view matrices
-    auto view = camera->GetModelViewMatrix();
-    glMatrixMode(GL_MODELVIEW);
-    glLoadMatrixf(&view[0].x);
-    auto perspective = camera->GetProjectionMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf(&perspective[0].x);        
 
-    static GLuint point_buffer = 0;
+    // Upload data to the GPU, streamed over several frames
+    if(must_update_vbos)
+    {
+        renderer->SetCurrent(current_points);
+        must_update_vbos = false;
+    }
+    renderer->ContinueUpload();
+    renderer->ContinuePreview();
 
-    if(current_points != nullptr)
+    if(current_points != nullptr || renderer->HasPreview())
     {
-        // Upload data to the GPU
-        if(must_update_vbos)
-        {
-            vector<vec3<float>> points;
-            current_points->GetPointsSorted(&points);
-            if(point_buffer != 0)
-            {
-                glDeleteBuffers(1, &point_buffer);
-            }
-            glGenBuffers(1, &point_buffer);
-            glBindBuffer(GL_ARRAY_BUFFER, point_buffer);
-            glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(points[0]), &points[0], GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-        }
 
-        // Render points
-        if(point_buffer != 0)
-        {
-            current_points->Lock();
-            vector<size_t> indices = current_points->GetSectionIndices();
-            current_points->Unlock();
-            glBindBuffer(GL_ARRAY_BUFFER, point_buffer);
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glVertexPointer(3, GL_FLOAT, 0, NULL);
-            size_t pos = 0;
-            for(size_t i = 0; i < indices.size(); i++)
-            {
-                auto color = section_colors[i];
-                glColor3f(color.x, color.y, color.z);
-                glDrawArrays(GL_POINTS, pos, indices[i]);
-                pos = indices[i];
-            }
-        }
+        // section edits only change uniforms
+        renderer->SetSections(sections, section_colors);
+        glm::mat4 view = camera->GetModelViewMatrix();
+        glm::mat4 projection = camera->GetProjectionMatrix();
+        glm::mat4 view_projection = projection * view;
+        renderer->Render(view, projection, display_w, display_h);
 
         // Render section slices
         if(slice_quads_enabled)
-        {
-            float pos = 0.0f;
-            for(int i = 0; i < sections.size(); i++)
-            {
-                pos += sections[i];
-                vec3<float> p0 = {-SLICE_QUAD_SIZE, -SLICE_QUAD_SIZE, pos};
-                vec3<float> p1 = {SLICE_QUAD_SIZE, -SLICE_QUAD_SIZE, pos};
-                vec3<float> p2 = {SLICE_QUAD_SIZE, SLICE_QUAD_SIZE, pos};
-                vec3<float> p3 = {-SLICE_QUAD_SIZE, SLICE_QUAD_SIZE, pos};
-                auto color = section_colors[i];
-                glBegin(GL_TRIANGLES);
-                {
-                    glColor4f(color.x, color.y, color.z, slice_quads_opacity);
-                    glVertex3f(p0.x, p0.y, p0.z);
-                    glVertex3f(p1.x, p1.y, p1.z);
-                    glVertex3f(p2.x, p2.y, p2.z);
-
-                    glVertex3f(p2.x, p2.y, p2.z);
-                    glVertex3f(p3.x, p3.y, p3.z);
-                    glVertex3f(p0.x, p0.y, p0.z);
-                }
-                glEnd();
-            }
-        }
+            renderer->RenderSeparators(view_projection, SLICE_QUAD_SIZE, slice_quads_opacity);
     }    
 }
 
 void OpenFile(string path)
 {
-    loading_points.push_back(std::make_shared<PointProcessor>(path));
+    loading_points.push_back(std::make_shared<PointProcessor>(path, force_out_of_core));
+}
+
+// pattern is a directory or a glob like test_data/data_*.txt
+void OpenSequence(string pattern)
+{
+    auto files = FindSequenceFiles(pattern);
+    if(files.empty())
+    {
+        sequence_error = "No files match " + pattern;
+        return;
+    }
+    sequence_error.clear();
+    sequence = std::make_shared<PointSequence>(files);
+    current_points = nullptr;
+    must_update_vbos = true;
+}
+
+void CloseSequence()
+{
+    sequence = nullptr;
+    current_points = nullptr;
+    must_update_vbos = true;
+}
+
+void UpdateSequence()
+{
+    TraceScope trace("UpdateSequence");
+    if(sequence == nullptr)
+        return;
+    auto points = sequence->Update(*renderer, sections);
+    if(points == nullptr)
+        return;
+    // the camera is only fitted to the first frame, it stays put during playback
+    if(current_points == nullptr)
+        SetCurrentPoints(points);
+    else
+    {
+        current_points = points;
+        must_update_vbos = true;
+    }
 }
 
 bool IsLoading()
@@ -157,6 +178,16 @@ string BytesToReadableString(size_t bytes)
     return to_string(bytes) + prefixes[pos];
 }
 
+// Takes the result of the export job once it is done, called every frame
+void FinishExport()
+{
+    if(export_points != nullptr && export_job.IsDone())
+    {
+        export_status = export_ok ? "Exported to " + export_target : export_error;
+        export_points = nullptr;
+    }
+}
+
 void RenderToolsWindow()
 {
     // for brevity
@@ -167,8 +198,44 @@ void RenderToolsWindow()
         ImGui::Text("Info:");
         ImGui::Text("File size: %s", BytesToReadableString(cp->GetFileSize()).c_str());
         ImGui::SameLine();
-        ImGui::Text("Memory used: %s", BytesToReadableString(cp->GetMemoryUsage()).c_str());
+        if(cp->IsOutOfCore())
+            ImGui::Text("Memory used: %s of %s (out-of-core)", BytesToReadableString(cp->GetResidentMemoryUsage()).c_str(),
+                BytesToReadableString(cp->GetMemoryUsage()).c_str());
+        else
+            ImGui::Text("Memory used: %s", BytesToReadableString(cp->GetMemoryUsage()).c_str());
+        ImGui::SameLine();
+        ImGui::Text("GPU memory used: %s", BytesToReadableString(renderer->GetMemoryUsage(cp.get())).c_str());
+        ImGui::Text("GPU memory used by all files: %s", BytesToReadableString(renderer->GetTotalMemoryUsage()).c_str());
+        // least recently viewed files are evicted past this
+        int budget_mb = int(renderer->GetMemoryBudget() >> 20);
+        if(ImGui::SliderInt("GPU budget (MB)", &budget_mb, 64, 16384))
+            renderer->SetMemoryBudget(size_t(budget_mb) << 20);
         ImGui::Text("Points: %lu", cp->GetNPoints());
+        vec3<double> origin = cp->GetOrigin();
+        if(cp->HasOrigin())
+            ImGui::Text("Origin: %.3f, %.3f, %.3f (coordinates are relative to it)", origin.x, origin.y, origin.z);
+        bool lod = renderer->IsLodEnabled();
+        if(ImGui::Checkbox("Level of detail", &lod))
+            renderer->SetLodEnabled(lod);
+        if(lod)
+        {
+            // in thousands of points
+            int budget = int(renderer->GetPointBudget() / 1000);
+            if(ImGui::SliderInt("Point budget (K/frame)", &budget, 100, 50000))
+                renderer->SetPointBudget(size_t(budget) * 1000);
+            ImGui::Text("Drawn this frame: %lu, shown: %lu of %lu in view", renderer->GetDrawnPoints(),
+                renderer->GetLodShownPoints(), renderer->GetLodVisiblePoints());
+        }
+        else
+            ImGui::Text("Drawn this frame: %lu", renderer->GetDrawnPoints());
+        if(cp->GetOctreeBuildTime() > 0.0f)
+            ImGui::Text("Octree: %lu nodes, index memory: %s, built in %.0f ms", cp->GetOctree().size(),
+                BytesToReadableString(cp->GetIndexMemoryUsage()).c_str(), cp->GetOctreeBuildTime() * 1000.0f);
+        else
+            ImGui::Text("Octree: %lu nodes, index memory: %s, from cache", cp->GetOctree().size(),
+                BytesToReadableString(cp->GetIndexMemoryUsage()).c_str());
+        if(renderer->IsUploading())
+            ImGui::ProgressBar(renderer->GetUploadProgress(), ImVec2(-FLT_MIN, 0), "Uploading to GPU");
         ImGui::Separator();
         static int csi = 1;
         ImGui::RadioButton("Center of points", &csi, 0);
@@ -233,13 +300,70 @@ void RenderToolsWindow()
             sections[sections.size()-1] = 10000.0f;
             cp->SetSections(sections);
         }
-        if(ImGui::Button("Add"))
+        if(sections.size() < PointRenderer::MAX_SECTIONS && ImGui::Button("Add"))
         {
             sections[sections.size()-1] = sections[sections.size()-2] * 2;
             sections.push_back(10000.0f);
             section_colors.push_back({1.0f, 1.0f, 1.0f});
             cp->SetSections(sections);
         }
+        ImGui::Separator();
+        export_section = std::min(export_section, int(sections.size()) - 1);
+        string export_label = (export_section < 0) ? "All points" : "Section " + to_string(export_section);
+        ImGui::SetNextItemWidth(150.0f);
+        if(ImGui::BeginCombo("##export_section", export_label.c_str()))
+        {
+            for(int i = -1; i < int(sections.size()); i++)
+            {
+                string label = (i < 0) ? "All points" : "Section " + to_string(i);
+                if(ImGui::Selectable(label.c_str(), i == export_section))
+                    export_section = i;
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(250.0f);
+        ImGui::InputText("##export_path", export_path, sizeof(export_path));
+        ImGui::SameLine();
+        // the same boundaries the section counts use, the last section goes out to infinity
+        float z_above = -std::numeric_limits<float>::infinity();
+        float z_up_to = std::numeric_limits<float>::infinity();
+        if(export_section >= 0)
+        {
+            float pos = 0.0f;
+            for(int i = 0; i <= export_section; i++)
+            {
+                if(i == export_section && i != 0)
+                    z_above = pos;
+                pos += sections[i];
+            }
+            if(export_section != int(sections.size()) - 1)
+                z_up_to = pos;
+        }
+        auto start_export = [&](string path, bool (PointProcessor::*export_fn)(string, float, float, string&))
+        {
+            export_points = cp;
+            export_target = path;
+            JobSystem::Get().Submit(JobPriority::Low, &export_job, [points = cp.get(), export_fn, path, z_above, z_up_to]()
+            {
+                export_ok = (points->*export_fn)(path, z_above, z_up_to, export_error);
+            });
+        };
+        ImGui::BeginDisabled(export_points != nullptr);
+        if(ImGui::Button("Export PLY"))
+            start_export(string(export_path) + ".ply", &PointProcessor::ExportPly);
+        ImGui::SameLine();
+        if(ImGui::Button("Export NPY"))
+            start_export(string(export_path) + ".npy", &PointProcessor::ExportNpy);
+        ImGui::SameLine();
+        // indices of the section's points in the file
+        if(ImGui::Button("Export indices"))
+            start_export(string(export_path) + "_indices.npy", &PointProcessor::ExportIndicesNpy);
+        ImGui::EndDisabled();
+        if(export_points != nullptr)
+            ImGui::Text("Exporting to %s... %.0f%%", export_target.c_str(), export_points->ExportState() * 100.0f);
+        else if(!export_status.empty())
+            ImGui::Text("%s", export_status.c_str());
     }
     ImGui::End();
 }
@@ -270,6 +394,8 @@ void RenderFilesWindow()
                     if(ImGui::Selectable(sid.c_str(), is_selected, ImGuiSelectableFlags_AllowOverlap))
                     {
                         file_selected = i;
+                        if(sequence != nullptr)
+                            CloseSequence();
                     }
                     ImGui::SameLine(232);
                     string bid = "X##" + to_string(i);
@@ -280,7 +406,7 @@ void RenderFilesWindow()
                     
                 }
                 ImGui::EndListBox();
-                if(file_selected < open_points.size() && open_points[file_selected] != current_points)
+                if(sequence == nullptr && file_selected < open_points.size() && open_points[file_selected] != current_points)
                     SetCurrentPoints(open_points[file_selected]);
                 for(int i = 0; i < to_delete.size(); i++)
                 {
@@ -290,9 +416,12 @@ void RenderFilesWindow()
                             open_points.erase(open_points.begin() + ii);
                     }
                     if(to_delete[i] == current_points)
+                    {
                         current_points = nullptr;
+                        must_update_vbos = true;
+                    }
                 }
-                if(current_points == nullptr && open_points.size() > 0)
+                if(sequence == nullptr && current_points == nullptr && open_points.size() > 0)
                     SetCurrentPoints(open_points[0]);
             }
         }
@@ -304,6 +433,22 @@ void RenderFilesWindow()
             config.path = ".";
             ImGuiFileDialog::Instance()->OpenDialog(POPUP_OPEN_FILE, "Choose File", ".*", config);
         }
+        ImGui::Separator();
+        ImGui::Text("Sequence (directory or glob):");
+        ImGui::InputText("##sequence", sequence_pattern, sizeof(sequence_pattern));
+        if(ImGui::Button("Play sequence"))
+            OpenSequence(sequence_pattern);
+        if(!sequence_error.empty())
+            ImGui::Text("%s", sequence_error.c_str());
+        ImGui::Separator();
+        // the most recent loads, uploads and frames, for chrome://tracing
+        if(ImGui::Button("Save trace"))
+            trace_status = Trace::Get().WriteChromeTrace(trace_path) ? "Saved to " + trace_path : "Failed to write " + trace_path;
+        if(!trace_status.empty())
+        {
+            ImGui::SameLine();
+            ImGui::Text("%s", trace_status.c_str());
+        }
         if (ImGuiFileDialog::Instance()->Display(POPUP_OPEN_FILE, 32, {500.0f, 500.0f})) 
         {
             if (ImGuiFileDialog::Instance()->IsOk()) 
@@ -350,9 +495,29 @@ void RenderLoadingPopups()
                 }
                 it->Unlock();
             }
-            if(!ImGui::IsPopupOpen(POPUP_LOADING))
-            {          
-                ImGui::OpenPopup(POPUP_LOADING);
+            // the first file becomes the current one, it is shown while it loads
+            if(loading_points.size() > 0)
+            {
+                auto first = loading_points[0];
+                first->Lock();
+                bool failed_first = first->HasFailedToLoad();
+                first->Unlock();
+                if(failed_first)
+                    renderer->SetPreview(nullptr);
+                else if(first.get() != previewed_points)
+                {
+                    renderer->SetPreview(first);
+                    previewed_points = first.get();
+                    preview_fit_distance = 0.0f;
+                }
+                vec3<float> low, high;
+                float furthest;
+                if(!failed_first && first->GetPreviewBounds(low, high, furthest) && furthest > preview_fit_distance * 1.1f)
+                {
+                    preview_fit_distance = furthest;
+                    camera->SetDistance(furthest * 3.0f);
+                    camera->SetCenter(vec3<float>{(low.x + high.x) * 0.5f, (low.y + high.y) * 0.5f, (low.z + high.z) * 0.5f});
+                }
             }
             if(completed == loading_points.size())
             {
@@ -379,14 +544,15 @@ void RenderLoadingPopups()
             }
         }
     }
-    if(ImGui::BeginPopupModal(POPUP_LOADING, nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+    // not modal, the files can be looked at while they load
+    if(loading_finished)
     {
-        if(loading_finished)
-        {
-            loading_points.clear();
-            ImGui::CloseCurrentPopup();
-        }
-        else
+        loading_points.clear();
+        previewed_points = nullptr;
+    }
+    else if(loading_points.size() > 0 && !ImGui::IsPopupOpen(POPUP_LOAD_FAILED))
+    {
+        if(ImGui::Begin(POPUP_LOADING, nullptr, ImGuiWindowFlags_AlwaysAutoResize))
         {
             if(loading_points.size() == 1)
                 ImGui::Text("Loading file: %s", loading_points[0]->GetFileName().c_str());
@@ -407,7 +573,7 @@ void RenderLoadingPopups()
                 loading_state = 0.99;
             ImGui::ProgressBar(loading_state, ImVec2(0.0f, 0.0f));
         }
-        ImGui::EndPopup();
+        ImGui::End();
     }
     if(ImGui::BeginPopupModal(POPUP_LOAD_FAILED, nullptr, ImGuiChildFlags_AlwaysAutoResize))
     {
@@ -434,8 +600,93 @@ void RenderLoadingPopups()
     }
 }
 
+void RenderSequenceWindow()
+{
+    bool close = false;
+    if(ImGui::Begin("Sequence", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        size_t frame = sequence->GetFrame();
+        size_t count = sequence->GetFrameCount();
+        ImGui::Text("Frame %lu/%lu: %s", frame + 1, count,
+            std::filesystem::path(sequence->GetFramePath(frame)).filename().string().c_str());
+        if(ImGui::Button(sequence->IsPlaying() ? "Pause" : "Play"))
+            sequence->SetPlaying(!sequence->IsPlaying());
+        ImGui::SameLine();
+        bool loop = sequence->IsLooping();
+        if(ImGui::Checkbox("Loop", &loop))
+            sequence->SetLooping(loop);
+        ImGui::SameLine();
+        close = ImGui::Button("Close");
+        int seek = int(frame);
+        if(ImGui::SliderInt("Frame", &seek, 0, int(count) - 1))
+            sequence->Seek(size_t(seek));
+        float fps = sequence->GetTargetFps();
+        if(ImGui::SliderFloat("Target FPS", &fps, 1.0f, 120.0f, "%.0f"))
+            sequence->SetTargetFps(fps);
+        int depth = sequence->GetPrefetchDepth();
+        if(ImGui::SliderInt("Prefetch (frames)", &depth, 0, 16))
+            sequence->SetPrefetchDepth(depth);
+        ImGui::Separator();
+        ImGui::Text("Sustained: %.1f FPS, %lu stalls", sequence->GetSustainedFps(), sequence->GetStallCount());
+        ImGui::Text("Per frame: I/O %.1f ms, parse %.1f ms, upload %.1f ms",
+            sequence->GetStageTime(SequenceStage::IO) * 1000.0f, sequence->GetStageTime(SequenceStage::Parse) * 1000.0f,
+            sequence->GetStageTime(SequenceStage::Upload) * 1000.0f);
+        ImGui::Text("Bottleneck: %s", GetSequenceStageName(sequence->GetBottleneck()));
+    }
+    ImGui::End();
+    if(close)
+        CloseSequence();
+}
+
+// Plots a history of the PerformanceMonitor with its latest value and average as the overlay
+void PlotHistory(const char* label, const float* values, int offset, const char* format)
+{
+    float sum = 0.0f;
+    float high = 0.0f;
+    for(int i = 0; i < PerformanceMonitor::HISTORY; i++)
+    {
+        sum += values[i];
+        high = std::max(high, values[i]);
+    }
+    float latest = values[(offset + PerformanceMonitor::HISTORY - 1) % PerformanceMonitor::HISTORY];
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), format, latest, sum / PerformanceMonitor::HISTORY);
+    ImGui::PlotLines(label, values, PerformanceMonitor::HISTORY, offset, overlay, 0.0f, high * 1.1f + 1e-6f, ImVec2(300, 50));
+}
+
+void RenderPerformanceWindow()
+{
+    auto start = std::chrono::steady_clock::now();
+    ImGui::SetNextWindowCollapsed(true, ImGuiCond_FirstUseEver);
+    if(ImGui::Begin("Performance", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
+    {
+        int offset = performance->GetHistoryOffset();
+        PlotHistory("CPU frame", performance->GetCpuTimes(), offset, "%.2f ms (avg %.2f)");
+        if(performance->HasGpuTimer())
+            PlotHistory("GPU frame", performance->GetGpuTimes(), performance->GetGpuHistoryOffset(), "%.2f ms (avg %.2f)");
+        else
+            ImGui::Text("GPU frame: timer queries not supported");
+        PlotHistory("Frame interval", performance->GetFrameIntervals(), offset, "%.2f ms (avg %.2f)");
+        PlotHistory("Points drawn", performance->GetDrawnPoints(), offset, "%.0f (avg %.0f)");
+        PlotHistory("Uploaded", performance->GetUploadedMegabytes(), offset, "%.1f MB (avg %.1f)");
+        ImGui::Text("Queued jobs: %zu urgent, %zu background", JobSystem::Get().GetQueuedJobs(JobPriority::High),
+            JobSystem::Get().GetQueuedJobs(JobPriority::Low));
+        ImGui::Separator();
+        ImGui::Text("Memory per file (RAM / GPU):");
+        for(auto& it : open_points)
+            ImGui::Text("%s: %s / %s", it->GetFileName().c_str(), BytesToReadableString(it->GetResidentMemoryUsage()).c_str(),
+                BytesToReadableString(renderer->GetMemoryUsage(it.get())).c_str());
+        for(auto& it : loading_points)
+            ImGui::Text("%s: loading", it->GetFileName().c_str());
+        ImGui::Text("This window: %.3f ms", performance_window_ms);
+    }
+    ImGui::End();
+    performance_window_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 void RenderGUI()
 {
+    TraceScope trace("RenderGUI");
     ImGui::NewFrame();
 
     // Camera debug info:
@@ -447,9 +698,15 @@ void RenderGUI()
 
     RenderFilesWindow();
 
+    if(sequence != nullptr)
+        RenderSequenceWindow();
+
+    FinishExport();
     if(current_points != nullptr && !IsLoading())
         RenderToolsWindow();
 
+    RenderPerformanceWindow();
+
     // Demo window for figuring out how ImGui works
     //ImGui::ShowDemoWindow(nullptr);
     
@@ -466,6 +723,7 @@ static void glfw_error_callback(int error, const char* description)
 int main(int argc, char** argv)
 {
     printf("Starting points");
+    Trace::Get().SetThreadName("Main");
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 1;
@@ -491,12 +749,11 @@ int main(int argc, char** argv)
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+ only
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // Required on Mac
 #else
-    // GL 3.0 + GLSL 130
-    const char* glsl_version = "#version 130";
+    // GL 3.3 + GLSL 330, core profile, PointRenderer does not use the fixed function pipeline
+    const char* glsl_version = "#version 330";
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
-    //glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+ only
-    //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // 3.0+ only
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+ only
 #endif
 
     // Create window with graphics context
@@ -506,6 +763,8 @@ int main(int argc, char** argv)
         return 1;
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable vsync
+    // needed for glew to load the entry points of a core profile context
+    glewExperimental = GL_TRUE;
     glewInit();
 
     glfwSetScrollCallback(window, HandleMouseScroll);
@@ -536,6 +795,9 @@ int main(int argc, char** argv)
 #endif
     ImGui_ImplOpenGL3_Init(glsl_version);
 
+    renderer = std::make_shared<PointRenderer>(glsl_version);
+    performance = std::make_shared<PerformanceMonitor>();
+
     // OpenFile("./test_data/data_1.txt");
     // OpenFile("./test_data/data_2.txt");
     // OpenFile("./test_data/data_3.txt");
@@ -547,9 +809,27 @@ int main(int argc, char** argv)
 
     if(argc > 1)
     {
+        // flags apply to every file, wherever they are given
         for(int i = 1; i < argc; i++)
         {
-            OpenFile(argv[i]);
+            string arg = argv[i];
+            if(arg == "--out-of-core")
+                force_out_of_core = true;
+            else if(arg == "--trace" && i + 1 < argc)
+            {
+                trace_path = argv[++i];
+                trace_on_exit = true;
+            }
+        }
+        for(int i = 1; i < argc; i++)
+        {
+            string arg = argv[i];
+            if(arg == "--sequence" && i + 1 < argc)
+                OpenSequence(argv[++i]);
+            else if(arg == "--trace" && i + 1 < argc)
+                i++;
+            else if(arg != "--out-of-core")
+                OpenFile(arg);
         }
     }
     
@@ -576,9 +856,12 @@ int main(int argc, char** argv)
             camera->Rotate(io.MouseDelta.x * CAMERA_MOVEMENT_RATE_X, io.MouseDelta.y * CAMERA_MOVEMENT_RATE_Y);
         }
 
+        performance->BeginFrame();
+
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
+        UpdateSequence();
         RenderGUI();
 
 
@@ -588,11 +871,24 @@ int main(int argc, char** argv)
 
         // Now render the gui over the scene
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        performance->EndFrame(renderer->GetDrawnPoints(), renderer->GetUploadedBytes());
         glfwSwapBuffers(window);
 
     }
 
     // Cleanup
+    // the processors wait for their load jobs, which must happen while the JobSystem is still around
+    JobSystem::Get().Wait(export_job);
+    export_points = nullptr;
+    sequence = nullptr;
+    current_points = nullptr;
+    loading_points.clear();
+    open_points.clear();
+    failed_to_load_points.clear();
+    renderer = nullptr;
+    performance = nullptr;
+    if(trace_on_exit && !Trace::Get().WriteChromeTrace(trace_path))
+        fprintf(stderr, "Failed to write the trace to %s\n", trace_path.c_str());
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();